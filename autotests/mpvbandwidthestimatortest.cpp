@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvbandwidthestimator.h"
+#include "mpvratelimiter.h"
+
+#include <QElapsedTimer>
+#include <QTest>
+#include <QThread>
+
+#include <future>
+
+namespace
+{
+// MpvBandwidthArbiter::MinimumRate
+constexpr qint64 MinimumRate = 64 * 1024;
+}
+
+class MpvBandwidthEstimatorTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void probesUpToTheLink();
+    void decaysWhileBelowTheRate();
+};
+
+void MpvBandwidthEstimatorTest::probesUpToTheLink()
+{
+    // the focused player has its readahead full and fetches nothing, the
+    // visible one is throttled and would fetch all the link carries
+    constexpr qint64 LinkRate = 1024 * 1024;
+    constexpr qint64 Chunk = 1024;
+    MpvRateLimiter focused;
+    MpvRateLimiter visible;
+    std::atomic<bool> isCancelled{false};
+    auto fetch = std::async(std::launch::async, [&visible, &isCancelled]() {
+        while (!isCancelled) {
+            // the link takes at least this long for a chunk, never bursting
+            QThread::usleep(Chunk * 1000000 / LinkRate);
+            visible.consume(Chunk, isCancelled);
+        }
+    });
+
+    MpvBandwidthEstimator estimator;
+    QElapsedTimer clock;
+    clock.start();
+    qint64 focusedConsumed = 0;
+    qint64 visibleConsumed = 0;
+    for (int i = 0; i < 40; ++i) {
+        // as the arbiter shares it: only the visible player fetches, all of it is its own
+        visible.setRate(qMax<qint64>(MinimumRate, qint64(estimator.estimate())));
+        QThread::msleep(100);
+        const qint64 elapsed = clock.restart();
+        const qint64 focusedRate = (focused.bytesConsumed() - focusedConsumed) * 1000 / elapsed;
+        const qint64 visibleRate = (visible.bytesConsumed() - visibleConsumed) * 1000 / elapsed;
+        focusedConsumed = focused.bytesConsumed();
+        visibleConsumed = visible.bytesConsumed();
+        estimator.addSamples(elapsed, {{focusedRate, focused.rate()}, {visibleRate, visible.rate()}});
+    }
+    isCancelled = true;
+    visible.wake();
+    fetch.wait();
+
+    // far above the rate it started from, not far above the link
+    QVERIFY(estimator.estimate() > 8 * MinimumRate);
+    QVERIFY(estimator.estimate() < 2 * LinkRate);
+}
+
+void MpvBandwidthEstimatorTest::decaysWhileBelowTheRate()
+{
+    constexpr qint64 Rate = 1000000;
+    MpvBandwidthEstimator estimator;
+    estimator.addSamples(1000, {{0, 0}, {Rate, Rate}});
+    QCOMPARE(estimator.estimate(), Rate * MpvBandwidthEstimator::ProbeFactor);
+
+    // idle players say nothing about the link
+    const double probed = estimator.estimate();
+    estimator.addSamples(10000, {{0, 0}, {0, Rate}});
+    QCOMPARE(estimator.estimate(), probed);
+
+    // fetching less than the rate means the link carries less
+    estimator.addSamples(1000, {{0, 0}, {Rate / 2, qint64(probed)}});
+    QCOMPARE(estimator.estimate(), probed * MpvBandwidthEstimator::Decay);
+    estimator.addSamples(60000, {{0, 0}, {Rate / 2, qint64(probed)}});
+    QCOMPARE(estimator.estimate(), double(Rate / 2));
+}
+
+QTEST_GUILESS_MAIN(MpvBandwidthEstimatorTest)
+
+#include "mpvbandwidthestimatortest.moc"
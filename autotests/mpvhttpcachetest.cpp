@@ -0,0 +1,196 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvhttpcache.h"
+#include "testhttpserver.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QStandardPaths>
+#include <QTest>
+
+#include <future>
+
+namespace
+{
+// false if a read failed
+bool readAll(MpvStream *stream, QByteArray *data)
+{
+    data->clear();
+    char buffer[64 * 1024];
+    while (true) {
+        const qint64 read = stream->read(buffer, sizeof(buffer));
+        if (read <= 0) {
+            return read == 0;
+        }
+        data->append(buffer, read);
+    }
+}
+
+QByteArray randomData(qsizetype size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    QRandomGenerator generator(size);
+    for (char &byte : data) {
+        byte = char(generator.bounded(256));
+    }
+    return data;
+}
+}
+
+class MpvHttpCacheTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void servesRepeatedReadsFromTheCache();
+    void resumesInterruptedFetches();
+    void refetchesChangedSources();
+    void cancelInterruptsTheFirstRead();
+
+private:
+    std::unique_ptr<MpvStream> open(const QString &path);
+
+    TestHttpServer m_server;
+    MpvHttpCache *m_cache{nullptr};
+    // a few blocks and a short one
+    const QByteArray m_content = randomData(40 * MpvHttpCache::BlockSize + 1234);
+};
+
+void MpvHttpCacheTest::initTestCase()
+{
+    QStandardPaths::setTestModeEnabled(true);
+    QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/mpvqt/http")).removeRecursively();
+    m_cache = MpvHttpCache::instance();
+    QVERIFY(!m_cache->isEnabled());
+    m_cache->setEnabled(true);
+}
+
+void MpvHttpCacheTest::cleanupTestCase()
+{
+    m_cache->clear();
+}
+
+std::unique_ptr<MpvStream> MpvHttpCacheTest::open(const QString &path)
+{
+    return MpvHttpCacheProtocol().open(m_server.url(path));
+}
+
+void MpvHttpCacheTest::servesRepeatedReadsFromTheCache()
+{
+    const QString path = QStringLiteral("/hit.mp4");
+    m_server.setFile(path, m_content, "\"hit-1\"");
+    QVERIFY(m_cache->isCacheable(m_server.url(path)));
+
+    QByteArray data;
+    auto stream = open(path);
+    QVERIFY(stream);
+    QCOMPARE(stream->size(), qint64(m_content.size()));
+    QVERIFY(readAll(stream.get(), &data));
+    QCOMPARE(data, m_content);
+    stream.reset();
+    const qsizetype requestCount = m_server.requests(path).size();
+    QCOMPARE(requestCount, qsizetype(1));
+    const qint64 fetched = m_cache->bytesFetched();
+    const qint64 read = m_cache->bytesRead();
+
+    // read again, and seek back within it: all from disk
+    stream = open(path);
+    QVERIFY(stream);
+    QVERIFY(readAll(stream.get(), &data));
+    QCOMPARE(data, m_content);
+    QVERIFY(stream->seek(3 * MpvHttpCache::BlockSize - 10));
+    char buffer[20];
+    QCOMPARE(stream->read(buffer, sizeof(buffer)), qint64(sizeof(buffer)));
+    QCOMPARE(QByteArray(buffer, sizeof(buffer)), m_content.mid(3 * MpvHttpCache::BlockSize - 10, sizeof(buffer)));
+    stream.reset();
+
+    QCOMPARE(m_server.requests(path).size(), requestCount);
+    QCOMPARE(m_cache->bytesFetched(), fetched);
+    QCOMPARE(m_cache->bytesRead(), read + m_content.size() + qint64(sizeof(buffer)));
+}
+
+void MpvHttpCacheTest::resumesInterruptedFetches()
+{
+    const QString path = QStringLiteral("/resume.mp4");
+    m_server.setFile(path, m_content, "\"resume-1\"");
+    // three whole blocks arrive, the fourth one only partly
+    m_server.cutResponses(1, 3 * MpvHttpCache::BlockSize + 1000);
+
+    QByteArray data;
+    auto stream = open(path);
+    QVERIFY(stream);
+    QVERIFY(readAll(stream.get(), &data));
+    QCOMPARE(data, m_content);
+    stream.reset();
+
+    // the fetch resumed at the first block it didn't complete, validated by If-Range
+    const auto requests = m_server.requests(path);
+    QCOMPARE(requests.size(), qsizetype(2));
+    QCOMPARE(requests.at(0).rangeStart, qint64(0));
+    QCOMPARE(requests.at(1).rangeStart, 3 * MpvHttpCache::BlockSize);
+}
+
+void MpvHttpCacheTest::refetchesChangedSources()
+{
+    const QString path = QStringLiteral("/changed.mp4");
+    m_server.setFile(path, m_content.left(10 * MpvHttpCache::BlockSize), "\"changed-1\"");
+    // every response ends after two blocks, most of the source stays uncached
+    m_server.cutResponses(100, 2 * MpvHttpCache::BlockSize);
+    auto stream = open(path);
+    QVERIFY(stream);
+    char buffer[1000];
+    QCOMPARE(stream->read(buffer, sizeof(buffer)), qint64(sizeof(buffer)));
+    stream.reset();
+    m_server.cutResponses(0, 0);
+
+    // fetching the rest, If-Range finds the source changed: the entry is
+    // dropped and the stream fails, like QMpv expects before reopening it
+    const QByteArray changed = randomData(12 * MpvHttpCache::BlockSize);
+    m_server.setFile(path, changed, "\"changed-2\"");
+    QByteArray data;
+    stream = open(path);
+    QVERIFY(stream);
+    QVERIFY(!readAll(stream.get(), &data));
+    stream.reset();
+
+    stream = open(path);
+    QVERIFY(stream);
+    QVERIFY(readAll(stream.get(), &data));
+    QCOMPARE(data, changed);
+}
+
+void MpvHttpCacheTest::cancelInterruptsTheFirstRead()
+{
+    const QString path = QStringLiteral("/slow.mp4");
+    m_server.setFile(path, m_content, "\"slow-1\"");
+    m_server.setResponseDelay(20000);
+
+    // opening doesn't wait for the server
+    QElapsedTimer timer;
+    timer.start();
+    auto stream = open(path);
+    QVERIFY(stream);
+    QVERIFY(timer.elapsed() < 1000);
+
+    auto read = std::async(std::launch::async, [&stream]() {
+        char buffer[1000];
+        return stream->read(buffer, sizeof(buffer));
+    });
+    QVERIFY(read.wait_for(std::chrono::milliseconds(200)) == std::future_status::timeout);
+    stream->cancel();
+    QVERIFY(read.wait_for(std::chrono::seconds(2)) == std::future_status::ready);
+    QCOMPARE(read.get(), qint64(-1));
+    stream.reset();
+    m_server.setResponseDelay(0);
+}
+
+QTEST_GUILESS_MAIN(MpvHttpCacheTest)
+
+#include "mpvhttpcachetest.moc"
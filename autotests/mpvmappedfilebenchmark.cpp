@@ -0,0 +1,220 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvmappedfileprotocol.h"
+#include "mpvratelimiter.h"
+#include "mpvstreamprotocol.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QTest>
+#include <QtEndian>
+
+#include <clocale>
+#include <utility>
+
+#include <mpv/client.h>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+/**
+ * Reads the same file through mpv's file:// and through mpvqt-mmap, from
+ * loadfile until the demuxer reached the end of the file, and reports both.
+ *
+ * Set MPVQT_BENCHMARK_FILE to a media file on the storage to measure, e.g. an
+ * SD card; without it a WAV file is generated in the temporary directory.
+ * MPVQT_BENCHMARK_RUNS sets the runs per protocol, 3 by default. The file is
+ * dropped from the page cache before each run, so they all read from storage.
+ */
+class MpvMappedFileBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void readFile_data();
+    void readFile();
+
+private:
+    void generateFile(const QString &fileName, qint64 size);
+    void dropFromPageCache();
+    // milliseconds until the demuxer read all of @p url, -1 if it failed
+    qint64 readThrough(const QString &url);
+
+    QTemporaryDir m_directory;
+    QString m_fileName;
+    qint64 m_fileSize{0};
+};
+
+void MpvMappedFileBenchmark::initTestCase()
+{
+    // mpv parses numbers with the C locale
+    std::setlocale(LC_NUMERIC, "C");
+
+    m_fileName = qEnvironmentVariable("MPVQT_BENCHMARK_FILE");
+    if (m_fileName.isEmpty()) {
+        QVERIFY(m_directory.isValid());
+        m_fileName = m_directory.filePath(QStringLiteral("benchmark.wav"));
+        generateFile(m_fileName, 256 * 1024 * 1024);
+    }
+    m_fileSize = QFile(m_fileName).size();
+    QVERIFY2(m_fileSize > 0, qPrintable(m_fileName));
+}
+
+void MpvMappedFileBenchmark::generateFile(const QString &fileName, qint64 size)
+{
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    const quint32 dataSize = quint32(size - 44);
+    const auto appendLittleEndian = [](QByteArray &data, auto value) {
+        char bytes[sizeof(value)];
+        qToLittleEndian(value, bytes);
+        data.append(bytes, sizeof(bytes));
+    };
+    // 16 bit stereo PCM at 48 kHz
+    QByteArray header;
+    header.append("RIFF");
+    appendLittleEndian(header, quint32(36 + dataSize));
+    header.append("WAVEfmt ");
+    appendLittleEndian(header, quint32(16));
+    appendLittleEndian(header, quint16(1));
+    appendLittleEndian(header, quint16(2));
+    appendLittleEndian(header, quint32(48000));
+    appendLittleEndian(header, quint32(48000 * 4));
+    appendLittleEndian(header, quint16(4));
+    appendLittleEndian(header, quint16(16));
+    header.append("data");
+    appendLittleEndian(header, dataSize);
+    QVERIFY(file.write(header) == header.size());
+
+    // noise, so no filesystem can store it compressed
+    QByteArray chunk(1024 * 1024, Qt::Uninitialized);
+    QRandomGenerator generator(47);
+    for (qint64 written = 0; written < dataSize; written += chunk.size()) {
+        generator.fillRange(reinterpret_cast<quint32 *>(chunk.data()), chunk.size() / sizeof(quint32));
+        const qint64 length = qMin<qint64>(chunk.size(), dataSize - written);
+        QVERIFY(file.write(chunk.constData(), length) == length);
+    }
+}
+
+void MpvMappedFileBenchmark::dropFromPageCache()
+{
+#ifdef Q_OS_LINUX
+    QFile file(m_fileName);
+    if (file.open(QIODevice::ReadOnly)) {
+        posix_fadvise(file.handle(), 0, 0, POSIX_FADV_DONTNEED);
+    }
+#else
+    static bool isWarned = false;
+    if (!std::exchange(isWarned, true)) {
+        qWarning() << "the file can't be dropped from the page cache, the runs after the first one read it from memory";
+    }
+#endif
+}
+
+qint64 MpvMappedFileBenchmark::readThrough(const QString &url)
+{
+    mpv_handle *mpv = mpv_create();
+    if (!mpv) {
+        return -1;
+    }
+    // the demuxer reads the whole file as fast as it can, into a cache large enough for it
+    mpv_set_option_string(mpv, "vo", "null");
+    mpv_set_option_string(mpv, "ao", "null");
+    mpv_set_option_string(mpv, "pause", "yes");
+    mpv_set_option_string(mpv, "cache", "yes");
+    mpv_set_option_string(mpv, "cache-secs", "10000000");
+    mpv_set_option_string(mpv, "demuxer-readahead-secs", "10000000");
+    mpv_set_option_string(mpv, "demuxer-max-bytes", QByteArray::number(m_fileSize * 2).constData());
+    mpv_set_option_string(mpv, "demuxer-max-back-bytes", "0");
+    if (mpv_initialize(mpv) < 0) {
+        mpv_terminate_destroy(mpv);
+        return -1;
+    }
+    auto protocols = MpvStreamProtocol::install(mpv, std::make_shared<MpvRateLimiter>());
+    mpv_observe_property(mpv, 0, "demuxer-cache-state", MPV_FORMAT_NODE);
+
+    dropFromPageCache();
+    QElapsedTimer timer;
+    timer.start();
+    const QByteArray urlData = url.toUtf8();
+    const char *command[] = {"loadfile", urlData.constData(), nullptr};
+    mpv_command(mpv, command);
+
+    qint64 elapsed = -1;
+    while (elapsed < 0 && timer.elapsed() < 10 * 60 * 1000) {
+        mpv_event *event = mpv_wait_event(mpv, 1);
+        if (event->event_id == MPV_EVENT_END_FILE) {
+            break;
+        }
+        if (event->event_id != MPV_EVENT_PROPERTY_CHANGE) {
+            continue;
+        }
+        auto property = static_cast<mpv_event_property *>(event->data);
+        if (property->format != MPV_FORMAT_NODE) {
+            continue;
+        }
+        const mpv_node *state = static_cast<mpv_node *>(property->data);
+        if (state->format != MPV_FORMAT_NODE_MAP) {
+            continue;
+        }
+        for (int i = 0; i < state->u.list->num; ++i) {
+            const mpv_node &value = state->u.list->values[i];
+            if (qstrcmp(state->u.list->keys[i], "eof") == 0 && value.format == MPV_FORMAT_FLAG && value.u.flag) {
+                elapsed = timer.elapsed();
+            }
+        }
+    }
+    mpv_terminate_destroy(mpv);
+    return elapsed;
+}
+
+void MpvMappedFileBenchmark::readFile_data()
+{
+    QTest::addColumn<QString>("url");
+    const QUrl source = QUrl::fromLocalFile(m_fileName);
+    QTest::newRow("file") << source.toString();
+    QTest::newRow("mpvqt-mmap") << MpvStreamProtocol::url(MpvMappedFileProtocol::Scheme, source);
+}
+
+void MpvMappedFileBenchmark::readFile()
+{
+    QFETCH(QString, url);
+    bool isSet = false;
+    int runs = qMax(1, qEnvironmentVariableIntValue("MPVQT_BENCHMARK_RUNS", &isSet));
+    if (!isSet) {
+        runs = 3;
+    }
+    MpvMappedFileProtocol::resetStatistics();
+
+    qint64 total = 0;
+    for (int run = 0; run < runs; ++run) {
+        const qint64 elapsed = readThrough(url);
+        QVERIFY2(elapsed >= 0, qPrintable(QStringLiteral("could not read %1").arg(url)));
+        total += elapsed;
+    }
+    const qint64 average = total / runs;
+    QTest::setBenchmarkResult(average, QTest::WalltimeMilliseconds);
+
+    QString details;
+    if (url.startsWith(MpvMappedFileProtocol::Scheme)) {
+        const auto statistics = MpvMappedFileProtocol::statistics();
+        details = QStringLiteral(", %1 reads, %2 slower than %3 ms")
+                      .arg(statistics.reads)
+                      .arg(statistics.slowReads)
+                      .arg(MpvMappedFileProtocol::SlowRead / 1000);
+    }
+    qInfo().noquote() << QTest::currentDataTag() << ":" << average << "ms," << qint64(m_fileSize / 1048576.0 / qMax<qint64>(1, average) * 1000)
+                      << "MiB/s over" << runs << "runs" << details;
+}
+
+QTEST_GUILESS_MAIN(MpvMappedFileBenchmark)
+
+#include "mpvmappedfilebenchmark.moc"
@@ -0,0 +1,287 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvsegmentloader.h"
+#include "testhttpserver.h"
+
+#include <QElapsedTimer>
+#include <QRandomGenerator>
+#include <QTest>
+#include <QThread>
+
+#include <algorithm>
+
+namespace
+{
+constexpr qsizetype SegmentSize = 64 * 1024;
+
+// false if a read failed
+bool read(MpvStream *stream, qint64 size, QByteArray *data)
+{
+    char buffer[16 * 1024];
+    while (size != 0) {
+        const qint64 read = stream->read(buffer, size < 0 ? qint64(sizeof(buffer)) : qMin<qint64>(size, sizeof(buffer)));
+        if (read <= 0) {
+            return read == 0 && size < 0;
+        }
+        data->append(buffer, read);
+        size = size < 0 ? size : size - read;
+    }
+    return true;
+}
+
+// HEAD requests ask for the sizes of segments, only GET ones load them
+QList<TestHttpServer::Request> loads(const TestHttpServer &server, const QString &path)
+{
+    QList<TestHttpServer::Request> requests = server.requests(path);
+    requests.removeIf([](const TestHttpServer::Request &request) {
+        return request.method != "GET";
+    });
+    return requests;
+}
+
+QByteArray segmentData(quint32 seed)
+{
+    QByteArray data(SegmentSize, Qt::Uninitialized);
+    QRandomGenerator generator(seed);
+    for (char &byte : data) {
+        byte = char(generator.bounded(256));
+    }
+    return data;
+}
+}
+
+class MpvSegmentLoaderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanup();
+    void servesSegmentsInOrder();
+    void fetchesInParallelUnderLatency();
+    void retriesFailedSegmentsWithBackoff();
+    void measuresThroughputWhileBusy();
+    void seeksWithinVodPlaylists();
+    void switchesVariants();
+
+private:
+    /**
+     * A VOD media playlist at @p directory/index.m3u8 with @p count segments,
+     * returns their data laid end to end.
+     */
+    QByteArray addPlaylist(const QString &directory, int count, quint32 seed = 0);
+    std::unique_ptr<MpvStream> open(const QString &path);
+
+    TestHttpServer m_server;
+    MpvSegmentLoader *m_loader{nullptr};
+};
+
+void MpvSegmentLoaderTest::initTestCase()
+{
+    m_loader = MpvSegmentLoader::instance();
+    QVERIFY(!m_loader->isEnabled());
+    m_loader->setEnabled(true);
+}
+
+void MpvSegmentLoaderTest::cleanup()
+{
+    // the defaults, whatever a test changed before failing
+    m_loader->setConcurrency(4);
+    m_loader->setSegmentsAhead(8);
+    m_server.setResponseDelay(0);
+}
+
+QByteArray MpvSegmentLoaderTest::addPlaylist(const QString &directory, int count, quint32 seed)
+{
+    QByteArray playlist = "#EXTM3U\n#EXT-X-VERSION:3\n#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:0\n";
+    QByteArray content;
+    for (int i = 0; i < count; ++i) {
+        const QByteArray data = segmentData(seed + i);
+        m_server.setFile(directory + QStringLiteral("/%1.ts").arg(i), data);
+        playlist += "#EXTINF:2.0,\n" + QByteArray::number(i) + ".ts\n";
+        content += data;
+    }
+    playlist += "#EXT-X-ENDLIST\n";
+    m_server.setFile(directory + QStringLiteral("/index.m3u8"), playlist);
+    return content;
+}
+
+std::unique_ptr<MpvStream> MpvSegmentLoaderTest::open(const QString &path)
+{
+    return MpvSegmentLoaderProtocol().open(m_server.url(path));
+}
+
+void MpvSegmentLoaderTest::servesSegmentsInOrder()
+{
+    const QByteArray content = addPlaylist(QStringLiteral("/order"), 12);
+    QVERIFY(m_loader->isLoadable(m_server.url(QStringLiteral("/order/index.m3u8"))));
+
+    auto stream = open(QStringLiteral("/order/index.m3u8"));
+    QVERIFY(stream);
+    QVERIFY(stream->isSeekable());
+    QByteArray data;
+    QVERIFY(read(stream.get(), -1, &data));
+    QCOMPARE(data, content);
+    for (int i = 0; i < 12; ++i) {
+        QCOMPARE(loads(m_server, QStringLiteral("/order/%1.ts").arg(i)).size(), qsizetype(1));
+    }
+}
+
+void MpvSegmentLoaderTest::fetchesInParallelUnderLatency()
+{
+    // every response takes Delay, like a link with a long round trip
+    constexpr int Delay = 200;
+    constexpr int Count = 12;
+    const QByteArray content = addPlaylist(QStringLiteral("/latency"), Count);
+    m_loader->setConcurrency(3);
+    m_server.setResponseDelay(Delay);
+
+    QElapsedTimer timer;
+    timer.start();
+    auto stream = open(QStringLiteral("/latency/index.m3u8"));
+    QVERIFY(stream);
+    QByteArray data;
+    QVERIFY(read(stream.get(), -1, &data));
+    const qint64 elapsed = timer.elapsed();
+    QCOMPARE(data, content);
+
+    // a request holds its slot until its response, at least Delay after it
+    // arrived: requests arriving within Delay of each other ran together
+    QList<qint64> arrivals;
+    for (int i = 0; i < Count; ++i) {
+        const auto requests = loads(m_server, QStringLiteral("/latency/%1.ts").arg(i));
+        QCOMPARE(requests.size(), qsizetype(1));
+        arrivals.append(requests.first().time);
+    }
+    std::sort(arrivals.begin(), arrivals.end());
+    int mostOverlapping = 0;
+    for (qsizetype i = 0; i < arrivals.size(); ++i) {
+        int overlapping = 0;
+        for (qsizetype j = i; j < arrivals.size() && arrivals.at(j) - arrivals.at(i) < Delay; ++j) {
+            ++overlapping;
+        }
+        mostOverlapping = qMax(mostOverlapping, overlapping);
+    }
+    // as many as allowed, never more
+    QCOMPARE(mostOverlapping, 3);
+
+    // the playlist and four rounds of three segments; one by one the segments
+    // alone would take Count * Delay
+    QVERIFY(elapsed >= 5 * Delay);
+    QVERIFY(elapsed < Count * Delay);
+}
+
+void MpvSegmentLoaderTest::retriesFailedSegmentsWithBackoff()
+{
+    const QByteArray content = addPlaylist(QStringLiteral("/retry"), 4);
+    const QString failing = QStringLiteral("/retry/1.ts");
+    m_server.failRequests(2, failing);
+
+    auto stream = open(QStringLiteral("/retry/index.m3u8"));
+    QVERIFY(stream);
+    QByteArray data;
+    QVERIFY(read(stream.get(), -1, &data));
+    QCOMPARE(data, content);
+
+    // half a second before the second request, a second before the third
+    // one; timers may fire a little early
+    const auto requests = loads(m_server, failing);
+    QCOMPARE(requests.size(), qsizetype(3));
+    QVERIFY(requests.at(1).time - requests.at(0).time >= 450);
+    QVERIFY(requests.at(2).time - requests.at(1).time >= 900);
+}
+
+void MpvSegmentLoaderTest::measuresThroughputWhileBusy()
+{
+    // as many segments as the estimate looks at, loaded one by one
+    const QByteArray content = addPlaylist(QStringLiteral("/busy"), 16);
+    m_loader->setConcurrency(1);
+    m_loader->setSegmentsAhead(1);
+
+    auto stream = open(QStringLiteral("/busy/index.m3u8"));
+    QVERIFY(stream);
+    QByteArray data;
+    QVERIFY(read(stream.get(), 8 * SegmentSize, &data));
+    // the player pauses, the loader idles once it is a segment ahead
+    QThread::msleep(1500);
+    QVERIFY(read(stream.get(), -1, &data));
+    QCOMPARE(data, content);
+
+    // counting the pause, the 16 segments would have taken over a second
+    QVERIFY(m_loader->throughput() > 16 * SegmentSize);
+    // the same segments were the last 16 of the stream too
+    const QUrl source = m_server.url(QStringLiteral("/busy/index.m3u8"));
+    QCOMPARE(m_loader->throughput(source), m_loader->throughput());
+    QCOMPARE(m_loader->throughput(m_server.url(QStringLiteral("/none/index.m3u8"))), qint64(0));
+}
+
+void MpvSegmentLoaderTest::seeksWithinVodPlaylists()
+{
+    const QByteArray content = addPlaylist(QStringLiteral("/seek"), 8);
+    auto stream = open(QStringLiteral("/seek/index.m3u8"));
+    QVERIFY(stream);
+    // the sizes of the segments not loaded yet come from HEAD requests
+    QTRY_COMPARE(stream->size(), qint64(content.size()));
+
+    const qint64 ahead = 5 * SegmentSize + 100;
+    QVERIFY(stream->seek(ahead));
+    QByteArray data;
+    QVERIFY(read(stream.get(), 1000, &data));
+    QCOMPARE(data, content.mid(ahead, 1000));
+
+    // back to a segment loaded and left behind by the seek: loaded again
+    const qint64 back = 1 * SegmentSize + 10;
+    QVERIFY(stream->seek(back));
+    data.clear();
+    QVERIFY(read(stream.get(), -1, &data));
+    QCOMPARE(data, content.mid(back));
+    QCOMPARE(loads(m_server, QStringLiteral("/seek/1.ts")).size(), qsizetype(2));
+
+    QVERIFY(stream->seek(content.size()));
+    QVERIFY(!stream->seek(content.size() + 1));
+}
+
+void MpvSegmentLoaderTest::switchesVariants()
+{
+    const QByteArray low = addPlaylist(QStringLiteral("/abr/low"), 10, 100);
+    const QByteArray high = addPlaylist(QStringLiteral("/abr/high"), 10, 200);
+    m_server.setFile(QStringLiteral("/abr/master.m3u8"),
+                     "#EXTM3U\n"
+                     "#EXT-X-STREAM-INF:BANDWIDTH=800000\nlow/index.m3u8\n"
+                     "#EXT-X-STREAM-INF:BANDWIDTH=2000000\nhigh/index.m3u8\n");
+    const QUrl source = m_server.url(QStringLiteral("/abr/master.m3u8"));
+
+    auto stream = open(QStringLiteral("/abr/master.m3u8"));
+    QVERIFY(stream);
+    QCOMPARE(m_loader->variants(source), QList<qint64>({800000, 2000000}));
+    QCOMPARE(m_loader->variant(source), qint64(2000000));
+
+    // the window ends before the last segment while the first one is read
+    QByteArray data;
+    QVERIFY(read(stream.get(), 1000, &data));
+    m_loader->selectVariant(source, 800000);
+    QTRY_COMPARE(m_loader->variant(source), qint64(800000));
+    QVERIFY(read(stream.get(), -1, &data));
+
+    // the high variant up to the first segment not loading when switching, the low one after
+    qsizetype switched = -1;
+    for (qsizetype segments = 1; segments < 10; ++segments) {
+        if (data == high.left(segments * SegmentSize) + low.mid(segments * SegmentSize)) {
+            switched = segments;
+        }
+    }
+    QVERIFY(switched > 0);
+    QCOMPARE(loads(m_server, QStringLiteral("/abr/low/9.ts")).size(), qsizetype(1));
+    QVERIFY(loads(m_server, QStringLiteral("/abr/high/9.ts")).isEmpty());
+
+    stream.reset();
+    QVERIFY(m_loader->variants(source).isEmpty());
+}
+
+QTEST_GUILESS_MAIN(MpvSegmentLoaderTest)
+
+#include "mpvsegmentloadertest.moc"
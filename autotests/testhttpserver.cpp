@@ -0,0 +1,200 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "testhttpserver.h"
+
+#include <QHostAddress>
+#include <QMutexLocker>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+
+TestHttpServer::TestHttpServer()
+{
+    m_clock.start();
+    m_thread.setObjectName(QStringLiteral("testhttpserver"));
+    m_thread.start();
+    QMetaObject::invokeMethod(
+        &m_thread,
+        [this]() {
+            m_server = new QTcpServer();
+            connect(m_server, &QTcpServer::newConnection, m_server, [this]() {
+                onNewConnection();
+            });
+            m_server->listen(QHostAddress::LocalHost);
+            m_port = m_server->serverPort();
+        },
+        Qt::BlockingQueuedConnection);
+}
+
+TestHttpServer::~TestHttpServer()
+{
+    QMetaObject::invokeMethod(
+        &m_thread,
+        [this]() {
+            delete m_server;
+        },
+        Qt::BlockingQueuedConnection);
+    m_thread.quit();
+    m_thread.wait();
+}
+
+QUrl TestHttpServer::url(const QString &path) const
+{
+    return QUrl(QStringLiteral("http://127.0.0.1:%1%2").arg(m_port).arg(path));
+}
+
+void TestHttpServer::setFile(const QString &path, const QByteArray &data, const QByteArray &etag)
+{
+    QMutexLocker locker(&m_mutex);
+    m_files.insert(path, File{data, etag});
+}
+
+void TestHttpServer::cutResponses(int count, qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_cutCount = count;
+    m_cutBytes = bytes;
+}
+
+void TestHttpServer::failRequests(int count, const QString &path)
+{
+    QMutexLocker locker(&m_mutex);
+    m_failCount = count;
+    m_failPath = path;
+}
+
+void TestHttpServer::setResponseDelay(int milliseconds)
+{
+    QMutexLocker locker(&m_mutex);
+    m_responseDelay = milliseconds;
+}
+
+QList<TestHttpServer::Request> TestHttpServer::requests(const QString &path) const
+{
+    QMutexLocker locker(&m_mutex);
+    if (path.isEmpty()) {
+        return m_requests;
+    }
+    QList<Request> requests;
+    for (const auto &request : m_requests) {
+        if (request.path == path) {
+            requests.append(request);
+        }
+    }
+    return requests;
+}
+
+qint64 TestHttpServer::bytesServed() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bytesServed;
+}
+
+void TestHttpServer::onNewConnection()
+{
+    while (QTcpSocket *socket = m_server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+        connect(socket, &QTcpSocket::readyRead, socket, [this, socket]() {
+            onReadyRead(socket);
+        });
+    }
+}
+
+void TestHttpServer::onReadyRead(QTcpSocket *socket)
+{
+    const QByteArray buffered = socket->peek(socket->bytesAvailable());
+    const qsizetype end = buffered.indexOf("\r\n\r\n");
+    if (end < 0) {
+        return;
+    }
+    const QByteArray head = socket->read(end + 4);
+    disconnect(socket, &QTcpSocket::readyRead, socket, nullptr);
+
+    int delay = 0;
+    {
+        QMutexLocker locker(&m_mutex);
+        delay = m_responseDelay;
+    }
+    if (delay > 0) {
+        QTimer::singleShot(delay, socket, [this, socket, head]() {
+            respond(socket, head);
+        });
+    } else {
+        respond(socket, head);
+    }
+}
+
+void TestHttpServer::respond(QTcpSocket *socket, const QByteArray &head)
+{
+    const QList<QByteArray> lines = head.trimmed().split('\n');
+    const QList<QByteArray> requestLine = lines.value(0).trimmed().split(' ');
+    Request request;
+    request.method = requestLine.value(0);
+    request.path = QString::fromLatin1(requestLine.value(1));
+    QHash<QByteArray, QByteArray> headers;
+    for (qsizetype i = 1; i < lines.size(); ++i) {
+        const qsizetype colon = lines.at(i).indexOf(':');
+        if (colon > 0) {
+            headers.insert(lines.at(i).left(colon).trimmed().toLower(), lines.at(i).mid(colon + 1).trimmed());
+        }
+    }
+    const QByteArray range = headers.value("range");
+    if (range.startsWith("bytes=")) {
+        request.rangeStart = range.mid(6, range.indexOf('-') - 6).toLongLong();
+    }
+
+    QMutexLocker locker(&m_mutex);
+    request.time = m_clock.elapsed();
+    m_requests.append(request);
+    const bool isFailing = m_failCount > 0 && (m_failPath.isEmpty() || m_failPath == request.path);
+    if (isFailing) {
+        --m_failCount;
+    }
+    if (isFailing || !m_files.contains(request.path)) {
+        socket->write(isFailing ? "HTTP/1.1 503 Service Unavailable\r\n" : "HTTP/1.1 404 Not Found\r\n");
+        socket->write("Content-Length: 0\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+        return;
+    }
+
+    const File file = m_files.value(request.path);
+    const qint64 size = file.data.size();
+    if (!file.etag.isEmpty() && headers.value("if-none-match") == file.etag) {
+        socket->write("HTTP/1.1 304 Not Modified\r\nETag: " + file.etag + "\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+        return;
+    }
+    // If-Range with another ETag asks for the whole file
+    const bool isCurrent = !headers.contains("if-range") || headers.value("if-range") == file.etag;
+    const bool isRange = request.rangeStart >= 0 && request.rangeStart < size && isCurrent;
+    const qint64 start = isRange ? request.rangeStart : 0;
+
+    QByteArray response = isRange ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+    response += "Accept-Ranges: bytes\r\nConnection: close\r\n";
+    response += "Content-Length: " + QByteArray::number(size - start) + "\r\n";
+    if (isRange) {
+        response += "Content-Range: bytes " + QByteArray::number(start) + '-' + QByteArray::number(size - 1) + '/' + QByteArray::number(size) + "\r\n";
+    }
+    if (!file.etag.isEmpty()) {
+        response += "ETag: " + file.etag + "\r\n";
+    }
+    response += "\r\n";
+    socket->write(response);
+
+    if (request.method != "HEAD") {
+        qint64 length = size - start;
+        if (m_cutCount > 0) {
+            --m_cutCount;
+            length = qMin(length, m_cutBytes);
+        }
+        socket->write(file.data.constData() + start, length);
+        m_bytesServed += length;
+    }
+    socket->disconnectFromHost();
+}
+
+#include "moc_testhttpserver.cpp"
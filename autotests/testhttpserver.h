@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef TESTHTTPSERVER_H
+#define TESTHTTPSERVER_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QObject>
+#include <QThread>
+#include <QUrl>
+
+class QTcpServer;
+class QTcpSocket;
+
+/**
+ * HTTP/1.1 server for the autotests, serving files from memory on the local
+ * host, with range requests, ETags and injectable faults.
+ *
+ * It runs on its own thread, so a test may block on reads that wait for it.
+ * Every response closes its connection. Thread-safe.
+ */
+class TestHttpServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Request {
+        QByteArray method;
+        QString path;
+        // first byte of the Range header, -1 without one
+        qint64 rangeStart{-1};
+        // milliseconds since the server started
+        qint64 time{0};
+    };
+
+    TestHttpServer();
+    ~TestHttpServer() override;
+
+    QUrl url(const QString &path) const;
+
+    void setFile(const QString &path, const QByteArray &data, const QByteArray &etag = {});
+
+    /**
+     * Cut the body of the next @p count responses after @p bytes.
+     */
+    void cutResponses(int count, qint64 bytes);
+
+    /**
+     * Answer the next @p count requests for @p path, or for any path, with
+     * 503 Service Unavailable.
+     */
+    void failRequests(int count, const QString &path = {});
+
+    /**
+     * Milliseconds to wait before each response.
+     */
+    void setResponseDelay(int milliseconds);
+
+    QList<Request> requests(const QString &path = {}) const;
+    qint64 bytesServed() const;
+
+private:
+    struct File {
+        QByteArray data;
+        QByteArray etag;
+    };
+
+    // on m_thread
+    void onNewConnection();
+    void onReadyRead(QTcpSocket *socket);
+    void respond(QTcpSocket *socket, const QByteArray &head);
+
+    QThread m_thread;
+    QTcpServer *m_server{nullptr};
+    quint16 m_port{0};
+
+    mutable QMutex m_mutex;
+    QHash<QString, File> m_files;
+    QList<Request> m_requests;
+    qint64 m_bytesServed{0};
+    int m_cutCount{0};
+    qint64 m_cutBytes{0};
+    int m_failCount{0};
+    QString m_failPath;
+    QElapsedTimer m_clock;
+    int m_responseDelay{0};
+};
+
+#endif // TESTHTTPSERVER_H
@@ -7,24 +7,359 @@
 #include "mpvabstractitem.h"
 #include "mpvabstractitem_p.h"
 
+#include <QCoreApplication>
 #include <QLoggingCategory>
+#include <QPointer>
 #include <QQuickWindow>
 #include <QThread>
 
+#include "mpvbandwidtharbiter.h"
+#include "mpvcachebudget.h"
 #include "mpvcontroller.h"
+#include "mpvcontrollerpool.h"
+#include "mpvcpumonitor.h"
+#include "mpvmemorypressure.h"
 #include "mpvrenderer.h"
 
 Q_LOGGING_CATEGORY(MpvQt_MpvAbstractItem, "MpvQt.MpvAbstractItem")
 
+// saved by hibernate() besides the path and position, restored by resume()
+static const QStringList HibernatedProperties{
+    QStringLiteral("aid"),
+    QStringLiteral("vid"),
+    QStringLiteral("sid"),
+    QStringLiteral("vf"),
+    QStringLiteral("af"),
+    QStringLiteral("pause"),
+    QStringLiteral("speed"),
+    QStringLiteral("volume"),
+    QStringLiteral("mute"),
+    QStringLiteral("demuxer-lavf-format"),
+    QStringLiteral("demuxer-lavf-o"),
+    QStringLiteral("demuxer-lavf-probesize"),
+    QStringLiteral("demuxer-lavf-analyzeduration"),
+    QStringLiteral("demuxer-readahead-secs"),
+};
+
+static QHash<MpvAbstractItem::SchedulingPolicy, MpvSchedulingParameters> &schedulingPolicies()
+{
+    static QHash<MpvAbstractItem::SchedulingPolicy, MpvSchedulingParameters> policies{
+        {MpvAbstractItem::ForegroundScheduling, {QThread::HighPriority, 0, 0, {}}},
+        {MpvAbstractItem::BackgroundScheduling, {QThread::LowPriority, 2, 0, {}}},
+        {MpvAbstractItem::ThumbnailScheduling, {QThread::LowestPriority, 1, 0, {}}},
+    };
+    return policies;
+}
+
 MpvAbstractItemPrivate::MpvAbstractItemPrivate(MpvAbstractItem *q)
     : q_ptr(q)
 {
 }
 
+void MpvAbstractItemPrivate::invokeWhenInitialized(std::function<void()> call)
+{
+    // the restored state would override calls made while hibernated
+    if (m_isHibernated || !m_snapshot.path.isEmpty()) {
+        m_restoreCalls.append(std::move(call));
+        return;
+    }
+    if (m_isInitialized) {
+        call();
+        return;
+    }
+    m_pendingCalls.append(std::move(call));
+}
+
+void MpvAbstractItemPrivate::initialize()
+{
+    if (m_isInitStarted) {
+        return;
+    }
+    m_isInitStarted = true;
+    m_startupTimer.start();
+
+    // a new player runs mpv_create, mpv_initialize and the config parsing on its
+    // worker thread, everything issued until it is done is queued, see invokeWhenInitialized()
+    attachPlayer(m_isPooled ? MpvControllerPool::instance()->checkout() : MpvControllerPool::createPlayer(m_options));
+}
+
+void MpvAbstractItemPrivate::attachPlayer(MpvPooledPlayer player)
+{
+    m_workerThread = player.thread;
+    m_mpvController = player.controller;
+
+    auto q = q_ptr;
+    // controller signals are emitted on the worker thread and relayed through the item,
+    // so subclasses don't have to care about the player being swapped
+    QObject::connect(m_mpvController, &MpvController::initialized, q, [this]() {
+        onInitialized();
+    });
+    QObject::connect(m_mpvController, &MpvController::propertyChanged, q, &MpvAbstractItem::propertyChanged);
+    QObject::connect(m_mpvController, &MpvController::asyncReply, q, &MpvAbstractItem::asyncReply);
+    QObject::connect(m_mpvController, &MpvController::fileStarted, q, &MpvAbstractItem::fileStarted);
+    QObject::connect(m_mpvController, &MpvController::fileLoaded, q, &MpvAbstractItem::fileLoaded);
+    QObject::connect(m_mpvController, &MpvController::endFile, q, &MpvAbstractItem::endFile);
+    QObject::connect(m_mpvController, &MpvController::videoReconfig, q, &MpvAbstractItem::videoReconfig);
+
+    // a pooled player may have finished initializing long ago
+    if (m_mpvController->isInitialized()) {
+        onInitialized();
+    }
+}
+
+void MpvAbstractItemPrivate::onInitialized()
+{
+    if (m_isInitialized || !m_mpvController) {
+        return;
+    }
+    auto q = q_ptr;
+
+    auto mpvHandleManager = m_mpvController->mpvHandleManager();
+    auto renderContext{nullptr};
+    m_mpvResourceManager = std::make_shared<MpvResourceManager>(renderContext, mpvHandleManager);
+
+    m_isInitialized = true;
+    m_startupTime = m_startupTimer.elapsed();
+    qCDebug(MpvQt_MpvAbstractItem) << "mpv initialized in" << m_startupTime << "ms" << (m_isPooled ? "(pooled)" : "");
+
+    // pooled players were initialized with the pool's options
+    if (m_isPooled) {
+        post([options = m_options](MpvController *controller) {
+            for (auto it = options.constBegin(); it != options.constEnd(); ++it) {
+                controller->setProperty(it.key(), it.value());
+            }
+        });
+    }
+    applySchedulingPolicy();
+    post([observedProperties = m_observedProperties](MpvController *controller) {
+        for (const auto &observed : observedProperties) {
+            controller->observeProperty(observed.property, observed.format, observed.id);
+        }
+    });
+    // calls made before init run before anything issued from the initialized() handlers
+    const auto calls = std::exchange(m_pendingCalls, {});
+    for (const auto &call : calls) {
+        call();
+    }
+    Q_EMIT q->initialized();
+
+    // the renderer picks up the resource manager on the next sync and creates the render context
+    q->update();
+}
+
+void MpvAbstractItemPrivate::releasePlayer()
+{
+    if (!m_isInitStarted) {
+        return;
+    }
+    QObject::disconnect(m_mpvController, nullptr, q_ptr, nullptr);
+
+    MpvPooledPlayer player;
+    player.thread = std::exchange(m_workerThread, nullptr);
+    player.controller = std::exchange(m_mpvController, nullptr);
+    m_isInitStarted = false;
+    m_isInitialized = false;
+    m_isRendererReady = false;
+    m_isHoldingFrame = false;
+    m_startupTime = -1;
+    m_pendingCalls.clear();
+    QObject::disconnect(m_restoreConnection);
+    m_isPaused = false;
+    m_pausedHibernationTimer.stop();
+
+    if (!m_isPooled) {
+        // the resource manager keeps the mpv_handle alive until the renderer freed its context
+        m_mpvResourceManager.reset();
+        MpvControllerPool::destroyPlayer(player);
+        return;
+    }
+
+    // the player can only be reused once the renderer freed its render context,
+    // which happens on the render thread when it drops the resource manager
+    QPointer<MpvControllerPool> pool = MpvControllerPool::instance();
+    auto checkin = [pool, player]() {
+        if (pool) {
+            pool->checkin(player);
+        }
+    };
+    if (m_mpvResourceManager) {
+        m_mpvResourceManager->releaseHandler = checkin;
+        m_mpvResourceManager.reset();
+    } else {
+        checkin();
+    }
+}
+
+bool MpvAbstractItemPrivate::isUserOption(const QString &name) const
+{
+    return m_options.contains(name) && !m_defaultOptions.contains(name);
+}
+
+void MpvAbstractItemPrivate::setCacheAllocation(qint64 bytes)
+{
+    if (m_cacheAllocation == bytes) {
+        return;
+    }
+    m_cacheAllocation = bytes;
+    Q_EMIT q_ptr->cacheAllocationChanged();
+}
+
+void MpvAbstractItemPrivate::setBandwidthAllocation(qreal readahead, qint64 rate)
+{
+    if (qFuzzyCompare(m_readaheadTarget, readahead) && m_bandwidthShare == rate) {
+        return;
+    }
+    m_readaheadTarget = readahead;
+    m_bandwidthShare = rate;
+    Q_EMIT q_ptr->bandwidthAllocationChanged();
+}
+
+void MpvAbstractItemPrivate::applySchedulingPolicy()
+{
+    const auto parameters = MpvAbstractItem::schedulingParameters(m_schedulingPolicy);
+    post([parameters](MpvController *controller) {
+        controller->setScheduling(parameters);
+    });
+}
+
+void MpvAbstractItemPrivate::hibernate()
+{
+    if (m_isHibernated || m_isHibernating) {
+        return;
+    }
+    auto q = q_ptr;
+    // nothing was played yet, or the previous snapshot was not restored yet: keep it
+    if (!m_isInitialized || !m_snapshot.path.isEmpty()) {
+        releasePlayer();
+        q->update();
+        m_isHibernated = true;
+        Q_EMIT q->hibernatedChanged();
+        return;
+    }
+
+    m_isHibernating = true;
+    QPointer<MpvAbstractItem> item = q;
+    auto player = m_mpvController;
+    post([this, item, player](MpvController *controller) {
+        Snapshot snapshot;
+        snapshot.path = controller->getProperty(QStringLiteral("path")).toString();
+        snapshot.position = controller->getProperty(QStringLiteral("time-pos")).toDouble();
+        for (const auto &property : HibernatedProperties) {
+            const QVariant value = controller->getProperty(property);
+            if (value.isValid() && value.metaType() != QMetaType::fromType<ErrorReturn>()) {
+                snapshot.properties.insert(property, value);
+            }
+        }
+
+        // back on the GUI thread, where the item lives
+        QMetaObject::invokeMethod(
+            QCoreApplication::instance(),
+            [this, item, player, snapshot]() {
+                if (!item || !m_isHibernating) {
+                    return;
+                }
+                m_isHibernating = false;
+                // resumed or released in the meantime
+                if (m_mpvController != player) {
+                    return;
+                }
+                m_snapshot = snapshot;
+                releasePlayer();
+                item->update();
+                m_isHibernated = true;
+                qCDebug(MpvQt_MpvAbstractItem) << "hibernated" << m_snapshot.path << "at" << m_snapshot.position;
+                Q_EMIT item->hibernatedChanged();
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void MpvAbstractItemPrivate::resume()
+{
+    if (m_isHibernating) {
+        // the snapshot is still being taken, just keep the player
+        m_isHibernating = false;
+        return;
+    }
+    if (!m_isHibernated) {
+        return;
+    }
+    m_isHibernated = false;
+    m_resumeTime = -1;
+    m_resumeTimer.start();
+    initialize();
+
+    if (m_snapshot.path.isEmpty()) {
+        m_pendingCalls.append(std::exchange(m_restoreCalls, {}));
+        invokeWhenInitialized([this]() {
+            m_hibernatedFrame = QImage();
+            finishResume(m_resumeTimer.elapsed());
+        });
+    } else {
+        m_isHoldingFrame = true;
+        restoreSnapshot();
+    }
+    Q_EMIT q_ptr->hibernatedChanged();
+}
+
+void MpvAbstractItemPrivate::restoreSnapshot()
+{
+    // files loaded before the render context exists have no video output
+    if (!m_isRendererReady) {
+        QObject::disconnect(m_restoreConnection);
+        m_restoreConnection = QObject::connect(q_ptr, &MpvAbstractItem::ready, q_ptr, [this]() {
+            if (m_isRendererReady) {
+                QObject::disconnect(m_restoreConnection);
+                restoreSnapshot();
+            }
+        });
+        return;
+    }
+
+    const auto snapshot = std::exchange(m_snapshot, {});
+    post([snapshot](MpvController *controller) {
+        for (auto it = snapshot.properties.constBegin(); it != snapshot.properties.constEnd(); ++it) {
+            controller->setProperty(it.key(), it.value());
+        }
+        // a keyframe seek is enough to get going, and much faster than a precise one
+        QString options = QStringLiteral("hr-seek=no");
+        if (snapshot.position > 0) {
+            options += QStringLiteral(",start=%1").arg(snapshot.position);
+        }
+        controller->command({QStringLiteral("loadfile"), snapshot.path, QStringLiteral("replace"), QStringLiteral("-1"), options});
+    });
+    // on the same worker, so they apply to the restored file
+    const auto calls = std::exchange(m_restoreCalls, {});
+    for (const auto &call : calls) {
+        call();
+    }
+}
+
+void MpvAbstractItemPrivate::finishResume(qint64 resumeTime)
+{
+    m_resumeTime = resumeTime;
+    qCDebug(MpvQt_MpvAbstractItem) << "resumed in" << m_resumeTime << "ms";
+    Q_EMIT q_ptr->resumed();
+}
+
+void MpvAbstractItemPrivate::updatePausedHibernation()
+{
+    if (!m_isPaused || m_pausedHibernationDelay <= 0 || !m_isInitialized || m_isHibernating) {
+        m_pausedHibernationTimer.stop();
+        return;
+    }
+    // pause is reported again by every observer, keep counting from the first report
+    if (!m_pausedHibernationTimer.isActive()) {
+        m_pausedHibernationTimer.start(m_pausedHibernationDelay);
+    }
+}
+
 MpvAbstractItem::MpvAbstractItem(QQuickItem *parent)
     : QQuickFramebufferObject(parent)
     , d_ptr{std::make_unique<MpvAbstractItemPrivate>(this)}
 {
+    setOption(QStringLiteral("vd-lavc-threads"), schedulingParameters(d_ptr->m_schedulingPolicy).decoderThreads);
+
     if (QQuickWindow::graphicsApi() != QSGRendererInterface::OpenGL) {
         qCCritical(MpvQt_MpvAbstractItem) << "The graphics api must be set to opengl "
                                              "or mpv won't be able to render the video.\n"
@@ -33,27 +368,61 @@ MpvAbstractItem::MpvAbstractItem(QQuickItem *parent)
                                              "the first QQuickWindow in the application.";
     }
 
-    d_ptr->m_workerThread = new QThread(this);
-    d_ptr->m_mpvController = new MpvController;
-
-    connect(d_ptr->m_workerThread, &QThread::finished, d_ptr->m_mpvController, &MpvController::deleteLater);
-
-    d_ptr->m_mpvController->moveToThread(d_ptr->m_workerThread);
-    d_ptr->m_workerThread->start();
-
-    // must wait for init to finish or the mpv object could be accessed while not initialized
-    QMetaObject::invokeMethod(d_ptr->m_mpvController, &MpvController::init, Qt::BlockingQueuedConnection);
-
-    auto mpvHandleManager = mpvController()->mpvHandleManager();
-    auto renderContext{nullptr};
-    d_ptr->m_mpvResourceManager = std::make_shared<MpvResourceManager>(renderContext, mpvHandleManager);
+    // Items created from QML start in componentComplete(), once their options are set.
+    // Items created from C++ are already complete, they start on the next event loop
+    // iteration so options staged right after construction are still applied.
+    QMetaObject::invokeMethod(
+        this,
+        [this]() {
+            if (isComponentComplete()) {
+                d_ptr->initialize();
+            }
+        },
+        Qt::QueuedConnection);
+
+    // MpvCacheBudget sizes the demuxer cache from the stream bitrates
+    observeProperty(QStringLiteral("video-bitrate"), MPV_FORMAT_DOUBLE, CacheBudgetObserverId);
+    observeProperty(QStringLiteral("audio-bitrate"), MPV_FORMAT_DOUBLE, CacheBudgetObserverId);
+    MpvCacheBudget::instance()->registerPlayer(this);
+    // MpvBandwidthArbiter measures the input rates of network sources and favours players that are buffering
+    observeProperty(QStringLiteral("demuxer-cache-state"), MPV_FORMAT_NODE, BandwidthArbiterObserverId);
+    observeProperty(QStringLiteral("paused-for-cache"), MPV_FORMAT_FLAG, BandwidthArbiterObserverId);
+    observeProperty(QStringLiteral("path"), MPV_FORMAT_STRING, BandwidthArbiterObserverId);
+    MpvBandwidthArbiter::instance()->registerPlayer(this);
+
+    connect(MpvCpuMonitor::instance(), &MpvCpuMonitor::sampled, this, [this]() {
+        const qreal usage = MpvCpuMonitor::instance()->usage(d_ptr->m_mpvController);
+        if (!qFuzzyCompare(usage + 1, d_ptr->m_cpuUsage + 1)) {
+            d_ptr->m_cpuUsage = usage;
+            Q_EMIT cpuUsageChanged();
+        }
+    });
+    connect(MpvMemoryPressure::instance(), &MpvMemoryPressure::criticalPressure, this, [this]() {
+        if (priority() == BackgroundPriority) {
+            hibernate();
+        }
+    });
+
+    // players paused for long hibernate, see pausedHibernationDelay
+    d_ptr->m_pausedHibernationTimer.setSingleShot(true);
+    connect(&d_ptr->m_pausedHibernationTimer, &QTimer::timeout, this, [this]() {
+        qCDebug(MpvQt_MpvAbstractItem) << "paused for" << d_ptr->m_pausedHibernationDelay << "ms, hibernating";
+        hibernate();
+    });
+    observeProperty(QStringLiteral("pause"), MPV_FORMAT_FLAG, HibernationObserverId);
+    connect(this, &MpvAbstractItem::propertyChanged, this, [this](const QString &property, const QVariant &value) {
+        if (property == QStringLiteral("pause")) {
+            d_ptr->m_isPaused = value.toBool();
+            d_ptr->updatePausedHibernation();
+        }
+    });
 }
 
 MpvAbstractItem::~MpvAbstractItem()
 {
-    d_ptr->m_workerThread->quit();
-    d_ptr->m_workerThread->wait();
-    d_ptr->m_workerThread->deleteLater();
+    MpvCacheBudget::instance()->unregisterPlayer(this);
+    MpvBandwidthArbiter::instance()->unregisterPlayer(this);
+    d_ptr->releasePlayer();
 }
 
 QQuickFramebufferObject::Renderer *MpvAbstractItem::createRenderer() const
@@ -66,124 +435,342 @@ MpvController *MpvAbstractItem::mpvController()
     return d_ptr->m_mpvController;
 }
 
-// clang-format off
+void MpvAbstractItem::componentComplete()
+{
+    QQuickFramebufferObject::componentComplete();
+    d_ptr->initialize();
+}
+
+bool MpvAbstractItem::isPooled() const
+{
+    return d_ptr->m_isPooled;
+}
+
+void MpvAbstractItem::setPooled(bool pooled)
+{
+    if (d_ptr->m_isPooled == pooled) {
+        return;
+    }
+    if (d_ptr->m_isInitStarted) {
+        qCWarning(MpvQt_MpvAbstractItem) << "pooled must be set before the player is acquired, it applies from the next acquirePlayer()";
+    }
+    d_ptr->m_isPooled = pooled;
+    Q_EMIT pooledChanged();
+}
+
+MpvAbstractItem::Priority MpvAbstractItem::priority() const
+{
+    return d_ptr->m_priority;
+}
+
+void MpvAbstractItem::setPriority(Priority priority)
+{
+    if (d_ptr->m_priority == priority) {
+        return;
+    }
+    d_ptr->m_priority = priority;
+    Q_EMIT priorityChanged();
+}
+
+qint64 MpvAbstractItem::cacheAllocation() const
+{
+    return d_ptr->m_cacheAllocation;
+}
+
+qreal MpvAbstractItem::readaheadTarget() const
+{
+    return d_ptr->m_readaheadTarget;
+}
+
+qint64 MpvAbstractItem::bandwidthShare() const
+{
+    return d_ptr->m_bandwidthShare;
+}
+
+qreal MpvAbstractItem::cpuUsage() const
+{
+    return d_ptr->m_cpuUsage;
+}
+
+QVariantMap MpvAbstractItem::cpuUsageByRole() const
+{
+    return MpvCpuMonitor::instance()->usageByRole(d_ptr->m_mpvController);
+}
+
+MpvAbstractItem::SchedulingPolicy MpvAbstractItem::schedulingPolicy() const
+{
+    return d_ptr->m_schedulingPolicy;
+}
+
+void MpvAbstractItem::setSchedulingPolicy(SchedulingPolicy policy)
+{
+    if (d_ptr->m_schedulingPolicy == policy) {
+        return;
+    }
+    d_ptr->m_schedulingPolicy = policy;
+    // takes effect when the decoder is (re)initialized, i.e. with the next file
+    setOption(QStringLiteral("vd-lavc-threads"), schedulingParameters(policy).decoderThreads);
+    if (d_ptr->m_isInitialized) {
+        d_ptr->applySchedulingPolicy();
+    }
+    Q_EMIT schedulingPolicyChanged();
+}
+
+void MpvAbstractItem::setSchedulingParameters(SchedulingPolicy policy, const MpvSchedulingParameters &parameters)
+{
+    schedulingPolicies().insert(policy, parameters);
+}
+
+MpvSchedulingParameters MpvAbstractItem::schedulingParameters(SchedulingPolicy policy)
+{
+    return schedulingPolicies().value(policy);
+}
+
+void MpvAbstractItem::releasePlayer()
+{
+    d_ptr->releasePlayer();
+    // lets the renderer free its render context
+    update();
+}
+
+void MpvAbstractItem::acquirePlayer()
+{
+    if (d_ptr->m_isHibernated) {
+        d_ptr->resume();
+        return;
+    }
+    d_ptr->initialize();
+}
+
+void MpvAbstractItem::hibernate()
+{
+    d_ptr->hibernate();
+}
+
+void MpvAbstractItem::resume()
+{
+    d_ptr->resume();
+}
+
+bool MpvAbstractItem::isHibernated() const
+{
+    return d_ptr->m_isHibernated;
+}
+
+qint64 MpvAbstractItem::resumeTime() const
+{
+    return d_ptr->m_resumeTime;
+}
+
+int MpvAbstractItem::pausedHibernationDelay() const
+{
+    return d_ptr->m_pausedHibernationDelay;
+}
+
+void MpvAbstractItem::setPausedHibernationDelay(int delay)
+{
+    if (d_ptr->m_pausedHibernationDelay == delay) {
+        return;
+    }
+    d_ptr->m_pausedHibernationDelay = delay;
+    d_ptr->m_pausedHibernationTimer.stop();
+    d_ptr->updatePausedHibernation();
+    Q_EMIT pausedHibernationDelayChanged();
+}
+
+QVariantMap MpvAbstractItem::options() const
+{
+    return d_ptr->m_options;
+}
+
+void MpvAbstractItem::setOptions(const QVariantMap &options)
+{
+    bool changed = false;
+    for (auto it = options.constBegin(); it != options.constEnd(); ++it) {
+        d_ptr->m_defaultOptions.remove(it.key());
+        if (d_ptr->m_options.contains(it.key()) && d_ptr->m_options.value(it.key()) == it.value()) {
+            continue;
+        }
+        d_ptr->m_options.insert(it.key(), it.value());
+        if (d_ptr->m_isInitStarted) {
+            setProperty(it.key(), it.value());
+        }
+        changed = true;
+    }
+    if (changed) {
+        Q_EMIT optionsChanged();
+    }
+}
+
+void MpvAbstractItem::setOption(const QString &name, const QVariant &value)
+{
+    // setting the default's value explicitly still makes it the application's
+    d_ptr->m_defaultOptions.remove(name);
+    if (d_ptr->m_options.value(name) == value && d_ptr->m_options.contains(name)) {
+        return;
+    }
+    d_ptr->m_options.insert(name, value);
+    if (d_ptr->m_isInitStarted) {
+        setProperty(name, value);
+    }
+    Q_EMIT optionsChanged();
+}
+
+void MpvAbstractItem::setDefaultOption(const QString &name, const QVariant &value)
+{
+    if (d_ptr->isUserOption(name)) {
+        return;
+    }
+    setOption(name, value);
+    d_ptr->m_defaultOptions.insert(name);
+}
+
+bool MpvAbstractItem::isUserOption(const QString &name) const
+{
+    return d_ptr->isUserOption(name);
+}
+
+bool MpvAbstractItem::isRendererReady() const
+{
+    return d_ptr->m_isRendererReady;
+}
+
+bool MpvAbstractItem::isInitialized() const
+{
+    return d_ptr->m_isInitialized;
+}
+
+qint64 MpvAbstractItem::startupTime() const
+{
+    return d_ptr->m_startupTime;
+}
 
 void MpvAbstractItem::observeProperty(const QString &property, mpv_format format, uint64_t id)
 {
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::observeProperty,
-                              Qt::QueuedConnection,
-                              property,
-                              format,
-                              id);
+    // observers are replayed whenever a player is attached, see MpvAbstractItemPrivate::onInitialized()
+    d_ptr->m_observedProperties.append({property, format, id});
+    if (!d_ptr->m_isInitialized) {
+        return;
+    }
+    d_ptr->post([=](MpvController *controller) {
+        controller->observeProperty(property, format, id);
+    });
 }
 
 int MpvAbstractItem::unobserveProperty(uint64_t id)
 {
-    int result = 0;
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::unobserveProperty,
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(int, result),
-                              id);
+    int removed = d_ptr->m_observedProperties.removeIf([id](const MpvAbstractItemPrivate::ObservedProperty &observed) {
+        return observed.id == id;
+    });
+    if (!d_ptr->m_isInitialized) {
+        return removed;
+    }
 
+    int result = 0;
+    d_ptr->postBlocking([&](MpvController *controller) {
+        result = controller->unobserveProperty(id);
+    });
     return result;
 }
 
 void MpvAbstractItem::setProperty(const QString &property, const QVariant &value)
 {
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::setProperty,
-                              Qt::QueuedConnection,
-                              property,
-                              value);
+    d_ptr->invokeWhenInitialized([=, this]() {
+        d_ptr->post([=](MpvController *controller) {
+            controller->setProperty(property, value);
+        });
+    });
 }
 
 int MpvAbstractItem::setPropertyBlocking(const QString &property, const QVariant &value)
 {
-    int error = 0;
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::setProperty,
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(int, error),
-                              property,
-                              value);
+    if (!d_ptr->m_isInitialized) {
+        qCDebug(MpvQt_MpvAbstractItem) << "setPropertyBlocking called before mpv was initialized:" << property;
+        return MPV_ERROR_UNINITIALIZED;
+    }
 
+    int error = 0;
+    d_ptr->postBlocking([&](MpvController *controller) {
+        error = controller->setProperty(property, value);
+    });
     return error;
 }
 
 void MpvAbstractItem::setPropertyAsync(const QString &property, const QVariant &value, int id)
 {
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::setPropertyAsync,
-                              Qt::QueuedConnection,
-                              property,
-                              value,
-                              id);
+    d_ptr->invokeWhenInitialized([=, this]() {
+        d_ptr->post([=](MpvController *controller) {
+            controller->setPropertyAsync(property, value, id);
+        });
+    });
 }
 
 QVariant MpvAbstractItem::getProperty(const QString &property)
 {
-    QVariant value;
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::getProperty,
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariant, value),
-                              property);
+    if (!d_ptr->m_isInitialized) {
+        return QVariant::fromValue(ErrorReturn(MPV_ERROR_UNINITIALIZED));
+    }
 
+    QVariant value;
+    d_ptr->postBlocking([&](MpvController *controller) {
+        value = controller->getProperty(property);
+    });
     return value;
 }
 
 void MpvAbstractItem::getPropertyAsync(const QString &property, int id)
 {
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::getPropertyAsync,
-                              Qt::QueuedConnection,
-                              property,
-                              id);
+    d_ptr->invokeWhenInitialized([=, this]() {
+        d_ptr->post([=](MpvController *controller) {
+            controller->getPropertyAsync(property, id);
+        });
+    });
 }
 
 void MpvAbstractItem::command(const QStringList &params)
 {
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::command,
-                              Qt::QueuedConnection,
-                              params);
+    d_ptr->invokeWhenInitialized([=, this]() {
+        d_ptr->post([=](MpvController *controller) {
+            controller->command(params);
+        });
+    });
 }
 
 QVariant MpvAbstractItem::commandBlocking(const QStringList &params)
 {
+    if (!d_ptr->m_isInitialized) {
+        return QVariant::fromValue(ErrorReturn(MPV_ERROR_UNINITIALIZED));
+    }
+
     QVariant value;
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::command,
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariant, value),
-                              params);
+    d_ptr->postBlocking([&](MpvController *controller) {
+        value = controller->command(params);
+    });
     return value;
 }
 
 void MpvAbstractItem::commandAsync(const QStringList &params, int id)
 {
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::commandAsync,
-                              Qt::QueuedConnection,
-                              params,
-                              id);
+    d_ptr->invokeWhenInitialized([=, this]() {
+        d_ptr->post([=](MpvController *controller) {
+            controller->commandAsync(params, id);
+        });
+    });
 }
 
 QVariant MpvAbstractItem::expandText(const QString &text)
 {
+    if (!d_ptr->m_isInitialized) {
+        return QVariant::fromValue(ErrorReturn(MPV_ERROR_UNINITIALIZED));
+    }
+
     QVariant value;
-    QMetaObject::invokeMethod(d_ptr->m_mpvController,
-                              &MpvController::command,
-                              Qt::BlockingQueuedConnection,
-                              Q_RETURN_ARG(QVariant, value),
-                              QStringList() << QStringLiteral("expand-text") << text);
+    d_ptr->postBlocking([&](MpvController *controller) {
+        value = controller->command(QStringList() << QStringLiteral("expand-text") << text);
+    });
     return value;
 }
 
-// clang-format on
-
 void MpvAbstractItem::requestUpdateFromRenderer()
 {
     update();
@@ -8,12 +8,16 @@
 #define MPVABSTRACTITEM_H
 
 #include "mpvcontroller.h"
+#include "mpvthreadtracker.h"
 
+#include <QtQml/qqmlregistration.h>
 #include <QtQuick/QQuickFramebufferObject>
 
 #include <mpv/client.h>
 #include <mpv/render_gl.h>
 
+#include <functional>
+
 class MpvController;
 class MpvAbstractItemPrivate;
 
@@ -30,6 +34,10 @@ struct MpvResourceManager {
     // Shared pointer to the manager owning the mpv_handle
     // Ensures the core mpv instance outlives the rendering context
     std::shared_ptr<MpvHandleManager> mpvHandleManager;
+    // Called once neither the item nor the renderer use the handle anymore,
+    // which is when a pooled player can be handed to another item.
+    // Can run on the render thread.
+    std::function<void()> releaseHandler;
 
     MpvResourceManager(mpv_render_context *c, std::shared_ptr<MpvHandleManager> owner)
         : mpvRenderContext(c)
@@ -37,6 +45,13 @@ struct MpvResourceManager {
     {
     }
 
+    ~MpvResourceManager()
+    {
+        if (releaseHandler) {
+            releaseHandler();
+        }
+    }
+
     /**
      * cleans up mpv's rendering context
      *
@@ -58,12 +73,200 @@ struct MpvResourceManager {
 class MpvAbstractItem : public QQuickFramebufferObject
 {
     Q_OBJECT
+    // registered for its properties and the Priority and SchedulingPolicy enums, subclasses are the items to use
+    QML_ELEMENT
+    QML_UNCREATABLE("MpvAbstractItem is a base class, use a subclass such as QMpv")
+
+    /**
+     * Milliseconds it took from acquiring a player until its mpv core
+     * was initialized, -1 while initialization is still running.
+     * Close to 0 for a pooled player that was already initialized.
+     */
+    Q_PROPERTY(qint64 startupTime READ startupTime NOTIFY initialized)
+
+    /**
+     * mpv options applied between mpv_create and mpv_initialize, see setOption().
+     * Assigned maps are merged into the options staged so far, so subclass
+     * defaults are kept unless overridden.
+     */
+    Q_PROPERTY(QVariantMap options READ options WRITE setOptions NOTIFY optionsChanged)
+
+    /**
+     * Take the player from MpvControllerPool instead of creating one.
+     * Must be set before the item is complete.
+     */
+    Q_PROPERTY(bool pooled READ isPooled WRITE setPooled NOTIFY pooledChanged)
+
+    /**
+     * How much the user cares about this player right now, used by MpvCacheBudget
+     * to divide the demuxer cache between the players.
+     */
+    Q_PROPERTY(Priority priority READ priority WRITE setPriority NOTIFY priorityChanged)
+
+    /**
+     * Demuxer cache bytes, forward and back, MpvCacheBudget currently allows this player.
+     */
+    Q_PROPERTY(qint64 cacheAllocation READ cacheAllocation NOTIFY cacheAllocationChanged)
+
+    /**
+     * Seconds the player reads ahead, and bytes per second its stream protocols
+     * may read (0 when unthrottled), as MpvBandwidthArbiter currently allows.
+     */
+    Q_PROPERTY(qreal readaheadTarget READ readaheadTarget NOTIFY bandwidthAllocationChanged)
+    Q_PROPERTY(qint64 bandwidthShare READ bandwidthShare NOTIFY bandwidthAllocationChanged)
+
+    /**
+     * Whether the player is hibernated, see hibernate().
+     */
+    Q_PROPERTY(bool hibernated READ isHibernated NOTIFY hibernatedChanged)
+
+    /**
+     * Milliseconds the last resume() took until the first frame of the restored
+     * file was rendered, -1 before the first resume and while resuming.
+     */
+    Q_PROPERTY(qint64 resumeTime READ resumeTime NOTIFY resumed)
+
+    /**
+     * Milliseconds a player stays paused before it hibernates, 0 to never
+     * hibernate paused players. Defaults to 10 minutes.
+     */
+    Q_PROPERTY(int pausedHibernationDelay READ pausedHibernationDelay WRITE setPausedHibernationDelay NOTIFY pausedHibernationDelayChanged)
+
+    /**
+     * How the threads of the player compete for CPU time, see SchedulingPolicy.
+     */
+    Q_PROPERTY(SchedulingPolicy schedulingPolicy READ schedulingPolicy WRITE setSchedulingPolicy NOTIFY schedulingPolicyChanged)
+
+    /**
+     * CPU milliseconds per second used by the player's threads, sampled by
+     * MpvCpuMonitor while it is enabled (Linux only). 1000 is one busy core.
+     */
+    Q_PROPERTY(qreal cpuUsage READ cpuUsage NOTIFY cpuUsageChanged)
+
 public:
+    enum Priority {
+        FocusedPriority,
+        VisiblePriority,
+        BackgroundPriority,
+    };
+    Q_ENUM(Priority)
+
+    /**
+     * Each policy maps to MpvSchedulingParameters, see setSchedulingParameters().
+     * By default foreground players decode with one thread per core on a high
+     * priority worker, background players with 2 decoder threads on a low priority
+     * worker and thumbnails with a single decoder thread on the lowest priority.
+     */
+    enum SchedulingPolicy {
+        ForegroundScheduling,
+        BackgroundScheduling,
+        ThumbnailScheduling,
+    };
+    Q_ENUM(SchedulingPolicy)
+
+    // observer id of the properties watched on behalf of MpvCacheBudget
+    static constexpr uint64_t CacheBudgetObserverId = (uint64_t(1) << 47) + 1;
+    // observer id of the properties watched on behalf of MpvAdaptiveBitrate
+    static constexpr uint64_t AdaptiveBitrateObserverId = (uint64_t(1) << 47) + 2;
+    // observer id of the properties watched on behalf of MpvBandwidthArbiter
+    static constexpr uint64_t BandwidthArbiterObserverId = (uint64_t(1) << 47) + 3;
+    // observer id of the properties watched to hibernate paused players
+    static constexpr uint64_t HibernationObserverId = (uint64_t(1) << 47) + 4;
+
     explicit MpvAbstractItem(QQuickItem *parent = nullptr);
     ~MpvAbstractItem();
 
     Renderer *createRenderer() const override;
 
+    /**
+     * The mpv core is created and initialized asynchronously on the worker thread.
+     * Until it is, non-blocking calls (setProperty, command, observeProperty...)
+     * are queued and run in order once it is ready; blocking calls return
+     * MPV_ERROR_UNINITIALIZED instead of stalling the GUI thread.
+     */
+    bool isInitialized() const;
+    qint64 startupTime() const;
+
+    QVariantMap options() const;
+    void setOptions(const QVariantMap &options);
+
+    /**
+     * Stage an mpv option. Options staged before the item is complete are applied
+     * in one pass between mpv_create and mpv_initialize, which is the only way
+     * to set init-only options and avoids reconfiguring subsystems after startup.
+     * Once initialization has started the option is set as a property instead.
+     */
+    Q_INVOKABLE void setOption(const QString &name, const QVariant &value);
+
+    bool isPooled() const;
+    void setPooled(bool pooled);
+
+    Priority priority() const;
+    void setPriority(Priority priority);
+
+    qint64 cacheAllocation() const;
+    qreal readaheadTarget() const;
+    qint64 bandwidthShare() const;
+
+    qreal cpuUsage() const;
+
+    /**
+     * cpuUsage broken down by thread role: "decoder", "demux", "vo", "ao", "worker"...
+     */
+    Q_INVOKABLE QVariantMap cpuUsageByRole() const;
+
+    SchedulingPolicy schedulingPolicy() const;
+    void setSchedulingPolicy(SchedulingPolicy policy);
+
+    /**
+     * Change what @p policy means, e.g. to pin background players to the
+     * efficiency cores or to renice them. Applies to policies set afterwards.
+     */
+    static void setSchedulingParameters(SchedulingPolicy policy, const MpvSchedulingParameters &parameters);
+    static MpvSchedulingParameters schedulingParameters(SchedulingPolicy policy);
+
+    /**
+     * Stop using the current player: a pooled one is reset and returned to the
+     * pool, others are destroyed. The last frame stays on screen.
+     * Meant for ListView delegate recycling:
+     * @code
+     * ListView.onPooled: player.releasePlayer()
+     * ListView.onReused: player.acquirePlayer()
+     * @endcode
+     */
+    Q_INVOKABLE void releasePlayer();
+
+    /**
+     * Acquire a player again after releasePlayer(). Observed properties and
+     * options are reapplied; calls made in between are queued until it is initialized.
+     */
+    Q_INVOKABLE void acquirePlayer();
+
+    /**
+     * Release the player of an item that is not needed for a while: decoders,
+     * demuxer cache, render context and worker all go away, the last frame stays
+     * on screen. The loaded file, position, selected tracks and filters are saved
+     * first and restored by resume().
+     *
+     * Background items hibernate automatically under critical memory pressure,
+     * and every item once it has been paused for pausedHibernationDelay.
+     * Calls made while hibernated are queued and run once the player is
+     * restored; they don't wake it, resume() does.
+     */
+    Q_INVOKABLE void hibernate();
+
+    /**
+     * Acquire a player again and reload the file saved by hibernate() at its
+     * position, seeking to the nearest keyframe. The hibernated frame is shown
+     * until the first frame of the restored file is rendered.
+     */
+    Q_INVOKABLE void resume();
+
+    bool isHibernated() const;
+    qint64 resumeTime() const;
+    int pausedHibernationDelay() const;
+    void setPausedHibernationDelay(int delay);
+
     Q_INVOKABLE void observeProperty(const QString &property, mpv_format format, uint64_t id = 0);
     Q_INVOKABLE int unobserveProperty(uint64_t id);
 
@@ -82,12 +285,49 @@ public:
     Q_INVOKABLE void requestUpdateFromRenderer();
 
     friend class MpvRenderer;
+    friend class MpvCacheBudget;
+    friend class MpvBandwidthArbiter;
 
 Q_SIGNALS:
     void ready();
+    void initialized();
+    void optionsChanged();
+    void pooledChanged();
+    void priorityChanged();
+    void cacheAllocationChanged();
+    void bandwidthAllocationChanged();
+    void hibernatedChanged();
+    void resumed();
+    void pausedHibernationDelayChanged();
+    void schedulingPolicyChanged();
+    void cpuUsageChanged();
+
+    // relayed from the current MpvController, see MpvController for details
+    void propertyChanged(const QString &property, const QVariant &value);
+    void asyncReply(const QVariant &data, mpv_event event);
+    void fileStarted();
+    void fileLoaded();
+    void endFile(QString reason);
+    void videoReconfig();
 
 protected:
+    void componentComplete() override;
+    /**
+     * Stage an option like setOption(), as a default of the subclass. Unlike
+     * options set by the application, defaults may be overridden by
+     * MpvCacheBudget and MpvBandwidthArbiter.
+     */
+    void setDefaultOption(const QString &name, const QVariant &value);
+    /**
+     * Whether the application set the option @p name with setOption() or setOptions().
+     */
+    bool isUserOption(const QString &name) const;
     MpvController *mpvController();
+    /**
+     * Whether the renderer has created its mpv render context, i.e. ready() was emitted.
+     * Files loaded before that have no video output to render to.
+     */
+    bool isRendererReady() const;
 
     std::unique_ptr<MpvAbstractItemPrivate> d_ptr;
 };
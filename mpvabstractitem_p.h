@@ -8,17 +8,142 @@
 #define MPVABSTRACTITEM_P_H_INCLUDED
 
 #include "mpvabstractitem.h"
+#include "mpvcontrollerpool.h"
+
+#include <QElapsedTimer>
+#include <QImage>
+#include <QSet>
+#include <QTimer>
+
+#include <functional>
 
 class MpvAbstractItemPrivate
 {
 public:
     explicit MpvAbstractItemPrivate(MpvAbstractItem *q);
 
+    /**
+     * Runs @p call right away if the mpv core is initialized,
+     * otherwise queues it until initialization finishes.
+     */
+    void invokeWhenInitialized(std::function<void()> call);
+
+    /**
+     * Runs @p call with the controller where the controller does its work,
+     * its worker thread or its strand on the shared worker pool.
+     */
+    template<typename Func>
+    void post(Func call)
+    {
+        auto controller = m_mpvController;
+        controller->post([controller, call]() {
+            call(controller);
+        });
+    }
+
+    /**
+     * Like post(), but waits for @p call to finish.
+     */
+    template<typename Func>
+    void postBlocking(Func call)
+    {
+        auto controller = m_mpvController;
+        controller->postBlocking([controller, &call]() {
+            call(controller);
+        });
+    }
+
+    /**
+     * Acquires a player, from MpvControllerPool if the item is pooled,
+     * otherwise a new one initialized with the staged options.
+     */
+    void initialize();
+    void attachPlayer(MpvPooledPlayer player);
+    void onInitialized();
+
+    /**
+     * Detaches the player from the item. Pooled players go back to the pool once
+     * the renderer freed its render context, others are destroyed.
+     */
+    void releasePlayer();
+
+    /**
+     * Whether the application set the option @p name, as opposed to a subclass default.
+     */
+    bool isUserOption(const QString &name) const;
+    void setCacheAllocation(qint64 bytes);
+    void setBandwidthAllocation(qreal readahead, qint64 rate);
+    void applySchedulingPolicy();
+
+    /**
+     * Snapshot the playback state on the worker, then release the player.
+     */
+    void hibernate();
+    void resume();
+    // loads the snapshot once the renderer has a render context to output to
+    void restoreSnapshot();
+    // called once the first restored frame was rendered, @p resumeTime milliseconds after resume()
+    void finishResume(qint64 resumeTime);
+    // (re)starts or stops the countdown to hibernating a paused player
+    void updatePausedHibernation();
+
+    struct Snapshot {
+        QString path;
+        double position{0};
+        // track selection, filters and the other properties listed in mpvabstractitem.cpp
+        QVariantMap properties;
+    };
+
+    struct ObservedProperty {
+        QString property;
+        mpv_format format;
+        uint64_t id;
+    };
+
     MpvAbstractItem *q_ptr;
     QThread *m_workerThread{nullptr};
     MpvController *m_mpvController{nullptr};
     bool m_isRendererReady{false};
     std::shared_ptr<MpvResourceManager> m_mpvResourceManager;
+
+    // options staged for mpv_initialize, see MpvAbstractItem::setOption()
+    QVariantMap m_options;
+    // options in m_options staged by setDefaultOption() and not set by the application since
+    QSet<QString> m_defaultOptions;
+    // replayed on every player that gets attached
+    QList<ObservedProperty> m_observedProperties;
+    bool m_isPooled{false};
+    // set once a player is acquired, initialization may still be running
+    bool m_isInitStarted{false};
+    bool m_isInitialized{false};
+    // calls made before the mpv core was initialized, in the order they were made
+    QList<std::function<void()>> m_pendingCalls;
+    QElapsedTimer m_startupTimer;
+    qint64 m_startupTime{-1};
+    MpvAbstractItem::Priority m_priority{MpvAbstractItem::VisiblePriority};
+    qint64 m_cacheAllocation{0};
+    qreal m_readaheadTarget{30};
+    qint64 m_bandwidthShare{0};
+    qreal m_cpuUsage{0};
+    MpvAbstractItem::SchedulingPolicy m_schedulingPolicy{MpvAbstractItem::ForegroundScheduling};
+
+    // hibernate() was called, the snapshot is being taken
+    bool m_isHibernating{false};
+    bool m_isHibernated{false};
+    Snapshot m_snapshot;
+    QMetaObject::Connection m_restoreConnection;
+    // the renderer keeps the hibernated frame until a restored one is available
+    bool m_isHoldingFrame{false};
+    // read back by the renderer when the player hibernates, drawn until a restored frame is
+    // available; kept here so it survives the framebuffer or the renderer being recreated
+    QImage m_hibernatedFrame;
+    // calls made while hibernated, run after the snapshot was restored
+    QList<std::function<void()>> m_restoreCalls;
+    bool m_isPaused{false};
+    int m_pausedHibernationDelay{10 * 60 * 1000};
+    QTimer m_pausedHibernationTimer;
+    QElapsedTimer m_resumeTimer;
+    qint64 m_resumeTime{-1};
 };
 
 #endif // MPVABSTRACTITEM_P_H_INCLUDED
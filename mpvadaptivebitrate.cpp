@@ -0,0 +1,287 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvadaptivebitrate.h"
+
+#include <QLoggingCategory>
+#include <QMap>
+
+#include <cmath>
+
+#include "mpvabstractitem.h"
+#include "mpvbandwidtharbiter.h"
+#include "mpvsegmentloader.h"
+
+Q_LOGGING_CATEGORY(MpvQt_MpvAdaptiveBitrate, "MpvQt.MpvAdaptiveBitrate")
+
+namespace
+{
+// seconds after which a sample weighs half in the averages
+constexpr double FastHalfLife = 3;
+constexpr double SlowHalfLife = 10;
+// longest gap between samples taken into account, in seconds
+constexpr double MaximumSampleGap = 5;
+
+void average(double &value, double sample, double seconds, double halfLife)
+{
+    if (value < 0) {
+        value = sample;
+        return;
+    }
+    const double alpha = 1 - std::pow(0.5, seconds / halfLife);
+    value += alpha * (sample - value);
+}
+}
+
+MpvAdaptiveBitrate::MpvAdaptiveBitrate(MpvAbstractItem *item)
+    : QObject(item)
+    , m_item(item)
+{
+    m_clock.start();
+    item->observeProperty(QStringLiteral("track-list"), MPV_FORMAT_NODE, MpvAbstractItem::AdaptiveBitrateObserverId);
+    item->observeProperty(QStringLiteral("cache-speed"), MPV_FORMAT_INT64, MpvAbstractItem::AdaptiveBitrateObserverId);
+    item->observeProperty(QStringLiteral("demuxer-cache-state"), MPV_FORMAT_NODE, MpvAbstractItem::AdaptiveBitrateObserverId);
+    connect(item, &MpvAbstractItem::propertyChanged, this, &MpvAdaptiveBitrate::onPropertyChanged);
+}
+
+bool MpvAdaptiveBitrate::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void MpvAdaptiveBitrate::setEnabled(bool enabled)
+{
+    m_isEnabled = enabled;
+    m_upswitchSince = -1;
+}
+
+qint64 MpvAdaptiveBitrate::currentBitrate() const
+{
+    return m_currentBitrate;
+}
+
+qint64 MpvAdaptiveBitrate::targetBitrate() const
+{
+    return m_targetBitrate;
+}
+
+int MpvAdaptiveBitrate::switchCount() const
+{
+    return m_switchCount;
+}
+
+qint64 MpvAdaptiveBitrate::throughput() const
+{
+    if (m_fastAverage < 0) {
+        return 0;
+    }
+    return qint64(qMin(m_fastAverage, m_slowAverage) * 8);
+}
+
+void MpvAdaptiveBitrate::reset()
+{
+    m_variants.clear();
+    m_lastSwitch = -1;
+    m_upswitchSince = -1;
+    m_bufferSeconds = 0;
+    m_isUnderrun = false;
+    m_isIdle = true;
+    setCurrentBitrate(0);
+    setTargetBitrate(0);
+    if (m_switchCount != 0) {
+        m_switchCount = 0;
+        Q_EMIT switchCountChanged();
+    }
+}
+
+void MpvAdaptiveBitrate::setLoaderSource(const QUrl &source)
+{
+    m_loaderSource = source;
+}
+
+void MpvAdaptiveBitrate::onPropertyChanged(const QString &property, const QVariant &value)
+{
+    if (property == QStringLiteral("track-list")) {
+        updateTracks(value.toList());
+    } else if (property == QStringLiteral("cache-speed")) {
+        // the demuxer reads segments the loader fetched ahead at memory speed,
+        // the network is what the loader measured fetching them
+        addSample(m_loaderSource.isEmpty() ? value.toLongLong() : MpvSegmentLoader::instance()->throughput(m_loaderSource));
+    } else if (property == QStringLiteral("demuxer-cache-state")) {
+        const QVariantMap state = value.toMap();
+        m_bufferSeconds = state.value(QStringLiteral("cache-duration")).toDouble();
+        m_isUnderrun = state.value(QStringLiteral("underrun")).toBool();
+        m_isIdle = state.value(QStringLiteral("idle")).toBool() || state.value(QStringLiteral("eof")).toBool();
+        evaluate();
+    }
+}
+
+void MpvAdaptiveBitrate::updateTracks(const QVariantList &tracks)
+{
+    if (!m_loaderSource.isEmpty()) {
+        // the loader opened the stream before mpv lists its tracks
+        const auto loader = MpvSegmentLoader::instance();
+        m_isVideo = true;
+        m_variants.clear();
+        const auto bandwidths = loader->variants(m_loaderSource);
+        for (const qint64 bandwidth : bandwidths) {
+            m_variants.append({bandwidth, -1, -1});
+        }
+        setCurrentBitrate(m_variants.isEmpty() ? 0 : loader->variant(m_loaderSource));
+        evaluate();
+        return;
+    }
+
+    // variants by bitrate, of each type
+    QMap<qint64, Variant> video;
+    QMap<qint64, Variant> audio;
+    qint64 selectedVideo = 0;
+    qint64 selectedAudio = 0;
+    for (const QVariant &track : tracks) {
+        const QVariantMap map = track.toMap();
+        const qint64 bitrate = map.value(QStringLiteral("hls-bitrate")).toLongLong();
+        if (bitrate <= 0) {
+            continue;
+        }
+        const QString type = map.value(QStringLiteral("type")).toString();
+        if (type != QStringLiteral("video") && type != QStringLiteral("audio")) {
+            continue;
+        }
+        auto &variants = type == QStringLiteral("video") ? video : audio;
+        // variants repeating a bitrate keep their first track
+        if (!variants.contains(bitrate)) {
+            variants.insert(bitrate, {bitrate, map.value(QStringLiteral("id")).toInt(), -1});
+        }
+        if (map.value(QStringLiteral("selected")).toBool()) {
+            (type == QStringLiteral("video") ? selectedVideo : selectedAudio) = bitrate;
+        }
+    }
+
+    m_isVideo = !video.isEmpty();
+    m_variants.clear();
+    for (auto variant : std::as_const(m_isVideo ? video : audio)) {
+        if (m_isVideo && audio.contains(variant.bitrate)) {
+            variant.audioTrackId = audio.value(variant.bitrate).trackId;
+        }
+        m_variants.append(variant);
+    }
+    setCurrentBitrate(m_isVideo ? selectedVideo : selectedAudio);
+    evaluate();
+}
+
+void MpvAdaptiveBitrate::addSample(qint64 bytesPerSecond)
+{
+    const qint64 now = m_clock.elapsed();
+    const double seconds = m_lastSample < 0 ? 1 : qBound(0.1, (now - m_lastSample) / 1000.0, MaximumSampleGap);
+    m_lastSample = now;
+    // nothing is being read while the cache is full, that isn't a slow network
+    if (m_isIdle || bytesPerSecond <= 0) {
+        return;
+    }
+    average(m_fastAverage, bytesPerSecond, seconds, FastHalfLife);
+    average(m_slowAverage, bytesPerSecond, seconds, SlowHalfLife);
+    evaluate();
+}
+
+void MpvAdaptiveBitrate::evaluate()
+{
+    const qint64 estimate = throughput();
+    if (!m_isEnabled || m_variants.size() < 2 || estimate <= 0) {
+        return;
+    }
+    const qint64 affordable = qint64(estimate * SafetyFactor);
+    int target = 0;
+    for (int i = 1; i < m_variants.size(); ++i) {
+        if (m_variants.at(i).bitrate <= affordable) {
+            target = i;
+        }
+    }
+    setTargetBitrate(m_variants.at(target).bitrate);
+
+    const int current = indexOf(m_currentBitrate);
+    if (current < 0) {
+        return;
+    }
+    // a player held to a shorter readahead never buffers as much, scale the thresholds to it
+    const double readahead = MpvBandwidthArbiter::instance()->readahead(m_item);
+    const double lowBuffer = qMin(LowBuffer, readahead / 3);
+    const double highBuffer = qMin(HighBuffer, readahead * 2 / 3);
+    const double drainHorizon = qMin(DrainHorizon, readahead * 2 / 3);
+
+    const qint64 now = m_clock.elapsed();
+    if (target < current) {
+        m_upswitchSince = -1;
+        // the buffer drains by this many seconds per second while the current variant plays
+        const double drain = 1.0 - double(estimate) / m_variants.at(current).bitrate;
+        const bool isRunningDry = drain > 0 && m_bufferSeconds / drain < drainHorizon;
+        if (m_isUnderrun || m_bufferSeconds < lowBuffer || isRunningDry) {
+            switchTo(target);
+        }
+    } else if (target > current) {
+        if (m_isUnderrun || m_bufferSeconds < highBuffer || (m_lastSwitch >= 0 && now - m_lastSwitch < MinimumSwitchInterval)) {
+            m_upswitchSince = -1;
+            return;
+        }
+        if (m_upswitchSince < 0) {
+            m_upswitchSince = now;
+        } else if (now - m_upswitchSince >= UpswitchDelay) {
+            switchTo(current + 1);
+        }
+    } else {
+        m_upswitchSince = -1;
+    }
+}
+
+void MpvAdaptiveBitrate::switchTo(int index)
+{
+    const Variant &variant = m_variants.at(index);
+    qCDebug(MpvQt_MpvAdaptiveBitrate) << m_item << "switching from" << m_currentBitrate << "to" << variant.bitrate << "bit/s, throughput"
+                                      << throughput() << "buffer" << m_bufferSeconds << "s";
+    if (!m_loaderSource.isEmpty()) {
+        MpvSegmentLoader::instance()->selectVariant(m_loaderSource, variant.bitrate);
+    } else {
+        m_item->setProperty(m_isVideo ? QStringLiteral("vid") : QStringLiteral("aid"), variant.trackId);
+        if (variant.audioTrackId >= 0) {
+            m_item->setProperty(QStringLiteral("aid"), variant.audioTrackId);
+        }
+    }
+    m_lastSwitch = m_clock.elapsed();
+    m_upswitchSince = -1;
+    // track-list confirms it for mpv's variants, until then no other switch is decided from the old variant
+    setCurrentBitrate(variant.bitrate);
+    ++m_switchCount;
+    Q_EMIT switchCountChanged();
+}
+
+int MpvAdaptiveBitrate::indexOf(qint64 bitrate) const
+{
+    for (int i = 0; i < m_variants.size(); ++i) {
+        if (m_variants.at(i).bitrate == bitrate) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void MpvAdaptiveBitrate::setCurrentBitrate(qint64 bitrate)
+{
+    if (m_currentBitrate == bitrate) {
+        return;
+    }
+    m_currentBitrate = bitrate;
+    Q_EMIT currentBitrateChanged();
+}
+
+void MpvAdaptiveBitrate::setTargetBitrate(qint64 bitrate)
+{
+    if (m_targetBitrate == bitrate) {
+        return;
+    }
+    m_targetBitrate = bitrate;
+    Q_EMIT targetBitrateChanged();
+}
+
+#include "moc_mpvadaptivebitrate.cpp"
@@ -0,0 +1,141 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVADAPTIVEBITRATE_H
+#define MPVADAPTIVEBITRATE_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QObject>
+#include <QUrl>
+
+class MpvAbstractItem;
+
+/**
+ * Throughput-driven variant selection for HLS streams opened by mpv.
+ *
+ * mpv lists every variant of a master playlist as tracks carrying their
+ * hls-bitrate, but only selects one when the file is opened (hls-bitrate
+ * option). This follows cache-speed with two exponentially weighted moving
+ * averages, a fast and a slow one, and takes the lower of them as throughput
+ * estimate. The target variant is the highest one fitting in 80% of it.
+ *
+ * Switching down happens before the buffer runs dry: as soon as the target is
+ * lower than the current variant and the demuxer cache holds less than
+ * LowBuffer seconds, or is draining fast enough to empty within DrainHorizon
+ * seconds. Switching up is deliberately slower: one variant at a time, once
+ * the buffer holds HighBuffer seconds and the target stayed higher for
+ * UpswitchDelay, and not within MinimumSwitchInterval of the last switch.
+ * The buffer thresholds shrink with the readahead MpvBandwidthArbiter allows.
+ *
+ * Sources opened through MpvSegmentLoader are a single stream to mpv, without
+ * variant tracks: their variants come from the loader, which switches them,
+ * and the samples from MpvSegmentLoader::throughput() of the source, taken
+ * whenever cache-speed updates.
+ *
+ * Disabled by default: until setEnabled(true), the variant mpv or the loader
+ * picked when opening the source is kept.
+ *
+ * Lives on the GUI thread, one per item.
+ */
+class MpvAdaptiveBitrate : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MpvAdaptiveBitrate(MpvAbstractItem *item);
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Bitrate of the selected variant and of the variant throughput allows,
+     * in bits per second, 0 without variants.
+     */
+    qint64 currentBitrate() const;
+    qint64 targetBitrate() const;
+
+    /**
+     * Variant switches made for the current source.
+     */
+    int switchCount() const;
+
+    /**
+     * Estimated throughput in bits per second, 0 before the first sample.
+     */
+    qint64 throughput() const;
+
+    /**
+     * Forget the variants of the previous source, the throughput estimate is kept.
+     */
+    void reset();
+
+    /**
+     * The HLS source MpvSegmentLoader serves the current file from, whose
+     * variants it switches; empty when mpv opens the source itself.
+     */
+    void setLoaderSource(const QUrl &source);
+
+    // seconds of buffer under which switching down is allowed
+    static constexpr double LowBuffer = 10;
+    // seconds of buffer over which switching up is allowed
+    static constexpr double HighBuffer = 20;
+    // seconds the buffer may take to run dry before switching down
+    static constexpr double DrainHorizon = 20;
+    // part of the throughput estimate variants may use
+    static constexpr double SafetyFactor = 0.8;
+    static constexpr qint64 UpswitchDelay = 10000;
+    static constexpr qint64 MinimumSwitchInterval = 10000;
+
+Q_SIGNALS:
+    void currentBitrateChanged();
+    void targetBitrateChanged();
+    void switchCountChanged();
+
+private:
+    struct Variant {
+        qint64 bitrate{0};
+        int trackId{-1};
+        // audio track of the same variant, -1 if the audio is shared
+        int audioTrackId{-1};
+    };
+
+    void onPropertyChanged(const QString &property, const QVariant &value);
+    void updateTracks(const QVariantList &tracks);
+    void addSample(qint64 bytesPerSecond);
+    void evaluate();
+    void switchTo(int index);
+    int indexOf(qint64 bitrate) const;
+    void setCurrentBitrate(qint64 bitrate);
+    void setTargetBitrate(qint64 bitrate);
+
+    MpvAbstractItem *m_item;
+    bool m_isEnabled{false};
+    QUrl m_loaderSource;
+    // by increasing bitrate
+    QList<Variant> m_variants;
+    // the variants are video tracks, audio tracks for audio-only streams
+    bool m_isVideo{true};
+    qint64 m_currentBitrate{0};
+    qint64 m_targetBitrate{0};
+    int m_switchCount{0};
+
+    // in bytes per second, -1 before the first sample
+    double m_fastAverage{-1};
+    double m_slowAverage{-1};
+    QElapsedTimer m_clock;
+    qint64 m_lastSample{-1};
+    qint64 m_lastSwitch{-1};
+    // since when the target is higher than the current variant, -1 if it isn't
+    qint64 m_upswitchSince{-1};
+
+    // from demuxer-cache-state
+    double m_bufferSeconds{0};
+    bool m_isUnderrun{false};
+    // not reading, cache-speed says nothing about the network then
+    bool m_isIdle{true};
+};
+
+#endif // MPVADAPTIVEBITRATE_H
@@ -0,0 +1,361 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvbandwidtharbiter.h"
+
+#include <QCoreApplication>
+#include <QLoggingCategory>
+#include <QStringList>
+
+#include "mpvabstractitem_p.h"
+#include "mpvcachebudget.h"
+#include "mpvcontroller.h"
+#include "mpvratelimiter.h"
+#include "mpvstreamprotocol.h"
+
+Q_LOGGING_CATEGORY(MpvQt_MpvBandwidthArbiter, "MpvQt.MpvBandwidthArbiter")
+
+namespace
+{
+// whether mpv fetches @p path over the network itself
+bool isFetchedByMpv(const QString &path)
+{
+    const qsizetype separator = path.indexOf(QStringLiteral("://"));
+    if (separator <= 0) {
+        return false;
+    }
+    const QString scheme = path.left(separator).toLower();
+    // stream protocols report what they fetch themselves
+    if (MpvStreamProtocol::isRegistered(scheme)) {
+        return false;
+    }
+    static const QStringList networkSchemes = {
+        QStringLiteral("http"),
+        QStringLiteral("https"),
+        QStringLiteral("ytdl"),
+        QStringLiteral("ftp"),
+        QStringLiteral("sftp"),
+        QStringLiteral("smb"),
+        QStringLiteral("rtmp"),
+        QStringLiteral("rtmps"),
+        QStringLiteral("rtsp"),
+        QStringLiteral("rtp"),
+        QStringLiteral("srt"),
+        QStringLiteral("tcp"),
+        QStringLiteral("udp"),
+        QStringLiteral("mms"),
+    };
+    return networkSchemes.contains(scheme);
+}
+}
+
+MpvBandwidthArbiter *MpvBandwidthArbiter::instance()
+{
+    static QPointer<MpvBandwidthArbiter> arbiter;
+    if (!arbiter) {
+        arbiter = new MpvBandwidthArbiter(QCoreApplication::instance());
+    }
+    return arbiter;
+}
+
+MpvBandwidthArbiter::MpvBandwidthArbiter(QObject *parent)
+    : QObject(parent)
+{
+    m_rebalanceTimer.setSingleShot(true);
+    m_rebalanceTimer.setInterval(500);
+    connect(&m_rebalanceTimer, &QTimer::timeout, this, &MpvBandwidthArbiter::rebalance);
+
+    m_sampleTimer.setInterval(1000);
+    connect(&m_sampleTimer, &QTimer::timeout, this, &MpvBandwidthArbiter::sample);
+}
+
+bool MpvBandwidthArbiter::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void MpvBandwidthArbiter::setEnabled(bool enabled)
+{
+    if (m_isEnabled == enabled) {
+        return;
+    }
+    m_isEnabled = enabled;
+    rebalance();
+}
+
+qint64 MpvBandwidthArbiter::totalBandwidth() const
+{
+    return m_totalBandwidth;
+}
+
+void MpvBandwidthArbiter::setTotalBandwidth(qint64 bytesPerSecond)
+{
+    if (m_totalBandwidth == bytesPerSecond) {
+        return;
+    }
+    m_totalBandwidth = qMax<qint64>(0, bytesPerSecond);
+    rebalance();
+}
+
+qint64 MpvBandwidthArbiter::estimatedBandwidth() const
+{
+    return qint64(m_estimator.estimate());
+}
+
+double MpvBandwidthArbiter::readahead(const MpvAbstractItem *item) const
+{
+    auto player = findPlayer(item);
+    return player ? player->readahead : DefaultReadahead;
+}
+
+qint64 MpvBandwidthArbiter::rate(const MpvAbstractItem *item) const
+{
+    auto player = findPlayer(item);
+    return player ? player->rate : 0;
+}
+
+void MpvBandwidthArbiter::registerPlayer(MpvAbstractItem *item)
+{
+    if (findPlayer(item)) {
+        return;
+    }
+    Player player;
+    player.item = item;
+    m_players.append(player);
+
+    connect(item, &MpvAbstractItem::propertyChanged, this, [this, item](const QString &property, const QVariant &value) {
+        onPropertyChanged(item, property, value);
+    });
+    connect(item, &MpvAbstractItem::fileLoaded, this, [this, item]() {
+        if (auto player = findPlayer(item)) {
+            player->hasFile = true;
+            scheduleRebalance();
+        }
+    });
+    connect(item, &MpvAbstractItem::endFile, this, [this, item]() {
+        if (auto player = findPlayer(item)) {
+            player->hasFile = false;
+            player->isBuffering = false;
+            player->rawInputRate = 0;
+            player->networkRate = 0;
+            scheduleRebalance();
+        }
+    });
+    connect(item, &MpvAbstractItem::initialized, this, [this, item]() {
+        if (auto player = findPlayer(item)) {
+            // a newly attached player has its own readahead, rate and count, apply ours again
+            player->hasFile = false;
+            player->isBuffering = false;
+            player->rawInputRate = 0;
+            player->networkRate = 0;
+            player->bytesConsumed = -1;
+            player->isApplied = false;
+            scheduleRebalance();
+        }
+    });
+    connect(item, &MpvAbstractItem::priorityChanged, this, &MpvBandwidthArbiter::scheduleRebalance);
+    scheduleRebalance();
+}
+
+void MpvBandwidthArbiter::unregisterPlayer(MpvAbstractItem *item)
+{
+    disconnect(item, nullptr, this, nullptr);
+    m_players.removeIf([item](const Player &player) {
+        return player.item == item || !player.item;
+    });
+    scheduleRebalance();
+}
+
+void MpvBandwidthArbiter::onPropertyChanged(MpvAbstractItem *item, const QString &property, const QVariant &value)
+{
+    auto player = findPlayer(item);
+    if (!player) {
+        return;
+    }
+    if (property == QStringLiteral("demuxer-cache-state")) {
+        player->rawInputRate = value.toMap().value(QStringLiteral("raw-input-rate")).toLongLong();
+    } else if (property == QStringLiteral("path")) {
+        player->isFetchedByMpv = isFetchedByMpv(value.toString());
+    } else if (property == QStringLiteral("paused-for-cache")) {
+        const bool isBuffering = value.toBool();
+        if (player->isBuffering != isBuffering) {
+            player->isBuffering = isBuffering;
+            // the others have to make room now
+            rebalance();
+        }
+    }
+}
+
+void MpvBandwidthArbiter::scheduleRebalance()
+{
+    if (!m_rebalanceTimer.isActive()) {
+        m_rebalanceTimer.start();
+    }
+}
+
+void MpvBandwidthArbiter::sample()
+{
+    const qint64 elapsed = m_sampleClock.isValid() ? m_sampleClock.restart() : 0;
+    if (!m_sampleClock.isValid()) {
+        m_sampleClock.start();
+    }
+    QList<MpvBandwidthEstimator::Sample> samples;
+    bool isFetchingChanged = false;
+    for (auto &player : m_players) {
+        if (!player.item) {
+            continue;
+        }
+        // raw-input-rate also counts local reads, it only says something about
+        // the network for sources mpv fetches itself
+        qint64 networkRate = player.isFetchedByMpv ? player.rawInputRate : 0;
+        if (auto controller = player.item->mpvController()) {
+            const qint64 consumed = controller->rateLimiter()->bytesConsumed();
+            if (player.bytesConsumed >= 0 && elapsed > 0) {
+                networkRate += (consumed - player.bytesConsumed) * 1000 / elapsed;
+            }
+            player.bytesConsumed = consumed;
+        }
+        if (!player.hasFile) {
+            networkRate = 0;
+        }
+        // the players fetching share the bandwidth
+        if ((networkRate > 0) != (player.networkRate > 0)) {
+            isFetchingChanged = true;
+        }
+        player.networkRate = networkRate;
+        if (player.hasFile) {
+            // the rates only hold back the stream protocols
+            samples.append({networkRate, player.isFetchedByMpv ? 0 : player.rate});
+        }
+    }
+    const double previous = m_estimator.estimate();
+    m_estimator.addSamples(elapsed, samples);
+    const double estimate = m_estimator.estimate();
+    // the shares follow the estimate once it moved noticeably
+    if (isFetchingChanged || (m_totalBandwidth == 0 && qAbs(estimate - previous) > previous * 0.2)) {
+        scheduleRebalance();
+    }
+}
+
+double MpvBandwidthArbiter::priorityReadahead(MpvAbstractItem::Priority priority)
+{
+    switch (priority) {
+    case MpvAbstractItem::FocusedPriority:
+        return DefaultReadahead;
+    case MpvAbstractItem::VisiblePriority:
+        return 10;
+    case MpvAbstractItem::BackgroundPriority:
+        return 3;
+    }
+    return DefaultReadahead;
+}
+
+void MpvBandwidthArbiter::rebalance()
+{
+    m_rebalanceTimer.stop();
+    m_players.removeIf([](const Player &player) {
+        return !player.item;
+    });
+
+    // the most important priority present, lower values come first
+    auto top = MpvAbstractItem::BackgroundPriority;
+    bool isTopBuffering = false;
+    bool hasFiles = false;
+    for (const auto &player : std::as_const(m_players)) {
+        top = qMin(top, player.item->priority());
+        hasFiles = hasFiles || player.hasFile;
+    }
+    double totalWeight = 0;
+    for (const auto &player : std::as_const(m_players)) {
+        if (player.item->priority() == top && player.isBuffering) {
+            isTopBuffering = true;
+        }
+        if (player.hasFile && player.networkRate > 0) {
+            totalWeight += MpvCacheBudget::priorityWeight(player.item->priority());
+        }
+    }
+    if (m_isEnabled && hasFiles) {
+        if (!m_sampleTimer.isActive()) {
+            // the first sample only takes the counts
+            m_sampleClock.invalidate();
+            m_sampleTimer.start();
+        }
+    } else {
+        m_sampleTimer.stop();
+    }
+    const double bandwidth = m_totalBandwidth > 0 ? m_totalBandwidth : m_estimator.estimate();
+
+    bool changed = false;
+    for (auto &player : m_players) {
+        const auto priority = player.item->priority();
+        // the application's readahead is kept, the rate still applies
+        const QString readaheadOption = QStringLiteral("demuxer-readahead-secs");
+        const bool isUserReadahead = player.item->isUserOption(readaheadOption);
+        const double userReadahead = isUserReadahead ? player.item->d_ptr->m_options.value(readaheadOption).toDouble() : DefaultReadahead;
+        // the highest priority present reads ahead as much as without the arbiter
+        double readahead = userReadahead;
+        qint64 rate = 0;
+        if (m_isEnabled && priority != top) {
+            if (isTopBuffering) {
+                readahead = isUserReadahead ? userReadahead : MinimumReadahead;
+                rate = MinimumRate;
+            } else {
+                readahead = isUserReadahead ? userReadahead : priorityReadahead(priority);
+                // unknown until some player read something; an idle player
+                // gets the share it would have once it fetches again
+                const double weight = MpvCacheBudget::priorityWeight(priority);
+                const double sharingWeight = totalWeight + (player.hasFile && player.networkRate > 0 ? 0 : weight);
+                if (bandwidth > 0) {
+                    rate = qMax<qint64>(MinimumRate, qint64(bandwidth * weight / sharingWeight));
+                }
+            }
+        }
+
+        // skip small rate adjustments, every readahead change goes through the player's worker
+        const bool isRateChanged = qAbs(player.rate - rate) > rate / 10 || (rate == 0) != (player.rate == 0);
+        if (player.isApplied && player.readahead == readahead && !isRateChanged) {
+            continue;
+        }
+        if (!isUserReadahead && (!player.isApplied || player.readahead != readahead)) {
+            player.item->setProperty(readaheadOption, readahead);
+        }
+        // without a player yet, initialized() has it applied
+        if (auto controller = player.item->mpvController()) {
+            controller->rateLimiter()->setRate(rate);
+        }
+        player.isApplied = true;
+        player.readahead = readahead;
+        player.rate = rate;
+        player.item->d_ptr->setBandwidthAllocation(readahead, rate);
+        changed = true;
+        qCDebug(MpvQt_MpvBandwidthArbiter) << player.item << "priority" << priority << "readahead" << readahead << "rate" << rate;
+    }
+    if (changed) {
+        Q_EMIT allocationsChanged();
+    }
+}
+
+MpvBandwidthArbiter::Player *MpvBandwidthArbiter::findPlayer(const MpvAbstractItem *item)
+{
+    for (auto &player : m_players) {
+        if (player.item == item) {
+            return &player;
+        }
+    }
+    return nullptr;
+}
+
+const MpvBandwidthArbiter::Player *MpvBandwidthArbiter::findPlayer(const MpvAbstractItem *item) const
+{
+    for (const auto &player : m_players) {
+        if (player.item == item) {
+            return &player;
+        }
+    }
+    return nullptr;
+}
+
+#include "moc_mpvbandwidtharbiter.cpp"
@@ -0,0 +1,133 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVBANDWIDTHARBITER_H
+#define MPVBANDWIDTHARBITER_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#include "mpvabstractitem.h"
+#include "mpvbandwidthestimator.h"
+
+/**
+ * Process-wide arbiter of the network bandwidth shared by all players.
+ *
+ * Every item with a player registers here. The players of the highest
+ * priority present are never throttled: they read ahead DefaultReadahead
+ * seconds, as without the arbiter, at any rate. The others get a readahead
+ * target by priority (10 s visible, 3 s background), applied as
+ * demuxer-readahead-secs, and a rate applied to what their stream protocols
+ * fetch through MpvController::rateLimiter(); they share the bandwidth by the
+ * weights of MpvCacheBudget, with at least MinimumRate each. Only the players
+ * that fetched from the network over the last sample take part in sharing:
+ * one that is idle, with a full readahead or a local file, leaves its share to
+ * the others, and a throttled one that is idle gets the share it would have
+ * once it fetches again. A
+ * demuxer-readahead-secs option set by the application is never overwritten,
+ * only the rate applies to its player.
+ *
+ * While a player of the highest priority is buffering, the others drop to
+ * MinimumReadahead and MinimumRate until it plays again.
+ *
+ * The bandwidth is totalBandwidth() when set, otherwise estimated from what
+ * all players fetch from the network by MpvBandwidthEstimator, which probes
+ * above what the throttled players fetch while they are held back by their
+ * rates. What they fetch is what their stream protocols report
+ * through MpvStream::takeNetworkBytes(), and the input rate of the sources mpv
+ * fetches itself over the network; local files don't count. Those sources are
+ * only held back by their readahead, the rates apply to what the network-backed
+ * stream protocols (MpvHttpCacheProtocol, MpvSegmentLoaderProtocol) fetch.
+ *
+ * Lives on the GUI thread.
+ */
+class MpvBandwidthArbiter : public QObject
+{
+    Q_OBJECT
+public:
+    static MpvBandwidthArbiter *instance();
+
+    /**
+     * When disabled every player reads ahead DefaultReadahead seconds, or the
+     * demuxer-readahead-secs the application set, unthrottled.
+     */
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Bytes per second shared by all players, 0 (the default) to estimate it.
+     */
+    qint64 totalBandwidth() const;
+    void setTotalBandwidth(qint64 bytesPerSecond);
+
+    /**
+     * Bytes per second the link is estimated to carry, see MpvBandwidthEstimator.
+     */
+    qint64 estimatedBandwidth() const;
+
+    /**
+     * Seconds @p item reads ahead, and the bytes per second its stream
+     * protocols may read, 0 if they aren't throttled.
+     */
+    double readahead(const MpvAbstractItem *item) const;
+    qint64 rate(const MpvAbstractItem *item) const;
+
+    void registerPlayer(MpvAbstractItem *item);
+    void unregisterPlayer(MpvAbstractItem *item);
+
+    /**
+     * Recompute and apply the readaheads and rates. Changes of priority,
+     * files and buffering schedule this automatically.
+     */
+    void rebalance();
+
+    static constexpr double DefaultReadahead = 30;
+    static constexpr double MinimumReadahead = 1;
+    static constexpr qint64 MinimumRate = 64 * 1024;
+
+Q_SIGNALS:
+    void allocationsChanged();
+
+private:
+    explicit MpvBandwidthArbiter(QObject *parent = nullptr);
+    void scheduleRebalance();
+    void sample();
+    void onPropertyChanged(MpvAbstractItem *item, const QString &property, const QVariant &value);
+    static double priorityReadahead(MpvAbstractItem::Priority priority);
+
+    struct Player {
+        QPointer<MpvAbstractItem> item;
+        bool hasFile{false};
+        bool isBuffering{false};
+        // mpv reads the current file over the network itself, not through a stream protocol
+        bool isFetchedByMpv{false};
+        // bytes per second read by the demuxer, from demuxer-cache-state
+        qint64 rawInputRate{0};
+        // bytes per second fetched from the network over the last sample
+        qint64 networkRate{0};
+        // the rate limiter's count at the last sample, -1 before the first one
+        qint64 bytesConsumed{-1};
+        double readahead{DefaultReadahead};
+        qint64 rate{0};
+        // false until the allocation was set on the current player
+        bool isApplied{false};
+    };
+    Player *findPlayer(const MpvAbstractItem *item);
+    const Player *findPlayer(const MpvAbstractItem *item) const;
+
+    QList<Player> m_players;
+    QTimer m_rebalanceTimer;
+    // measures the input rates while players have files
+    QTimer m_sampleTimer;
+    QElapsedTimer m_sampleClock;
+    qint64 m_totalBandwidth{0};
+    MpvBandwidthEstimator m_estimator;
+    bool m_isEnabled{true};
+};
+
+#endif // MPVBANDWIDTHARBITER_H
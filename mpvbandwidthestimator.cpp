@@ -0,0 +1,39 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvbandwidthestimator.h"
+
+#include <QtMath>
+
+double MpvBandwidthEstimator::estimate() const
+{
+    return m_estimate;
+}
+
+void MpvBandwidthEstimator::addSamples(qint64 elapsed, const QList<Sample> &samples)
+{
+    qint64 total = 0;
+    bool isHeldBack = false;
+    bool isShort = false;
+    for (const auto &sample : samples) {
+        total += sample.networkRate;
+        if (sample.rate > 0 && sample.networkRate > 0) {
+            if (sample.networkRate >= sample.rate * Saturation) {
+                isHeldBack = true;
+            } else {
+                isShort = true;
+            }
+        }
+    }
+    if (isHeldBack) {
+        // the link carried all of it and some player wanted more
+        m_estimate = qMax(m_estimate, total * ProbeFactor);
+    } else if (isShort) {
+        m_estimate = qMax<double>(total, m_estimate * qPow(Decay, elapsed / 1000.0));
+    } else {
+        m_estimate = qMax<double>(total, m_estimate);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVBANDWIDTHESTIMATOR_H
+#define MPVBANDWIDTHESTIMATOR_H
+
+#include <QList>
+
+/**
+ * Estimate of the capacity of the link all players fetch over, for
+ * MpvBandwidthArbiter.
+ *
+ * What the players fetch together is only a lower bound: the throttled ones
+ * fetch at most their rate, the others only until their readahead is full.
+ * So the estimate rises to the sum whenever it is higher, and above it when
+ * a throttled player fetched its whole rate and might have fetched more:
+ * ProbeFactor times the sum. It only decays, by Decay per second, while a
+ * throttled player fetched less than its rate, the one sign of a link
+ * carrying less than estimated. Idle players say nothing about the link.
+ *
+ * Not thread-safe.
+ */
+class MpvBandwidthEstimator
+{
+public:
+    struct Sample {
+        // bytes per second the player fetched from the network
+        qint64 networkRate{0};
+        // bytes per second it was limited to, 0 if it wasn't
+        qint64 rate{0};
+    };
+
+    /**
+     * Bytes per second, 0 before any player fetched something.
+     */
+    double estimate() const;
+
+    /**
+     * Account for what the players with a file fetched over the last @p elapsed milliseconds.
+     */
+    void addSamples(qint64 elapsed, const QList<Sample> &samples);
+
+    // part of its rate a throttled player has to fetch to count as held back
+    static constexpr double Saturation = 0.9;
+    static constexpr double ProbeFactor = 1.25;
+    static constexpr double Decay = 0.95;
+
+private:
+    double m_estimate{0};
+};
+
+#endif // MPVBANDWIDTHESTIMATOR_H
@@ -0,0 +1,370 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvcachebudget.h"
+
+#include <QCoreApplication>
+#include <QLoggingCategory>
+
+#include "mpvabstractitem_p.h"
+
+Q_LOGGING_CATEGORY(MpvQt_MpvCacheBudget, "MpvQt.MpvCacheBudget")
+
+MpvCacheBudget *MpvCacheBudget::instance()
+{
+    static QPointer<MpvCacheBudget> budget;
+    if (!budget) {
+        budget = new MpvCacheBudget(QCoreApplication::instance());
+    }
+    return budget;
+}
+
+MpvCacheBudget::MpvCacheBudget(QObject *parent)
+    : QObject(parent)
+{
+    // bitrates are reported continuously, don't rebalance on every update
+    m_rebalanceTimer.setSingleShot(true);
+    m_rebalanceTimer.setInterval(500);
+    connect(&m_rebalanceTimer, &QTimer::timeout, this, &MpvCacheBudget::rebalance);
+
+    auto monitor = MpvMemoryPressure::instance();
+    m_pressure = monitor->level();
+    connect(monitor, &MpvMemoryPressure::levelChanged, this, &MpvCacheBudget::onPressureChanged);
+}
+
+qint64 MpvCacheBudget::totalBudget() const
+{
+    return m_totalBudget;
+}
+
+void MpvCacheBudget::setTotalBudget(qint64 bytes)
+{
+    if (m_totalBudget == bytes) {
+        return;
+    }
+    m_totalBudget = bytes;
+    rebalance();
+}
+
+qint64 MpvCacheBudget::effectiveBudget() const
+{
+    switch (m_pressure) {
+    case MpvMemoryPressure::NoPressure:
+        break;
+    case MpvMemoryPressure::ModeratePressure:
+        return m_totalBudget / 2;
+    case MpvMemoryPressure::CriticalPressure:
+        return m_totalBudget / 4;
+    }
+    return m_totalBudget;
+}
+
+void MpvCacheBudget::onPressureChanged(MpvMemoryPressure::Level level)
+{
+    m_pressure = level;
+    // shrinking has to happen now, growing back can wait for the next regular rebalance
+    if (level == MpvMemoryPressure::NoPressure) {
+        scheduleRebalance();
+    } else {
+        rebalance();
+    }
+}
+
+bool MpvCacheBudget::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void MpvCacheBudget::setEnabled(bool enabled)
+{
+    if (m_isEnabled == enabled) {
+        return;
+    }
+    m_isEnabled = enabled;
+    rebalance();
+}
+
+qint64 MpvCacheBudget::allocation(const MpvAbstractItem *item) const
+{
+    auto player = findPlayer(item);
+    return player ? player->forwardBytes + player->backBytes : 0;
+}
+
+void MpvCacheBudget::registerPlayer(MpvAbstractItem *item)
+{
+    if (findPlayer(item)) {
+        return;
+    }
+    Player player;
+    player.item = item;
+    m_players.append(player);
+
+    connect(item, &MpvAbstractItem::propertyChanged, this, [this, item](const QString &property, const QVariant &value) {
+        onPropertyChanged(item, property, value);
+    });
+    connect(item, &MpvAbstractItem::fileLoaded, this, [this, item]() {
+        if (auto player = findPlayer(item)) {
+            player->hasFile = true;
+            scheduleRebalance();
+        }
+    });
+    connect(item, &MpvAbstractItem::endFile, this, [this, item]() {
+        if (auto player = findPlayer(item)) {
+            player->hasFile = false;
+            scheduleRebalance();
+        }
+    });
+    connect(item, &MpvAbstractItem::initialized, this, [this, item]() {
+        if (auto player = findPlayer(item)) {
+            // a newly attached player has its own cache settings, apply ours again
+            player->hasFile = false;
+            player->videoBitrate = 0;
+            player->audioBitrate = 0;
+            player->isApplied = false;
+            scheduleRebalance();
+        }
+    });
+    connect(item, &MpvAbstractItem::priorityChanged, this, &MpvCacheBudget::scheduleRebalance);
+    // the application may take over the cache sizes
+    connect(item, &MpvAbstractItem::optionsChanged, this, &MpvCacheBudget::scheduleRebalance);
+    scheduleRebalance();
+}
+
+void MpvCacheBudget::unregisterPlayer(MpvAbstractItem *item)
+{
+    disconnect(item, nullptr, this, nullptr);
+    m_players.removeIf([item](const Player &player) {
+        return player.item == item || !player.item;
+    });
+    scheduleRebalance();
+}
+
+void MpvCacheBudget::onPropertyChanged(MpvAbstractItem *item, const QString &property, const QVariant &value)
+{
+    if (property != QStringLiteral("video-bitrate") && property != QStringLiteral("audio-bitrate")) {
+        return;
+    }
+    auto player = findPlayer(item);
+    if (!player) {
+        return;
+    }
+    // mpv reports bits per second
+    const double bytesPerSecond = value.toDouble() / 8.0;
+    double &bitrate = property == QStringLiteral("video-bitrate") ? player->videoBitrate : player->audioBitrate;
+    // only bitrate changes that move the allocation noticeably are worth a rebalance
+    if (qAbs(bytesPerSecond - bitrate) > bitrate * 0.2) {
+        bitrate = bytesPerSecond;
+        scheduleRebalance();
+    }
+}
+
+void MpvCacheBudget::scheduleRebalance()
+{
+    if (!m_rebalanceTimer.isActive()) {
+        m_rebalanceTimer.start();
+    }
+}
+
+double MpvCacheBudget::priorityWeight(MpvAbstractItem::Priority priority)
+{
+    switch (priority) {
+    case MpvAbstractItem::FocusedPriority:
+        return 8.0;
+    case MpvAbstractItem::VisiblePriority:
+        return 3.0;
+    case MpvAbstractItem::BackgroundPriority:
+        return 1.0;
+    }
+    return 1.0;
+}
+
+double MpvCacheBudget::backFraction(MpvAbstractItem::Priority priority) const
+{
+    // back buffers are the first thing to go under pressure, they only help seeking back
+    if (m_pressure == MpvMemoryPressure::CriticalPressure) {
+        return 0;
+    }
+    if (m_pressure == MpvMemoryPressure::ModeratePressure && priority != MpvAbstractItem::FocusedPriority) {
+        return 0;
+    }
+    // the part of the allocation kept for seeking back
+    switch (priority) {
+    case MpvAbstractItem::FocusedPriority:
+        return 0.25;
+    case MpvAbstractItem::VisiblePriority:
+        return 0.15;
+    case MpvAbstractItem::BackgroundPriority:
+        return 0.05;
+    }
+    return 0.1;
+}
+
+void MpvCacheBudget::rebalance()
+{
+    m_rebalanceTimer.stop();
+    m_players.removeIf([](const Player &player) {
+        return !player.item;
+    });
+    if (!m_isEnabled || m_players.isEmpty()) {
+        return;
+    }
+
+    // under critical pressure background players only keep the minimum
+    const auto isStarved = [this](const Player &player) {
+        return !player.hasFile
+            || (m_pressure == MpvMemoryPressure::CriticalPressure && player.item->priority() == MpvAbstractItem::BackgroundPriority);
+    };
+
+    const QString forwardOption = QStringLiteral("demuxer-max-bytes");
+    const QString backOption = QStringLiteral("demuxer-max-back-bytes");
+    // bytes of each player divided by the budget, -1 for players keeping the sizes the application set
+    QList<qint64> shares(m_players.size(), 0);
+    // 0 for players getting the minimum
+    QList<double> weights(m_players.size(), 0);
+    qint64 available = effectiveBudget();
+    int managed = 0;
+    for (int i = 0; i < m_players.size(); ++i) {
+        const auto &player = m_players.at(i);
+        const auto d = player.item->d_ptr.get();
+        if (d->isUserOption(forwardOption) || d->isUserOption(backOption)) {
+            shares[i] = -1;
+            available -= qMax<qint64>(0, parseByteSize(d->m_options.value(forwardOption)));
+            available -= qMax<qint64>(0, parseByteSize(d->m_options.value(backOption)));
+            continue;
+        }
+        ++managed;
+        if (!isStarved(player)) {
+            const double bitrate = player.videoBitrate + player.audioBitrate;
+            weights[i] = priorityWeight(player.item->priority()) * (bitrate > 0 ? bitrate : DefaultBitrate);
+        }
+    }
+    available = qMax<qint64>(available, 0);
+    // with many players the minimum shrinks, so together they stay within the budget
+    const qint64 minimum = managed > 0 ? qMin(MinimumAllocation, available / managed) : 0;
+
+    // players whose share falls below the minimum get the minimum, the others divide what is left
+    bool isSettled = false;
+    while (!isSettled) {
+        isSettled = true;
+        qint64 remaining = available;
+        double totalWeight = 0;
+        for (int i = 0; i < m_players.size(); ++i) {
+            if (shares.at(i) < 0) {
+                continue;
+            }
+            if (weights.at(i) > 0) {
+                totalWeight += weights.at(i);
+            } else {
+                remaining -= minimum;
+            }
+        }
+        for (int i = 0; i < m_players.size(); ++i) {
+            if (shares.at(i) < 0) {
+                continue;
+            }
+            if (weights.at(i) <= 0) {
+                shares[i] = minimum;
+                continue;
+            }
+            shares[i] = qint64(remaining * (weights.at(i) / totalWeight));
+            if (shares.at(i) < minimum) {
+                weights[i] = 0;
+                shares[i] = minimum;
+                isSettled = false;
+            }
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < m_players.size(); ++i) {
+        auto &player = m_players[i];
+        const auto priority = player.item->priority();
+        const qint64 share = shares.at(i);
+        if (share < 0) {
+            // the application's own sizes stay, taken again should it unset them
+            const auto d = player.item->d_ptr.get();
+            player.isApplied = false;
+            d->setCacheAllocation(qMax<qint64>(0, parseByteSize(d->m_options.value(forwardOption)))
+                                  + qMax<qint64>(0, parseByteSize(d->m_options.value(backOption))));
+            continue;
+        }
+        const qint64 back = qint64(share * backFraction(priority));
+        const qint64 forward = share - back;
+
+        // skip tiny adjustments, every change goes through the player's worker
+        const auto differs = [](qint64 current, qint64 wanted) {
+            return qAbs(current - wanted) > wanted / 20 || (wanted == 0 && current != 0);
+        };
+        if (player.isApplied && !differs(player.forwardBytes, forward) && !differs(player.backBytes, back)) {
+            continue;
+        }
+        player.isApplied = true;
+        player.forwardBytes = forward;
+        player.backBytes = back;
+        player.item->setProperty(forwardOption, forward);
+        player.item->setProperty(backOption, back);
+        player.item->d_ptr->setCacheAllocation(forward + back);
+        changed = true;
+        qCDebug(MpvQt_MpvCacheBudget) << player.item << "priority" << priority << "forward" << forward << "back" << back;
+    }
+    if (changed) {
+        Q_EMIT allocationsChanged();
+    }
+}
+
+qint64 MpvCacheBudget::parseByteSize(const QVariant &value)
+{
+    bool isNumber = false;
+    const qint64 bytes = value.toLongLong(&isNumber);
+    if (isNumber) {
+        return bytes;
+    }
+    // mpv's byte size syntax, a number with a binary suffix
+    static const QList<std::pair<QString, qint64>> suffixes{
+        {QStringLiteral("kib"), 1LL << 10},
+        {QStringLiteral("mib"), 1LL << 20},
+        {QStringLiteral("gib"), 1LL << 30},
+        {QStringLiteral("tib"), 1LL << 40},
+        {QStringLiteral("k"), 1LL << 10},
+        {QStringLiteral("m"), 1LL << 20},
+        {QStringLiteral("g"), 1LL << 30},
+        {QStringLiteral("t"), 1LL << 40},
+        {QStringLiteral("b"), 1},
+    };
+    QString text = value.toString().trimmed().toLower();
+    qint64 multiplier = 1;
+    for (const auto &[suffix, factor] : suffixes) {
+        if (text.endsWith(suffix)) {
+            text.chop(suffix.size());
+            multiplier = factor;
+            break;
+        }
+    }
+    const double number = text.trimmed().toDouble(&isNumber);
+    return isNumber ? qint64(number * multiplier) : -1;
+}
+
+MpvCacheBudget::Player *MpvCacheBudget::findPlayer(const MpvAbstractItem *item)
+{
+    for (auto &player : m_players) {
+        if (player.item == item) {
+            return &player;
+        }
+    }
+    return nullptr;
+}
+
+const MpvCacheBudget::Player *MpvCacheBudget::findPlayer(const MpvAbstractItem *item) const
+{
+    for (const auto &player : m_players) {
+        if (player.item == item) {
+            return &player;
+        }
+    }
+    return nullptr;
+}
+
+#include "moc_mpvcachebudget.cpp"
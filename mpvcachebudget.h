@@ -0,0 +1,118 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVCACHEBUDGET_H
+#define MPVCACHEBUDGET_H
+
+#include <QObject>
+#include <QPointer>
+#include <QTimer>
+
+#include "mpvabstractitem.h"
+#include "mpvmemorypressure.h"
+
+/**
+ * Process-wide budget for the demuxer caches of all players.
+ *
+ * Every item with a player registers here. The budget is divided among the
+ * players that have a file loaded, weighted by their priority (focused,
+ * visible, background) and their estimated bitrate, and applied live as
+ * demuxer-max-bytes and demuxer-max-back-bytes through their controllers.
+ * Players without a file only get the minimum allocation.
+ *
+ * Players whose application set demuxer-max-bytes or demuxer-max-back-bytes
+ * through MpvAbstractItem::setOption() keep their own cache sizes, which are
+ * taken out of the budget before dividing it. With too many players for the
+ * budget the minimum allocation shrinks, so the total never exceeds it.
+ *
+ * Under memory pressure (see MpvMemoryPressure) the budget shrinks: at moderate
+ * pressure to half and without back buffers except for the focused player, at
+ * critical pressure to a quarter, without any back buffer and with background
+ * players reduced to the minimum. The limits are restored once pressure clears.
+ *
+ * Lives on the GUI thread.
+ */
+class MpvCacheBudget : public QObject
+{
+    Q_OBJECT
+public:
+    static MpvCacheBudget *instance();
+
+    /**
+     * Total bytes shared by all players. Defaults to 1 GiB.
+     */
+    qint64 totalBudget() const;
+    void setTotalBudget(qint64 bytes);
+
+    /**
+     * When disabled the players keep their own demuxer-max-bytes settings.
+     */
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Bytes currently allocated to @p item, forward and back cache together.
+     */
+    qint64 allocation(const MpvAbstractItem *item) const;
+
+    void registerPlayer(MpvAbstractItem *item);
+    void unregisterPlayer(MpvAbstractItem *item);
+
+    /**
+     * Recompute and apply the allocations. Changes of priority and bitrate
+     * schedule this automatically.
+     */
+    void rebalance();
+
+    /**
+     * The budget actually divided, totalBudget() reduced according to the memory pressure.
+     */
+    qint64 effectiveBudget() const;
+
+    /**
+     * How much more a player of @p priority gets than a background one.
+     */
+    static double priorityWeight(MpvAbstractItem::Priority priority);
+
+    // smallest allocation a player gets, lowered when there are too many players for the budget
+    static constexpr qint64 MinimumAllocation = 4 * 1024 * 1024;
+    // bitrate assumed when mpv doesn't report one yet, in bytes per second
+    static constexpr double DefaultBitrate = 2'000'000 / 8.0;
+
+Q_SIGNALS:
+    void allocationsChanged();
+
+private:
+    explicit MpvCacheBudget(QObject *parent = nullptr);
+    void scheduleRebalance();
+    void onPropertyChanged(MpvAbstractItem *item, const QString &property, const QVariant &value);
+    double backFraction(MpvAbstractItem::Priority priority) const;
+    void onPressureChanged(MpvMemoryPressure::Level level);
+    // bytes of an mpv byte size option value such as 50000000 or "64MiB", -1 if invalid
+    static qint64 parseByteSize(const QVariant &value);
+
+    struct Player {
+        QPointer<MpvAbstractItem> item;
+        bool hasFile{false};
+        // bytes per second, 0 if unknown
+        double videoBitrate{0};
+        double audioBitrate{0};
+        qint64 forwardBytes{0};
+        qint64 backBytes{0};
+        // false until the allocation was set on the current player
+        bool isApplied{false};
+    };
+    Player *findPlayer(const MpvAbstractItem *item);
+    const Player *findPlayer(const MpvAbstractItem *item) const;
+
+    QList<Player> m_players;
+    QTimer m_rebalanceTimer;
+    qint64 m_totalBudget{1024LL * 1024 * 1024};
+    bool m_isEnabled{true};
+    MpvMemoryPressure::Level m_pressure{MpvMemoryPressure::NoPressure};
+};
+
+#endif // MPVCACHEBUDGET_H
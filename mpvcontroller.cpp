@@ -6,9 +6,15 @@
 
 #include "mpvcontroller.h"
 #include "mpvcontroller_p.h"
+#include "mpvlibrary.h"
+#include "mpvstreamprotocol.h"
+#include "mpvworkerpool.h"
 
 #include <QLoggingCategory>
+#include <QMutexLocker>
+#include <QSemaphore>
 #include <QStandardPaths>
+#include <QThread>
 #include <QVariant>
 
 #include <clocale>
@@ -166,8 +172,153 @@ inline QVariant MpvControllerPrivate::nodeToVariant(const mpv_node *node)
     }
 }
 
+int MpvControllerPrivate::setOption(const QString &name, const QVariant &value)
+{
+    mpv_node node;
+    setNode(&node, value);
+    int err = mpv_set_option(m_mpv, name.toUtf8().constData(), MPV_FORMAT_NODE, &node);
+    freeNode(&node);
+    if (err < 0) {
+        qCWarning(MpvQt_MpvController) << "could not set option" << name << value << MpvController::getError(err);
+    }
+    return err;
+}
+
+void MpvControllerPrivate::rememberOriginalValue(const QString &property)
+{
+    if (m_originalValues.contains(property)) {
+        return;
+    }
+    mpv_node node;
+    int err = 0;
+    MpvWorkerPool::blockingCall([this, &property, &node, &err]() {
+        err = mpv_get_property(m_mpv, property.toUtf8().constData(), MPV_FORMAT_NODE, &node);
+    });
+    if (err < 0) {
+        // not readable (e.g. a runtime-only property), nothing to restore
+        return;
+    }
+    node_autofree f(&node);
+    m_originalValues.insert(property, nodeToVariant(&node));
+}
+
+MpvValue MpvControllerPrivate::propertyToValue(const mpv_event_property *prop)
+{
+    if (!prop->data) {
+        return {};
+    }
+    switch (prop->format) {
+    case MPV_FORMAT_DOUBLE:
+        return *reinterpret_cast<double *>(prop->data);
+    case MPV_FORMAT_STRING:
+        return QByteArray(*reinterpret_cast<char **>(prop->data));
+    case MPV_FORMAT_INT64:
+        return qint64(*reinterpret_cast<int64_t *>(prop->data));
+    case MPV_FORMAT_FLAG:
+        return *reinterpret_cast<int *>(prop->data) != 0;
+    case MPV_FORMAT_NODE: {
+        auto node = reinterpret_cast<mpv_node *>(prop->data);
+        switch (node->format) {
+        case MPV_FORMAT_STRING:
+            return QByteArray(node->u.string);
+        case MPV_FORMAT_FLAG:
+            return node->u.flag != 0;
+        case MPV_FORMAT_INT64:
+            return qint64(node->u.int64);
+        case MPV_FORMAT_DOUBLE:
+            return node->u.double_;
+        case MPV_FORMAT_NODE_ARRAY:
+        case MPV_FORMAT_NODE_MAP:
+            return nodeToVariant(node);
+        default:
+            return {};
+        }
+    }
+    default:
+        return {};
+    }
+}
+
+void MpvControllerPrivate::observeSubscriptions()
+{
+    QMutexLocker locker(&m_subscriptionsMutex);
+    for (auto it = m_subscriptions.constBegin(); it != m_subscriptions.constEnd(); ++it) {
+        if (!it->property.isEmpty()) {
+            mpv_observe_property(m_mpv, it.key(), it->property.constData(), it->format);
+        }
+    }
+    m_subscriptionsObserved = true;
+}
+
+bool MpvControllerPrivate::dispatchToSubscribers(const mpv_event *event)
+{
+    if (event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+        if (event->reply_userdata < SubscriptionIdBase) {
+            return false;
+        }
+        std::shared_ptr<MpvSubscriber> callback;
+        {
+            QMutexLocker locker(&m_subscriptionsMutex);
+            auto it = m_subscriptions.constFind(event->reply_userdata);
+            if (it == m_subscriptions.constEnd()) {
+                // unsubscribed while the event was queued, drop it
+                return true;
+            }
+            callback = it->callback;
+        }
+        auto prop = static_cast<mpv_event_property *>(event->data);
+        MpvNotification notification;
+        notification.event = event->event_id;
+        notification.subscription = event->reply_userdata;
+        notification.name = QByteArray(prop->name);
+        notification.value = propertyToValue(prop);
+        notification.error = event->error;
+        (*callback)(notification);
+        return true;
+    }
+
+    switch (event->event_id) {
+    case MPV_EVENT_START_FILE:
+    case MPV_EVENT_FILE_LOADED:
+    case MPV_EVENT_END_FILE:
+    case MPV_EVENT_VIDEO_RECONFIG:
+    case MPV_EVENT_AUDIO_RECONFIG:
+    case MPV_EVENT_SEEK:
+    case MPV_EVENT_PLAYBACK_RESTART:
+    case MPV_EVENT_SHUTDOWN:
+        break;
+    default:
+        return false;
+    }
+
+    QList<std::pair<uint64_t, std::shared_ptr<MpvSubscriber>>> callbacks;
+    {
+        QMutexLocker locker(&m_subscriptionsMutex);
+        for (auto it = m_subscriptions.constBegin(); it != m_subscriptions.constEnd(); ++it) {
+            if (it->property.isEmpty()) {
+                callbacks.append({it.key(), it->callback});
+            }
+        }
+    }
+
+    MpvNotification notification;
+    notification.event = event->event_id;
+    notification.error = event->error;
+    if (event->event_id == MPV_EVENT_END_FILE) {
+        auto endFile = static_cast<mpv_event_end_file *>(event->data);
+        notification.value = qint64(endFile->reason);
+        notification.error = endFile->error;
+    }
+    for (const auto &[id, callback] : std::as_const(callbacks)) {
+        notification.subscription = id;
+        (*callback)(notification);
+    }
+    return false;
+}
+
 MpvController::MpvController(QObject *parent)
     : QObject(parent)
+    , d_ptr{std::make_unique<MpvControllerPrivate>(this)}
 {
 }
 
@@ -176,36 +327,131 @@ MpvController::~MpvController()
     if (d_ptr && d_ptr->m_mpv) {
         mpv_set_wakeup_callback(d_ptr->m_mpv, nullptr, nullptr);
     }
+    MpvThreadTracker::instance()->forget(this);
 }
 
-void MpvController::init()
+void MpvController::init(const QVariantMap &options)
 {
-    d_ptr = std::make_unique<MpvControllerPrivate>(this);
     // Qt sets the locale in the QGuiApplication constructor, but libmpv
     // requires the LC_NUMERIC category to be set to "C", so change it back.
     std::setlocale(LC_NUMERIC, "C");
 
+    // a no-op unless libmpv is loaded lazily, in which case the first player pays for it here
+    bool isLoaded = false;
+    MpvWorkerPool::blockingCall([&isLoaded]() {
+        isLoaded = MpvLibrary::load();
+    });
+    if (!isLoaded) {
+        qFatal("could not load libmpv: %s", qPrintable(MpvLibrary::errorString()));
+    }
+
     d_ptr->m_mpv = mpv_create();
     if (!d_ptr->m_mpv) {
         qFatal("could not create mpv context");
     }
-    if (mpv_initialize(d_ptr->m_mpv) < 0) {
-        qFatal("could not initialize mpv context");
-    }
-    mpv_set_wakeup_callback(d_ptr->m_mpv, MpvController::mpvEvents, this);
 
-    // otherwise mpv opens a separate window
+    // everything is applied as an option before mpv_initialize, so the core
+    // starts with its final configuration instead of being reconfigured afterwards
     QString configPath = QStandardPaths::writableLocation(QStandardPaths::ConfigLocation);
     configPath.append(QStringLiteral("/mpvqt"));
     configPath.append(QStringLiteral("/mpvqt.conf"));
-    setProperty(QStringLiteral("include"), configPath);
-    setProperty(QStringLiteral("vo"), QStringLiteral("libmpv"));
-    d_ptr->m_mpvHandleManager = std::make_shared<MpvHandleManager>(d_ptr->m_mpv);
+    d_ptr->setOption(QStringLiteral("include"), configPath);
+    // otherwise mpv opens a separate window
+    d_ptr->setOption(QStringLiteral("vo"), QStringLiteral("libmpv"));
+    // apply the profile first so the explicit options override it
+    const QString profile = QStringLiteral("profile");
+    if (options.contains(profile)) {
+        d_ptr->setOption(profile, options.value(profile));
+    }
+    for (auto it = options.constBegin(); it != options.constEnd(); ++it) {
+        if (it.key() != profile) {
+            d_ptr->setOption(it.key(), it.value());
+        }
+    }
+
+    int err = 0;
+    MpvWorkerPool::blockingCall([this, &err]() {
+        err = mpv_initialize(d_ptr->m_mpv);
+    });
+    if (err < 0) {
+        qFatal("could not initialize mpv context");
+    }
+    auto protocols = MpvStreamProtocol::install(d_ptr->m_mpv, d_ptr->m_rateLimiter);
+    d_ptr->observeSubscriptions();
+    mpv_set_wakeup_callback(d_ptr->m_mpv, MpvController::mpvEvents, this);
+
+    // pool workers are shared, only a dedicated thread belongs to this player
+    if (!d_ptr->m_strand) {
+        MpvThreadTracker::instance()->addThread(this, MpvThreadTracker::currentThreadId());
+    }
+    d_ptr->trackThreads();
+
+    d_ptr->m_mpvHandleManager = std::make_shared<MpvHandleManager>(d_ptr->m_mpv, std::move(protocols));
+    d_ptr->m_isInitialized = true;
+
+    Q_EMIT initialized();
+}
+
+void MpvController::setScheduling(const MpvSchedulingParameters &parameters)
+{
+    d_ptr->m_scheduling = parameters;
+    d_ptr->m_hasScheduling = true;
+    if (!d_ptr->m_strand) {
+        QThread::currentThread()->setPriority(parameters.threadPriority);
+    }
+    MpvThreadTracker::applyScheduling(parameters, MpvThreadTracker::instance()->threads(this));
+}
+
+void MpvControllerPrivate::trackThreads()
+{
+    const auto threads = MpvThreadTracker::instance()->attributeNewThreads(q_ptr);
+    if (m_hasScheduling && !threads.isEmpty()) {
+        MpvThreadTracker::applyScheduling(m_scheduling, threads);
+    }
 }
 
 void MpvController::mpvEvents(void *ctx)
 {
-    QMetaObject::invokeMethod(static_cast<MpvController *>(ctx), &MpvController::eventHandler, Qt::QueuedConnection);
+    auto controller = static_cast<MpvController *>(ctx);
+    controller->post([controller]() {
+        controller->eventHandler();
+    });
+}
+
+void MpvController::setStrand(std::shared_ptr<MpvStrand> strand)
+{
+    d_ptr->m_strand = std::move(strand);
+}
+
+void MpvController::post(std::function<void()> task)
+{
+    if (d_ptr->m_strand) {
+        d_ptr->m_strand->post(std::move(task));
+        return;
+    }
+    QMetaObject::invokeMethod(this, std::move(task), Qt::QueuedConnection);
+}
+
+void MpvController::postBlocking(std::function<void()> task)
+{
+    if (d_ptr->m_strand) {
+        if (d_ptr->m_strand->isCurrent()) {
+            task();
+            return;
+        }
+        QSemaphore done;
+        d_ptr->m_strand->post([&task, &done]() {
+            task();
+            done.release();
+        });
+        done.acquire();
+        return;
+    }
+    if (QThread::currentThread() == thread()) {
+        task();
+        return;
+    }
+    QMetaObject::invokeMethod(this, std::move(task), Qt::BlockingQueuedConnection);
 }
 
 void MpvController::eventHandler()
@@ -215,6 +461,10 @@ void MpvController::eventHandler()
         if (event->event_id == MPV_EVENT_NONE) {
             break;
         }
+        if (d_ptr->dispatchToSubscribers(event)) {
+            // property observed for a C++ subscriber only
+            continue;
+        }
         switch (event->event_id) {
         case MPV_EVENT_START_FILE: {
             Q_EMIT fileStarted();
@@ -222,6 +472,8 @@ void MpvController::eventHandler()
         }
 
         case MPV_EVENT_FILE_LOADED: {
+            // demuxer and decoder threads are started for each file
+            d_ptr->trackThreads();
             Q_EMIT fileLoaded();
             break;
         }
@@ -239,6 +491,7 @@ void MpvController::eventHandler()
         }
 
         case MPV_EVENT_VIDEO_RECONFIG: {
+            d_ptr->trackThreads();
             Q_EMIT videoReconfig();
             break;
         }
@@ -314,25 +567,78 @@ mpv_handle *MpvController::mpv() const
     return d_ptr->m_mpv;
 }
 
+bool MpvController::isInitialized() const
+{
+    return d_ptr->m_isInitialized;
+}
+
+uint64_t MpvController::subscribeProperty(const QString &property, mpv_format format, MpvSubscriber callback)
+{
+    QMutexLocker locker(&d_ptr->m_subscriptionsMutex);
+    const uint64_t id = d_ptr->m_nextSubscriptionId++;
+    MpvControllerPrivate::Subscription subscription;
+    subscription.property = property.toUtf8();
+    subscription.format = format;
+    subscription.callback = std::make_shared<MpvSubscriber>(std::move(callback));
+    d_ptr->m_subscriptions.insert(id, subscription);
+    if (d_ptr->m_subscriptionsObserved) {
+        mpv_observe_property(d_ptr->m_mpv, id, subscription.property.constData(), format);
+    }
+    return id;
+}
+
+uint64_t MpvController::subscribeEvents(MpvSubscriber callback)
+{
+    QMutexLocker locker(&d_ptr->m_subscriptionsMutex);
+    const uint64_t id = d_ptr->m_nextSubscriptionId++;
+    MpvControllerPrivate::Subscription subscription;
+    subscription.callback = std::make_shared<MpvSubscriber>(std::move(callback));
+    d_ptr->m_subscriptions.insert(id, subscription);
+    return id;
+}
+
+void MpvController::unsubscribe(uint64_t subscription)
+{
+    QMutexLocker locker(&d_ptr->m_subscriptionsMutex);
+    auto it = d_ptr->m_subscriptions.find(subscription);
+    if (it == d_ptr->m_subscriptions.end()) {
+        return;
+    }
+    if (!it->property.isEmpty() && d_ptr->m_subscriptionsObserved) {
+        mpv_unobserve_property(d_ptr->m_mpv, subscription);
+    }
+    d_ptr->m_subscriptions.erase(it);
+}
+
 void MpvController::observeProperty(const QString &property, mpv_format format, uint64_t id)
 {
+    d_ptr->m_observedIds.insert(id);
     mpv_observe_property(mpv(), id, property.toUtf8().data(), format);
 }
 
 int MpvController::unobserveProperty(uint64_t id)
 {
+    d_ptr->m_observedIds.remove(id);
     return mpv_unobserve_property(mpv(), id);
 }
 
 int MpvController::setProperty(const QString &property, const QVariant &value)
 {
+    d_ptr->rememberOriginalValue(property);
     mpv_node node;
     d_ptr->setNode(&node, value);
-    return mpv_set_property(d_ptr->m_mpv, property.toUtf8().constData(), MPV_FORMAT_NODE, &node);
+    int err = 0;
+    // waits for the core, which may be busy opening a file
+    MpvWorkerPool::blockingCall([this, &property, &node, &err]() {
+        err = mpv_set_property(d_ptr->m_mpv, property.toUtf8().constData(), MPV_FORMAT_NODE, &node);
+    });
+    d_ptr->freeNode(&node);
+    return err;
 }
 
 int MpvController::setPropertyAsync(const QString &property, const QVariant &value, int id)
 {
+    d_ptr->rememberOriginalValue(property);
     mpv_node node;
     d_ptr->setNode(&node, value);
     int err = mpv_set_property_async(d_ptr->m_mpv, id, property.toUtf8().constData(), MPV_FORMAT_NODE, &node);
@@ -342,7 +648,10 @@ int MpvController::setPropertyAsync(const QString &property, const QVariant &val
 QVariant MpvController::getProperty(const QString &property)
 {
     mpv_node node;
-    int err = mpv_get_property(d_ptr->m_mpv, property.toUtf8().constData(), MPV_FORMAT_NODE, &node);
+    int err = 0;
+    MpvWorkerPool::blockingCall([this, &property, &node, &err]() {
+        err = mpv_get_property(d_ptr->m_mpv, property.toUtf8().constData(), MPV_FORMAT_NODE, &node);
+    });
     if (err < 0) {
         return QVariant::fromValue(ErrorReturn(err));
     }
@@ -361,7 +670,11 @@ QVariant MpvController::command(const QStringList &params)
     mpv_node node;
     d_ptr->setNode(&node, params);
     mpv_node result;
-    int err = mpv_command_node(d_ptr->m_mpv, &node, &result);
+    int err = 0;
+    MpvWorkerPool::blockingCall([this, &node, &result, &err]() {
+        err = mpv_command_node(d_ptr->m_mpv, &node, &result);
+    });
+    d_ptr->freeNode(&node);
     if (err < 0) {
         qCDebug(MpvQt_MpvController) << getError(err) << params;
         return QVariant::fromValue(ErrorReturn(err));
@@ -377,6 +690,44 @@ int MpvController::commandAsync(const QVariant &params, int id)
     return mpv_command_node_async(d_ptr->m_mpv, id, &node);
 }
 
+void MpvController::reset()
+{
+    command(QStringList() << QStringLiteral("stop"));
+    command(QStringList() << QStringLiteral("playlist-clear"));
+
+    for (uint64_t id : std::as_const(d_ptr->m_observedIds)) {
+        mpv_unobserve_property(d_ptr->m_mpv, id);
+    }
+    d_ptr->m_observedIds.clear();
+
+    {
+        QMutexLocker locker(&d_ptr->m_subscriptionsMutex);
+        for (auto it = d_ptr->m_subscriptions.constBegin(); it != d_ptr->m_subscriptions.constEnd(); ++it) {
+            if (!it->property.isEmpty()) {
+                mpv_unobserve_property(d_ptr->m_mpv, it.key());
+            }
+        }
+        d_ptr->m_subscriptions.clear();
+    }
+
+    d_ptr->m_rateLimiter->setRate(0);
+
+    const auto originalValues = std::exchange(d_ptr->m_originalValues, {});
+    for (auto it = originalValues.constBegin(); it != originalValues.constEnd(); ++it) {
+        mpv_node node;
+        d_ptr->setNode(&node, it.value());
+        MpvWorkerPool::blockingCall([this, &it, &node]() {
+            mpv_set_property(d_ptr->m_mpv, it.key().toUtf8().constData(), MPV_FORMAT_NODE, &node);
+        });
+        d_ptr->freeNode(&node);
+    }
+}
+
+std::shared_ptr<MpvRateLimiter> MpvController::rateLimiter() const
+{
+    return d_ptr->m_rateLimiter;
+}
+
 std::shared_ptr<MpvHandleManager> MpvController::mpvHandleManager() const
 {
     return d_ptr->m_mpvHandleManager;
@@ -15,23 +15,32 @@
 #include <mpv/client.h>
 #include <mpv/render_gl.h>
 
+#include "mpvreaper.h"
+
+#include <functional>
 #include <memory>
+#include <variant>
 
 struct MpvHandleManager {
     mpv_handle *mpvHandle{nullptr};
-    explicit MpvHandleManager(mpv_handle *h)
+    // the stream protocols installed on the handle, see MpvStreamProtocol::install()
+    std::shared_ptr<void> protocols;
+    explicit MpvHandleManager(mpv_handle *h, std::shared_ptr<void> installedProtocols = {})
         : mpvHandle(h)
+        , protocols(std::move(installedProtocols))
     {
     }
     ~MpvHandleManager()
     {
-        if (mpvHandle) {
-            mpv_terminate_destroy(mpvHandle);
-        }
+        // mpv_terminate_destroy waits for mpv's threads, don't block whoever dropped the last reference
+        MpvReaper::instance()->reap(mpvHandle, std::move(protocols));
     }
 };
 
 class MpvControllerPrivate;
+class MpvRateLimiter;
+class MpvStrand;
+struct MpvSchedulingParameters;
 
 /**
  * RAII wrapper that calls mpv_free_node_contents() on the pointer.
@@ -72,6 +81,34 @@ struct ErrorReturn {
 };
 Q_DECLARE_METATYPE(ErrorReturn)
 
+/**
+ * Typed value delivered to C++ subscribers.
+ *
+ * Holds bool for MPV_FORMAT_FLAG, qint64 for MPV_FORMAT_INT64, double for
+ * MPV_FORMAT_DOUBLE and the UTF-8 bytes for MPV_FORMAT_STRING. Only array and
+ * map nodes are converted to QVariant. std::monostate means there is no value
+ * (MPV_FORMAT_NONE or the property is unavailable).
+ */
+using MpvValue = std::variant<std::monostate, bool, qint64, double, QByteArray, QVariant>;
+
+/**
+ * A property change or player event delivered to a C++ subscriber.
+ */
+struct MpvNotification {
+    // MPV_EVENT_PROPERTY_CHANGE for property subscriptions, the event id otherwise
+    mpv_event_id event{MPV_EVENT_NONE};
+    // id returned by subscribeProperty() or subscribeEvents()
+    uint64_t subscription{0};
+    // property name, empty for events
+    QByteArray name;
+    // property value; for MPV_EVENT_END_FILE the mpv_end_file_reason as qint64
+    MpvValue value;
+    // mpv error code carried by the event, if any
+    int error{0};
+};
+
+using MpvSubscriber = std::function<void(const MpvNotification &)>;
+
 class MpvController : public QObject
 {
     Q_OBJECT
@@ -90,8 +127,86 @@ public:
     void eventHandler();
     mpv_handle *mpv() const;
 
+    /**
+     * Whether init() finished. Thread-safe.
+     */
+    bool isInitialized() const;
+
+    /**
+     * Run the controller on a strand of the shared MpvWorkerPool instead of
+     * the event loop of the thread it lives on. Must be called before init().
+     */
+    void setStrand(std::shared_ptr<MpvStrand> strand);
+
+    /**
+     * Queue @p task to run where the controller does its work: its strand if it
+     * has one, otherwise its thread. Tasks run in the order they were posted.
+     * Thread-safe.
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * Like post(), but waits for @p task to finish. Runs it directly when
+     * called from the controller's own thread or strand.
+     */
+    void postBlocking(std::function<void()> task);
+
+    /**
+     * Schedule the threads doing this player's work: the worker thread (unless
+     * the controller runs on the shared MpvWorkerPool) and, on Linux, the threads
+     * mpv starts for it, including those started later, see MpvThreadTracker.
+     * The decoder thread count is an mpv option and is set by the caller.
+     * Must be called on the controller's worker.
+     */
+    void setScheduling(const MpvSchedulingParameters &parameters);
+
+    /**
+     * Subscribe a C++ callback to changes of the given property.
+     *
+     * Unlike observeProperty() and the propertyChanged signal, the callback is
+     * invoked directly on the controller's worker thread, with a typed value
+     * and without going through the GUI thread's event loop. The callback must
+     * not block; use MpvNotificationQueue::subscriber() to hand the values to
+     * another thread instead.
+     *
+     * Thread-safe, can be called before init(), in which case the property is
+     * observed once the mpv core has been initialized.
+     *
+     * @param property the property name
+     * @param format the format the value is delivered in, see MpvValue
+     * @param callback invoked for every change
+     * @return the subscription id, to be passed to unsubscribe()
+     */
+    uint64_t subscribeProperty(const QString &property, mpv_format format, MpvSubscriber callback);
+
+    /**
+     * Subscribe a C++ callback to player events (file started, loaded and
+     * ended, video and audio reconfiguration, seek, playback restart and shutdown).
+     * The callback is invoked on the controller's worker thread, see subscribeProperty().
+     *
+     * @return the subscription id, to be passed to unsubscribe()
+     */
+    uint64_t subscribeEvents(MpvSubscriber callback);
+
+    /**
+     * Remove a subscription created with subscribeProperty() or subscribeEvents().
+     * Thread-safe. When called from another thread, a notification that is
+     * being dispatched on the worker thread at the same time may still reach
+     * the callback once after this returns.
+     */
+    void unsubscribe(uint64_t subscription);
+
 public Q_SLOTS:
-    void init();
+    /**
+     * Create and initialize the mpv core. Runs on the worker thread,
+     * initialized() is emitted once the core can be used.
+     *
+     * @param options options applied with mpv_set_option() between mpv_create()
+     *                and mpv_initialize(), so init-only options work and nothing
+     *                has to be reconfigured once the core is running.
+     *                A "profile" entry selects a profile from the config file.
+     */
+    void init(const QVariantMap &options = QVariantMap());
 
     /**
      * Get a notification whenever the given property changes. You will receive
@@ -175,7 +290,24 @@ public Q_SLOTS:
      */
     int commandAsync(const QVariant &params, int id = 0);
 
+    /**
+     * Bring the player back to the state it had after init(), so it can be
+     * handed to another item: stops playback, clears the playlist, removes
+     * all property observers and subscriptions, and restores every property
+     * changed through setProperty() or setPropertyAsync() to the value it had
+     * before the first change.
+     */
+    void reset();
+
+    /**
+     * Throttles what the stream protocols this player opens fetch from the
+     * network, see MpvBandwidthArbiter. Unlimited by default and after
+     * reset(). Thread-safe.
+     */
+    std::shared_ptr<MpvRateLimiter> rateLimiter() const;
+
 Q_SIGNALS:
+    void initialized();
     void propertyChanged(const QString &property, const QVariant &value);
     void asyncReply(const QVariant &data, mpv_event event);
     void fileStarted();
@@ -184,6 +316,8 @@ Q_SIGNALS:
     void videoReconfig();
 
 private:
+    friend class MpvControllerPool;
+    friend class MpvAbstractItemPrivate;
     std::shared_ptr<MpvHandleManager> mpvHandleManager() const;
     std::unique_ptr<MpvControllerPrivate> d_ptr;
 };
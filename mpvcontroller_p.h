@@ -8,6 +8,14 @@
 #define MPVCONTROLLER_P_H_INCLUDED
 
 #include "mpvcontroller.h"
+#include "mpvratelimiter.h"
+#include "mpvthreadtracker.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+
+#include <atomic>
 
 class MpvControllerPrivate
 {
@@ -19,10 +27,47 @@ public:
     bool testType(const QVariant &v, QMetaType::Type t);
     void freeNode(mpv_node *dst);
     QVariant nodeToVariant(const mpv_node *node);
+    int setOption(const QString &name, const QVariant &value);
+    void rememberOriginalValue(const QString &property);
+    MpvValue propertyToValue(const mpv_event_property *prop);
+    void observeSubscriptions();
+    bool dispatchToSubscribers(const mpv_event *event);
+    // attributes the threads mpv started since the last look and schedules them
+    void trackThreads();
+
+    struct Subscription {
+        // empty for event subscriptions
+        QByteArray property;
+        mpv_format format{MPV_FORMAT_NONE};
+        std::shared_ptr<MpvSubscriber> callback;
+    };
+
+    // reply_userdata values used for subscriptions, kept out of the range
+    // applications are likely to pass to observeProperty()
+    static constexpr uint64_t SubscriptionIdBase = uint64_t(1) << 48;
 
     MpvController *q_ptr;
     mpv_handle *m_mpv{nullptr};
     std::shared_ptr<MpvHandleManager> m_mpvHandleManager;
+    std::atomic<bool> m_isInitialized{false};
+    // set when the controller runs on the shared worker pool
+    std::shared_ptr<MpvStrand> m_strand;
+
+    // state needed by MpvController::reset()
+    QSet<uint64_t> m_observedIds;
+    QHash<QString, QVariant> m_originalValues;
+
+    QMutex m_subscriptionsMutex;
+    QHash<uint64_t, Subscription> m_subscriptions;
+    uint64_t m_nextSubscriptionId{SubscriptionIdBase};
+    // set once the mpv core is initialized and property subscriptions are observed
+    bool m_subscriptionsObserved{false};
+
+    std::shared_ptr<MpvRateLimiter> m_rateLimiter{std::make_shared<MpvRateLimiter>()};
+
+    // see MpvController::setScheduling()
+    MpvSchedulingParameters m_scheduling;
+    bool m_hasScheduling{false};
 };
 
 #endif // MPVCONTROLLER_P_H_INCLUDED
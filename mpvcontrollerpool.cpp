@@ -0,0 +1,221 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvcontrollerpool.h"
+
+#include <QCoreApplication>
+#include <QLoggingCategory>
+#include <QPointer>
+#include <QThread>
+
+#include "mpvcontroller.h"
+#include "mpvworkerpool.h"
+
+Q_LOGGING_CATEGORY(MpvQt_MpvControllerPool, "MpvQt.MpvControllerPool")
+
+MpvControllerPool *MpvControllerPool::instance()
+{
+    static QPointer<MpvControllerPool> pool;
+    if (!pool) {
+        pool = new MpvControllerPool(QCoreApplication::instance());
+    }
+    return pool;
+}
+
+MpvControllerPool::MpvControllerPool(QObject *parent)
+    : QObject(parent)
+{
+    m_trimTimer.setInterval(m_idleTimeout);
+    connect(&m_trimTimer, &QTimer::timeout, this, &MpvControllerPool::trim);
+}
+
+MpvControllerPool::~MpvControllerPool()
+{
+    // the application is shutting down, let the idle players finish cleanly
+    for (const auto &idle : std::as_const(m_idlePlayers)) {
+        QThread *thread = idle.player.thread;
+        destroyPlayer(idle.player);
+        if (thread) {
+            thread->wait();
+        }
+    }
+}
+
+int MpvControllerPool::maximumIdle() const
+{
+    return m_maximumIdle;
+}
+
+void MpvControllerPool::setMaximumIdle(int count)
+{
+    m_maximumIdle = qMax(0, count);
+    trim();
+}
+
+int MpvControllerPool::idleTimeout() const
+{
+    return m_idleTimeout;
+}
+
+void MpvControllerPool::setIdleTimeout(int msecs)
+{
+    m_idleTimeout = qMax(0, msecs);
+    if (m_idleTimeout > 0) {
+        m_trimTimer.setInterval(m_idleTimeout);
+        if (!m_idlePlayers.isEmpty()) {
+            m_trimTimer.start();
+        }
+    } else {
+        m_trimTimer.stop();
+    }
+    trim();
+}
+
+QVariantMap MpvControllerPool::options() const
+{
+    return m_options;
+}
+
+void MpvControllerPool::setOptions(const QVariantMap &options)
+{
+    if (m_options == options) {
+        return;
+    }
+    m_options = options;
+    // players initialized with the old options would not match anymore
+    const auto idlePlayers = std::exchange(m_idlePlayers, {});
+    for (const auto &idle : idlePlayers) {
+        destroyPlayer(idle.player);
+    }
+    m_trimTimer.stop();
+}
+
+int MpvControllerPool::idleCount() const
+{
+    return m_idlePlayers.size();
+}
+
+void MpvControllerPool::prewarm(int count)
+{
+    count = qMin(count, m_maximumIdle);
+    while (m_idlePlayers.size() < count) {
+        addIdle(createPlayer(m_options));
+    }
+}
+
+MpvPooledPlayer MpvControllerPool::checkout()
+{
+    // prefer the most recently returned player that finished initializing
+    for (qsizetype i = m_idlePlayers.size() - 1; i >= 0; --i) {
+        if (m_idlePlayers.at(i).player.controller->isInitialized()) {
+            return m_idlePlayers.takeAt(i).player;
+        }
+    }
+    if (!m_idlePlayers.isEmpty()) {
+        return m_idlePlayers.takeLast().player;
+    }
+    qCDebug(MpvQt_MpvControllerPool) << "pool empty, creating a new player";
+    return createPlayer(m_options);
+}
+
+void MpvControllerPool::checkin(MpvPooledPlayer player)
+{
+    if (!player.isValid()) {
+        return;
+    }
+    // queued to the pool's thread even when called from it, callers might be
+    // in the middle of tearing down an item
+    QMetaObject::invokeMethod(
+        this,
+        [this, player]() {
+            auto controller = player.controller;
+            controller->post([controller]() {
+                controller->reset();
+            });
+            addIdle(player);
+            trim();
+        },
+        Qt::QueuedConnection);
+}
+
+void MpvControllerPool::addIdle(MpvPooledPlayer player)
+{
+    IdlePlayer idle;
+    idle.player = player;
+    idle.idleTimer.start();
+    m_idlePlayers.append(idle);
+    if (m_idleTimeout > 0 && !m_trimTimer.isActive()) {
+        m_trimTimer.start();
+    }
+}
+
+void MpvControllerPool::trim()
+{
+    while (m_idlePlayers.size() > m_maximumIdle) {
+        destroyPlayer(m_idlePlayers.takeFirst().player);
+    }
+    if (m_idleTimeout > 0) {
+        for (qsizetype i = m_idlePlayers.size() - 1; i >= 0; --i) {
+            if (m_idlePlayers.at(i).idleTimer.hasExpired(m_idleTimeout)) {
+                destroyPlayer(m_idlePlayers.takeAt(i).player);
+            }
+        }
+    }
+    if (m_idlePlayers.isEmpty()) {
+        m_trimTimer.stop();
+    }
+}
+
+MpvPooledPlayer MpvControllerPool::createPlayer(const QVariantMap &options)
+{
+    MpvPooledPlayer player;
+    player.controller = new MpvController;
+
+    if (MpvWorkerPool::instance()->isEnabled()) {
+        // the controller stays on the creating thread, its work runs on the strand
+        player.controller->setStrand(MpvWorkerPool::instance()->createStrand());
+    } else {
+        player.thread = new QThread;
+        QObject::connect(player.thread, &QThread::finished, player.controller, &MpvController::deleteLater);
+        player.controller->moveToThread(player.thread);
+        player.thread->start();
+    }
+
+    // mpv_create, mpv_initialize and the config parsing run on the worker
+    auto controller = player.controller;
+    controller->post([controller, options]() {
+        controller->init(options);
+    });
+    return player;
+}
+
+void MpvControllerPool::destroyPlayer(MpvPooledPlayer player)
+{
+    if (!player.isValid()) {
+        return;
+    }
+    if (!player.thread) {
+        auto controller = player.controller;
+        controller->post([controller]() {
+            // no wakeup can be in flight once this returns,
+            // so the task posted below is the last one for this controller
+            if (controller->mpv()) {
+                mpv_set_wakeup_callback(controller->mpv(), nullptr, nullptr);
+            }
+            controller->post([controller]() {
+                controller->deleteLater();
+            });
+        });
+        return;
+    }
+    // don't wait for the worker: it may be in the middle of a slow call. The controller is
+    // deleted when the thread finishes and the mpv handle goes to the MpvReaper once the
+    // renderer freed its render context, so nothing here blocks the calling thread.
+    QObject::connect(player.thread, &QThread::finished, player.thread, &QThread::deleteLater);
+    player.thread->quit();
+}
+
+#include "moc_mpvcontrollerpool.cpp"
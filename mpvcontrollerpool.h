@@ -0,0 +1,121 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVCONTROLLERPOOL_H
+#define MPVCONTROLLERPOOL_H
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include <QVariantMap>
+
+class MpvController;
+class QThread;
+
+/**
+ * An mpv core: the MpvController owning the mpv_handle (through its
+ * MpvHandleManager) and the worker thread the controller lives on.
+ */
+struct MpvPooledPlayer {
+    // null when the controller runs on the shared MpvWorkerPool
+    QThread *thread{nullptr};
+    MpvController *controller{nullptr};
+
+    bool isValid() const
+    {
+        return controller != nullptr;
+    }
+};
+
+/**
+ * Process-wide pool of initialized mpv cores.
+ *
+ * Creating a player means starting a thread, running mpv_create and
+ * mpv_initialize and parsing the config file. Items with the pooled property
+ * set check a player out in componentComplete and return it, stopped and
+ * reset, when they are destroyed or when releasePlayer() is called (e.g. from
+ * ListView.onPooled), so scrolling through delegates doesn't pay that cost again.
+ *
+ * Lives on the GUI thread. checkin() is thread-safe.
+ */
+class MpvControllerPool : public QObject
+{
+    Q_OBJECT
+public:
+    static MpvControllerPool *instance();
+    ~MpvControllerPool();
+
+    /**
+     * Maximum number of idle players kept in the pool, players returned
+     * beyond that are destroyed. Defaults to 4.
+     */
+    int maximumIdle() const;
+    void setMaximumIdle(int count);
+
+    /**
+     * Idle players unused for longer than this many milliseconds are destroyed,
+     * 0 keeps them forever. Defaults to 60 seconds.
+     */
+    int idleTimeout() const;
+    void setIdleTimeout(int msecs);
+
+    /**
+     * Options the pooled players are initialized with, see MpvController::init().
+     * Options of the items using them are applied as properties after checkout,
+     * so init-only options have to be set here.
+     */
+    QVariantMap options() const;
+    void setOptions(const QVariantMap &options);
+
+    int idleCount() const;
+
+    /**
+     * Start creating players until @p count are idle in the pool.
+     */
+    void prewarm(int count);
+
+    /**
+     * Take an idle player out of the pool, or create a new one if there is none.
+     * The player may still be initializing, see MpvController::isInitialized().
+     */
+    MpvPooledPlayer checkout();
+
+    /**
+     * Return a player to the pool. It is reset on its worker thread and kept
+     * idle, or destroyed if the pool is full. Can be called from any thread,
+     * but the player's mpv_handle must not have a render context anymore.
+     */
+    void checkin(MpvPooledPlayer player);
+
+    /**
+     * Create a player outside of the pool, its initialization is started right away.
+     * The player gets its own thread, or a strand of the shared MpvWorkerPool if enabled.
+     */
+    static MpvPooledPlayer createPlayer(const QVariantMap &options);
+
+    /**
+     * Stop the player's worker and delete its controller without blocking the calling
+     * thread. The mpv handle itself is destroyed by MpvReaper once nothing uses it.
+     */
+    static void destroyPlayer(MpvPooledPlayer player);
+
+private:
+    explicit MpvControllerPool(QObject *parent = nullptr);
+    void addIdle(MpvPooledPlayer player);
+    void trim();
+
+    struct IdlePlayer {
+        MpvPooledPlayer player;
+        QElapsedTimer idleTimer;
+    };
+    QList<IdlePlayer> m_idlePlayers;
+    QTimer m_trimTimer;
+    int m_maximumIdle{4};
+    int m_idleTimeout{60000};
+    QVariantMap m_options;
+};
+
+#endif // MPVCONTROLLERPOOL_H
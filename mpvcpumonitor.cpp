@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvcpumonitor.h"
+
+#include <QCoreApplication>
+#include <QPointer>
+
+MpvCpuMonitor *MpvCpuMonitor::instance()
+{
+    static QPointer<MpvCpuMonitor> monitor;
+    if (!monitor) {
+        monitor = new MpvCpuMonitor(QCoreApplication::instance());
+    }
+    return monitor;
+}
+
+MpvCpuMonitor::MpvCpuMonitor(QObject *parent)
+    : QObject(parent)
+{
+    m_timer.setInterval(1000);
+    connect(&m_timer, &QTimer::timeout, this, &MpvCpuMonitor::sample);
+}
+
+bool MpvCpuMonitor::isEnabled() const
+{
+    return m_timer.isActive();
+}
+
+void MpvCpuMonitor::setEnabled(bool enabled)
+{
+    if (enabled == m_timer.isActive()) {
+        return;
+    }
+    if (enabled) {
+        // the first sample only sets the baseline
+        sample();
+        m_timer.start();
+    } else {
+        m_timer.stop();
+        m_elapsed.invalidate();
+        m_cpuTimes.clear();
+        m_usage.clear();
+        Q_EMIT sampled();
+    }
+}
+
+int MpvCpuMonitor::interval() const
+{
+    return m_timer.interval();
+}
+
+void MpvCpuMonitor::setInterval(int msecs)
+{
+    m_timer.setInterval(qMax(100, msecs));
+}
+
+qreal MpvCpuMonitor::usage(MpvThreadTracker::Owner owner) const
+{
+    qreal total = 0;
+    const auto roles = m_usage.value(owner);
+    for (qreal usage : roles) {
+        total += usage;
+    }
+    return total;
+}
+
+QVariantMap MpvCpuMonitor::usageByRole(MpvThreadTracker::Owner owner) const
+{
+    QVariantMap usage;
+    const auto roles = m_usage.value(owner);
+    for (auto it = roles.constBegin(); it != roles.constEnd(); ++it) {
+        usage.insert(QString::fromUtf8(it.key()), it.value());
+    }
+    return usage;
+}
+
+void MpvCpuMonitor::sample()
+{
+    const auto threads = MpvThreadTracker::instance()->sampleCpuTime();
+    qint64 elapsed = 0;
+    if (m_elapsed.isValid()) {
+        elapsed = m_elapsed.restart();
+    } else {
+        m_elapsed.start();
+    }
+
+    // deltas per thread, so threads exiting between samples don't skew the totals
+    QHash<qint64, qint64> cpuTimes;
+    m_usage.clear();
+    for (const auto &thread : threads) {
+        cpuTimes.insert(thread.tid, thread.cpuTime);
+        auto previous = m_cpuTimes.constFind(thread.tid);
+        if (previous == m_cpuTimes.constEnd() || elapsed <= 0) {
+            continue;
+        }
+        const qreal usage = qreal(thread.cpuTime - previous.value()) * 1000 / elapsed;
+        m_usage[thread.owner][thread.role] += qMax<qreal>(usage, 0);
+    }
+    m_cpuTimes = cpuTimes;
+    Q_EMIT sampled();
+}
+
+#include "moc_mpvcpumonitor.cpp"
@@ -0,0 +1,68 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVCPUMONITOR_H
+#define MPVCPUMONITOR_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+#include <QVariantMap>
+
+#include "mpvthreadtracker.h"
+
+/**
+ * Samples the CPU time of every player's threads (Linux only).
+ *
+ * The threads are attributed to their player by MpvThreadTracker; every
+ * interval their user and system time is read from /proc/self/task/<tid>/stat
+ * and turned into milliseconds of CPU time per second, per player and per
+ * thread role. 1000 means one core fully busy.
+ *
+ * Disabled by default. Lives on the GUI thread.
+ */
+class MpvCpuMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    static MpvCpuMonitor *instance();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Milliseconds between samples. Defaults to 1 second.
+     */
+    int interval() const;
+    void setInterval(int msecs);
+
+    /**
+     * CPU milliseconds per second used by the threads of @p owner
+     * (an MpvController) during the last interval.
+     */
+    qreal usage(MpvThreadTracker::Owner owner) const;
+
+    /**
+     * usage() broken down by thread role, see MpvThreadTracker::ThreadUsage.
+     */
+    QVariantMap usageByRole(MpvThreadTracker::Owner owner) const;
+
+Q_SIGNALS:
+    void sampled();
+
+private:
+    explicit MpvCpuMonitor(QObject *parent = nullptr);
+    void sample();
+
+    QTimer m_timer;
+    QElapsedTimer m_elapsed;
+    // CPU time of each thread at the previous sample
+    QHash<qint64, qint64> m_cpuTimes;
+    QHash<MpvThreadTracker::Owner, QHash<QByteArray, qreal>> m_usage;
+};
+
+#endif // MPVCPUMONITOR_H
@@ -0,0 +1,570 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvfragmentindex.h"
+
+#include <QByteArrayView>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QPointer>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QtEndian>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvFragmentIndex, "MpvQt.MpvFragmentIndex")
+
+namespace
+{
+// a moof describes a few seconds of samples, anything this large isn't one
+constexpr qint64 MaximumMoofSize = 16 * 1024 * 1024;
+constexpr quint32 FileMagic = 0x4d514649; // "MQFI"
+constexpr quint32 FileVersion = 1;
+// indexes kept in memory, the others are read from disk again when needed
+constexpr int MaximumLoadedIndexes = 32;
+
+struct LoadedIndexes {
+    QMutex mutex;
+    // by local file name
+    QHash<QString, MpvFragmentIndex> indexes;
+};
+
+LoadedIndexes &loadedIndexes()
+{
+    static LoadedIndexes loaded;
+    return loaded;
+}
+
+void keepLoaded(const QString &localFile, const MpvFragmentIndex &index)
+{
+    QMutexLocker locker(&loadedIndexes().mutex);
+    auto &indexes = loadedIndexes().indexes;
+    if (indexes.size() >= MaximumLoadedIndexes && !indexes.contains(localFile)) {
+        indexes.clear();
+    }
+    indexes.insert(localFile, index);
+}
+
+bool isCurrent(const MpvFragmentIndex &index, const QString &localFile)
+{
+    const QFileInfo info(localFile);
+    return index.isValid() && info.exists() && info.size() == index.fileSize && info.lastModified() == index.modified;
+}
+
+// Calls function(type, payload) for each box in data; false if the boxes don't
+// add up or the function returns false.
+template<typename Function>
+bool forEachBox(QByteArrayView data, Function function)
+{
+    while (!data.isEmpty()) {
+        if (data.size() < 8) {
+            return false;
+        }
+        quint64 size = qFromBigEndian<quint32>(data.data());
+        qsizetype headerSize = 8;
+        if (size == 1) {
+            if (data.size() < 16) {
+                return false;
+            }
+            size = qFromBigEndian<quint64>(data.data() + 8);
+            headerSize = 16;
+        } else if (size == 0) {
+            size = data.size();
+        }
+        if (size < quint64(headerSize) || size > quint64(data.size())) {
+            return false;
+        }
+        if (!function(data.sliced(4, 4), data.sliced(headerSize, size - headerSize))) {
+            return false;
+        }
+        data = data.sliced(size);
+    }
+    return true;
+}
+
+// one fragment per traf of the moof at offset
+bool parseMoof(QByteArrayView moof, qint64 offset, QList<MpvFragmentIndex::Fragment> *fragments)
+{
+    quint32 trafNumber = 0;
+    return forEachBox(moof, [&](QByteArrayView type, QByteArrayView traf) {
+        if (type != "traf") {
+            return true;
+        }
+        MpvFragmentIndex::Fragment fragment;
+        fragment.offset = offset;
+        fragment.trafNumber = ++trafNumber;
+        bool hasTrackId = false;
+        bool hasTime = false;
+        // tfhd and tfdt are full boxes, the version and flags come first
+        const bool isValid = forEachBox(traf, [&](QByteArrayView childType, QByteArrayView payload) {
+            if (childType == "tfhd" && payload.size() >= 8) {
+                fragment.trackId = qFromBigEndian<quint32>(payload.data() + 4);
+                hasTrackId = true;
+            } else if (childType == "tfdt" && payload.size() >= 8) {
+                if (payload.at(0) == 1) {
+                    if (payload.size() < 12) {
+                        return false;
+                    }
+                    fragment.time = qFromBigEndian<quint64>(payload.data() + 4);
+                } else {
+                    fragment.time = qFromBigEndian<quint32>(payload.data() + 4);
+                }
+                hasTime = true;
+            }
+            return true;
+        });
+        // without tfdt the time of a fragment is only known by adding up the
+        // sample durations of all the fragments before it
+        if (!isValid || !hasTrackId || !hasTime) {
+            return false;
+        }
+        fragments->append(fragment);
+        return true;
+    });
+}
+
+void appendBigEndian32(QByteArray &data, quint32 value)
+{
+    char bytes[4];
+    qToBigEndian(value, bytes);
+    data.append(bytes, sizeof(bytes));
+}
+
+void appendBigEndian64(QByteArray &data, quint64 value)
+{
+    char bytes[8];
+    qToBigEndian(value, bytes);
+    data.append(bytes, sizeof(bytes));
+}
+
+class FragmentIndexStream : public MpvStream
+{
+public:
+    bool open(const QString &fileName, const MpvFragmentIndex &index)
+    {
+        m_file.setFileName(fileName);
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        m_fileSize = m_file.size();
+        // a file that changed since it was indexed is served as it is
+        if (index.isUseful() && index.fileSize == m_fileSize) {
+            m_mfra = index.mfra();
+        }
+        return true;
+    }
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        if (m_position < m_fileSize) {
+            const qint64 read = m_file.read(data, qMin(maxSize, m_fileSize - m_position));
+            if (read > 0) {
+                m_position += read;
+            }
+            return read;
+        }
+        const qint64 offset = m_position - m_fileSize;
+        const qint64 read = qMin(maxSize, m_mfra.size() - offset);
+        if (read <= 0) {
+            return 0;
+        }
+        std::memcpy(data, m_mfra.constData() + offset, read);
+        m_position += read;
+        return read;
+    }
+
+    bool seek(qint64 offset) override
+    {
+        if (offset < 0 || offset > size()) {
+            return false;
+        }
+        if (offset < m_fileSize && !m_file.seek(offset)) {
+            return false;
+        }
+        m_position = offset;
+        return true;
+    }
+
+    qint64 size() override
+    {
+        return m_fileSize + m_mfra.size();
+    }
+
+private:
+    QFile m_file;
+    qint64 m_fileSize{0};
+    QByteArray m_mfra;
+    qint64 m_position{0};
+};
+}
+
+MpvFragmentIndex MpvFragmentIndex::scan(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    MpvFragmentIndexBuilder builder(file.size());
+    builder.advance(&file, file.size(), [](qint64, qint64) {
+        return true;
+    });
+    MpvFragmentIndex index = builder.index();
+    index.modified = QFileInfo(file).lastModified();
+    return index;
+}
+
+QByteArray MpvFragmentIndex::mfra() const
+{
+    // tracks in the order of their first fragment
+    QList<quint32> tracks;
+    for (const auto &fragment : fragments) {
+        if (!tracks.contains(fragment.trackId)) {
+            tracks.append(fragment.trackId);
+        }
+    }
+
+    QByteArray mfra;
+    appendBigEndian32(mfra, 0);
+    mfra.append("mfra");
+    for (const quint32 track : std::as_const(tracks)) {
+        const qsizetype start = mfra.size();
+        appendBigEndian32(mfra, 0);
+        mfra.append("tfra");
+        // version 1: 64-bit times and offsets
+        appendBigEndian32(mfra, 0x01000000);
+        appendBigEndian32(mfra, track);
+        // traf, trun and sample numbers stored on 4 bytes each
+        appendBigEndian32(mfra, 0x3f);
+        const qsizetype countOffset = mfra.size();
+        appendBigEndian32(mfra, 0);
+        quint32 count = 0;
+        for (const auto &fragment : fragments) {
+            if (fragment.trackId != track) {
+                continue;
+            }
+            appendBigEndian64(mfra, fragment.time);
+            appendBigEndian64(mfra, fragment.offset);
+            appendBigEndian32(mfra, fragment.trafNumber);
+            // the fragment starts with the first sample of its first trun
+            appendBigEndian32(mfra, 1);
+            appendBigEndian32(mfra, 1);
+            ++count;
+        }
+        qToBigEndian(count, mfra.data() + countOffset);
+        qToBigEndian(quint32(mfra.size() - start), mfra.data() + start);
+    }
+    // mfro, found by lavf at the end of the file, points back to the start of the mfra
+    appendBigEndian32(mfra, 16);
+    mfra.append("mfro");
+    appendBigEndian32(mfra, 0);
+    appendBigEndian32(mfra, mfra.size() + 4);
+    qToBigEndian(quint32(mfra.size()), mfra.data());
+    return mfra;
+}
+
+MpvFragmentIndexBuilder::MpvFragmentIndexBuilder(qint64 fileSize)
+{
+    m_index.fileSize = fileSize;
+}
+
+bool MpvFragmentIndexBuilder::advance(QIODevice *file, qint64 end, const std::function<bool(qint64 offset, qint64 length)> &isAvailable)
+{
+    const qint64 size = m_index.fileSize;
+    while (!m_isFinished && m_position < end) {
+        if (m_position + 8 > size) {
+            m_isFinished = true;
+            break;
+        }
+        const qint64 headerLength = qMin<qint64>(16, size - m_position);
+        if (!isAvailable(m_position, headerLength)) {
+            break;
+        }
+        if (!file->seek(m_position)) {
+            m_isFinished = true;
+            break;
+        }
+        const QByteArray header = file->read(headerLength);
+        if (header.size() < 8) {
+            m_isFinished = true;
+            break;
+        }
+        quint64 boxSize = qFromBigEndian<quint32>(header.constData());
+        const QByteArray type = header.mid(4, 4);
+        qint64 headerSize = 8;
+        if (boxSize == 1) {
+            if (header.size() < 16) {
+                m_isFinished = true;
+                break;
+            }
+            boxSize = qFromBigEndian<quint64>(header.constData() + 8);
+            headerSize = 16;
+        } else if (boxSize == 0) {
+            boxSize = size - m_position;
+        }
+        // not MP4, or the rest of the file isn't there yet
+        if (boxSize < quint64(headerSize) || boxSize > quint64(size - m_position)) {
+            m_isFinished = true;
+            break;
+        }
+
+        if (type == "sidx" || type == "mfra") {
+            m_index.hasNativeIndex = true;
+            m_isFinished = true;
+            break;
+        }
+        if (type == "moof") {
+            if (boxSize > quint64(MaximumMoofSize)) {
+                m_isFinished = true;
+                break;
+            }
+            if (!isAvailable(m_position + headerSize, boxSize - headerSize)) {
+                break;
+            }
+            const QByteArray moof = file->seek(m_position + headerSize) ? file->read(boxSize - headerSize) : QByteArray();
+            if (moof.size() != qsizetype(boxSize - headerSize) || !parseMoof(moof, m_position, &m_index.fragments)) {
+                // an index with holes would send seeks to the wrong fragments
+                m_index.fragments.clear();
+                m_isFinished = true;
+                break;
+            }
+        }
+        m_position += boxSize;
+    }
+    return !m_isFinished;
+}
+
+qint64 MpvFragmentIndexBuilder::position() const
+{
+    return m_position;
+}
+
+bool MpvFragmentIndexBuilder::isFinished() const
+{
+    return m_isFinished;
+}
+
+const MpvFragmentIndex &MpvFragmentIndexBuilder::index() const
+{
+    return m_index;
+}
+
+MpvFragmentIndexCache *MpvFragmentIndexCache::instance()
+{
+    static QPointer<MpvFragmentIndexCache> cache;
+    if (!cache) {
+        cache = new MpvFragmentIndexCache(QCoreApplication::instance());
+    }
+    return cache;
+}
+
+MpvFragmentIndexCache::MpvFragmentIndexCache(QObject *parent)
+    : QObject(parent)
+{
+    // one scan at a time, behind playback and away from the application's global pool
+    m_scanPool.setMaxThreadCount(1);
+    m_scanPool.setThreadPriority(QThread::LowPriority);
+}
+
+bool MpvFragmentIndexCache::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void MpvFragmentIndexCache::setEnabled(bool enabled)
+{
+    m_isEnabled = enabled;
+}
+
+QString MpvFragmentIndexCache::fileName(const QUrl &source)
+{
+    const QByteArray hash = QCryptographicHash::hash(source.toString(QUrl::FullyEncoded).toUtf8(), QCryptographicHash::Sha1);
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/mpvqt/fragments/")
+        + QString::fromLatin1(hash.toHex()) + QStringLiteral(".idx");
+}
+
+MpvFragmentIndex MpvFragmentIndexCache::lookup(const QUrl &source)
+{
+    if (!m_isEnabled || !source.isLocalFile()) {
+        return {};
+    }
+    const MpvFragmentIndex index = MpvFragmentIndexCache::index(source);
+    if (!index.isValid() && QFile::exists(fileName(source))) {
+        qCDebug(MpvQt_MpvFragmentIndex) << "dropping outdated index of" << source;
+        remove(source);
+    }
+    return index;
+}
+
+MpvFragmentIndex MpvFragmentIndexCache::index(const QUrl &source)
+{
+    const QString localFile = source.toLocalFile();
+    MpvFragmentIndex index;
+    {
+        QMutexLocker locker(&loadedIndexes().mutex);
+        index = loadedIndexes().indexes.value(localFile);
+    }
+    if (!index.isValid()) {
+        index = load(fileName(source));
+    }
+    if (!isCurrent(index, localFile)) {
+        return {};
+    }
+    keepLoaded(localFile, index);
+    return index;
+}
+
+void MpvFragmentIndexCache::build(const QUrl &source)
+{
+    if (!m_isEnabled || !source.isLocalFile() || m_building.contains(source)) {
+        return;
+    }
+    m_building.insert(source);
+
+    QPointer<MpvFragmentIndexCache> cache = this;
+    m_scanPool.start([cache, source]() {
+        QElapsedTimer timer;
+        timer.start();
+        const MpvFragmentIndex index = MpvFragmentIndex::scan(source.toLocalFile());
+        if (index.isValid()) {
+            keepLoaded(source.toLocalFile(), index);
+            save(fileName(source), index);
+            qCDebug(MpvQt_MpvFragmentIndex) << "indexed" << index.fragments.size() << "fragments of" << source << "in" << timer.elapsed() << "ms"
+                                            << (index.hasNativeIndex ? "(has its own index)" : "");
+        }
+
+        // back on the GUI thread, where the cache lives
+        QMetaObject::invokeMethod(
+            QCoreApplication::instance(),
+            [cache, source, index]() {
+                if (!cache) {
+                    return;
+                }
+                cache->m_building.remove(source);
+                if (index.isValid()) {
+                    Q_EMIT cache->indexBuilt(source, index.isUseful() ? index.fragments.size() : 0);
+                }
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void MpvFragmentIndexCache::remove(const QUrl &source)
+{
+    {
+        QMutexLocker locker(&loadedIndexes().mutex);
+        loadedIndexes().indexes.remove(source.toLocalFile());
+    }
+    QFile::remove(fileName(source));
+}
+
+MpvFragmentIndex MpvFragmentIndexCache::load(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+    QDataStream stream(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (magic != FileMagic || version != FileVersion) {
+        return {};
+    }
+
+    MpvFragmentIndex index;
+    quint32 count = 0;
+    stream >> index.fileSize >> index.modified >> index.hasNativeIndex >> count;
+    index.fragments.reserve(qMin<quint32>(count, file.size() / 24));
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        MpvFragmentIndex::Fragment fragment;
+        stream >> fragment.trackId >> fragment.time >> fragment.offset >> fragment.trafNumber;
+        index.fragments.append(fragment);
+    }
+    if (stream.status() != QDataStream::Ok) {
+        qCWarning(MpvQt_MpvFragmentIndex) << "could not read" << fileName;
+        return {};
+    }
+    return index;
+}
+
+void MpvFragmentIndexCache::save(const QString &fileName, const MpvFragmentIndex &index)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(MpvQt_MpvFragmentIndex) << "could not write" << file.fileName() << file.errorString();
+        return;
+    }
+    QDataStream stream(&file);
+    stream << FileMagic << FileVersion;
+    stream << index.fileSize << index.modified << index.hasNativeIndex << quint32(index.fragments.size());
+    for (const auto &fragment : index.fragments) {
+        stream << fragment.trackId << fragment.time << fragment.offset << fragment.trafNumber;
+    }
+    file.commit();
+}
+
+void MpvFragmentIndexCache::recordSeek(qint64 latency, bool isIndexed)
+{
+    if (isIndexed) {
+        ++m_indexedSeekCount;
+        m_indexedSeekTime += latency;
+    } else {
+        ++m_unindexedSeekCount;
+        m_unindexedSeekTime += latency;
+    }
+    Q_EMIT statisticsChanged();
+}
+
+int MpvFragmentIndexCache::indexedSeekCount() const
+{
+    return m_indexedSeekCount;
+}
+
+qreal MpvFragmentIndexCache::indexedSeekLatency() const
+{
+    return m_indexedSeekCount > 0 ? qreal(m_indexedSeekTime) / m_indexedSeekCount : 0;
+}
+
+int MpvFragmentIndexCache::unindexedSeekCount() const
+{
+    return m_unindexedSeekCount;
+}
+
+qreal MpvFragmentIndexCache::unindexedSeekLatency() const
+{
+    return m_unindexedSeekCount > 0 ? qreal(m_unindexedSeekTime) / m_unindexedSeekCount : 0;
+}
+
+QString MpvFragmentIndexProtocol::scheme() const
+{
+    return Scheme;
+}
+
+std::unique_ptr<MpvStream> MpvFragmentIndexProtocol::open(const QUrl &source)
+{
+    if (!source.isLocalFile()) {
+        return nullptr;
+    }
+    auto stream = std::make_unique<FragmentIndexStream>();
+    if (!stream->open(source.toLocalFile(), MpvFragmentIndexCache::index(source))) {
+        return nullptr;
+    }
+    return stream;
+}
+
+#include "moc_mpvfragmentindex.cpp"
@@ -0,0 +1,200 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVFRAGMENTINDEX_H
+#define MPVFRAGMENTINDEX_H
+
+#include <QByteArray>
+#include <QDateTime>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+#include <QUrl>
+
+#include <functional>
+
+#include "mpvstreamprotocol.h"
+
+class QIODevice;
+
+/**
+ * Where the fragments of a fragmented MP4 file start, see MpvFragmentIndexCache.
+ */
+struct MpvFragmentIndex {
+    struct Fragment {
+        quint32 trackId{0};
+        // decode time of the fragment's first sample (tfdt), in the track's timescale
+        quint64 time{0};
+        // file offset of the moof box
+        qint64 offset{0};
+        // 1-based position of the track's traf in the moof
+        quint32 trafNumber{1};
+    };
+    QList<Fragment> fragments;
+    // the file has a sidx or mfra box, lavf seeks without help
+    bool hasNativeIndex{false};
+
+    // validators, modified only for local files
+    qint64 fileSize{-1};
+    QDateTime modified;
+
+    /**
+     * Whether the file was scanned, even if it turned out not to be fragmented.
+     */
+    bool isValid() const
+    {
+        return fileSize >= 0;
+    }
+
+    /**
+     * Whether seeking gains from serving the index to lavf.
+     */
+    bool isUseful() const
+    {
+        return !hasNativeIndex && !fragments.isEmpty();
+    }
+
+    /**
+     * Walk the top-level boxes of @p fileName and record the moof boxes.
+     * Reads the box headers and the moof boxes only. Blocking.
+     */
+    static MpvFragmentIndex scan(const QString &fileName);
+
+    /**
+     * The index as an mfra box with one tfra per track, ending with its mfro.
+     */
+    QByteArray mfra() const;
+};
+
+/**
+ * Walks the top-level boxes of a file from its start and records the moof
+ * boxes, as far as the file can be read: all of a local file for
+ * MpvFragmentIndex::scan(), what players read of a remote one for MpvHttpCache.
+ */
+class MpvFragmentIndexBuilder
+{
+public:
+    explicit MpvFragmentIndexBuilder(qint64 fileSize);
+
+    /**
+     * Record the boxes of @p file starting before @p end, from where the last
+     * call stopped, while @p isAvailable says their headers and the moof boxes
+     * can be read.
+     * @return false once the boxes ended or didn't add up, the index is final then
+     */
+    bool advance(QIODevice *file, qint64 end, const std::function<bool(qint64 offset, qint64 length)> &isAvailable);
+
+    /**
+     * Offset of the next box to record.
+     */
+    qint64 position() const;
+    bool isFinished() const;
+    const MpvFragmentIndex &index() const;
+
+private:
+    MpvFragmentIndex m_index;
+    qint64 m_position{0};
+    bool m_isFinished{false};
+};
+
+/**
+ * Fragment indexes of local fragmented MP4 files, built in the background and
+ * persisted per source in the application's cache location.
+ *
+ * Fragmented MP4 files without a sidx or mfra box, like most fragmented CENC
+ * streams, are slow to seek in: lavf knows where a fragment is only once it
+ * read the fragments before it. With an index, QMpv opens the file through
+ * MpvFragmentIndexProtocol, which appends the index to the file as an mfra box,
+ * and has lavf use it (use_mfra_for), so a seek reads the right moof directly.
+ *
+ * The first time such a file is played it is opened as usual while it is
+ * scanned, one file at a time on a low priority thread; the index applies from
+ * the next time it is opened. Indexes are validated by size and modification
+ * time. Remote sources are indexed by MpvHttpCache instead, from the moof boxes
+ * players read through it, and aren't handled here.
+ *
+ * Also collects the seek latencies QMpv measures on fragmented MP4 files, with
+ * and without the index.
+ *
+ * Lives on the GUI thread, except for the static index().
+ */
+class MpvFragmentIndexCache : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int indexedSeekCount READ indexedSeekCount NOTIFY statisticsChanged)
+    // average milliseconds from the seek to playback restarting
+    Q_PROPERTY(qreal indexedSeekLatency READ indexedSeekLatency NOTIFY statisticsChanged)
+    Q_PROPERTY(int unindexedSeekCount READ unindexedSeekCount NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal unindexedSeekLatency READ unindexedSeekLatency NOTIFY statisticsChanged)
+
+public:
+    static MpvFragmentIndexCache *instance();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * The index of the local file @p source, loaded from disk if needed;
+     * invalid if there is none or the file changed.
+     */
+    MpvFragmentIndex lookup(const QUrl &source);
+
+    /**
+     * Scan @p source in the background, indexBuilt() is emitted when done.
+     */
+    void build(const QUrl &source);
+
+    /**
+     * The index of the local file @p source, from memory or disk, invalid if
+     * there is none or the file changed. Thread-safe, for MpvFragmentIndexProtocol.
+     */
+    static MpvFragmentIndex index(const QUrl &source);
+
+    void remove(const QUrl &source);
+
+    void recordSeek(qint64 latency, bool isIndexed);
+
+    int indexedSeekCount() const;
+    qreal indexedSeekLatency() const;
+    int unindexedSeekCount() const;
+    qreal unindexedSeekLatency() const;
+
+Q_SIGNALS:
+    void indexBuilt(const QUrl &source, int fragmentCount);
+    void statisticsChanged();
+
+private:
+    explicit MpvFragmentIndexCache(QObject *parent = nullptr);
+    static QString fileName(const QUrl &source);
+    static MpvFragmentIndex load(const QString &fileName);
+    static void save(const QString &fileName, const MpvFragmentIndex &index);
+
+    QSet<QUrl> m_building;
+    QThreadPool m_scanPool;
+    bool m_isEnabled{true};
+
+    int m_indexedSeekCount{0};
+    qint64 m_indexedSeekTime{0};
+    int m_unindexedSeekCount{0};
+    qint64 m_unindexedSeekTime{0};
+};
+
+/**
+ * Serves a local fragmented MP4 file with its fragment index appended as an
+ * mfra box, see MpvFragmentIndexCache. lavf must be told to read it, with the
+ * demuxer-lavf-o option use_mfra_for=dts.
+ */
+class MpvFragmentIndexProtocol : public MpvStreamProtocol
+{
+public:
+    static inline const QString Scheme = QStringLiteral("mpvqt-fragidx");
+
+    QString scheme() const override;
+    std::unique_ptr<MpvStream> open(const QUrl &source) override;
+};
+
+#endif // MPVFRAGMENTINDEX_H
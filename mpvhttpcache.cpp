@@ -0,0 +1,848 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvhttpcache.h"
+#include "mpvfragmentindex.h"
+
+#include <QBitArray>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLoggingCategory>
+#include <QMutexLocker>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QStringList>
+
+#include <cstring>
+#include <mutex>
+#include <optional>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvHttpCache, "MpvQt.MpvHttpCache")
+
+namespace
+{
+constexpr quint32 MapMagic = 0x4d514843; // "MQHC"
+// version 1 lacks the fragment index
+constexpr quint32 MapVersion = 2;
+// blocks fetched ahead of the reading position
+constexpr qint64 ReadaheadBlocks = 16 * 1024 * 1024 / MpvHttpCache::BlockSize;
+// a fetch this close to a wanted block gets there sooner than a new request
+constexpr qint64 CatchUpBlocks = 1024 * 1024 / MpvHttpCache::BlockSize;
+// milliseconds the first read of an uncached source waits for the first response
+constexpr int OpenTimeout = 30000;
+// failed fetches retried before a read fails
+constexpr int MaximumRetries = 3;
+// outside the instance, which QMpv asks whether to use for every source
+std::atomic<bool> isCacheEnabled{false};
+}
+
+struct MpvHttpCache::Entry {
+    QString key;
+    QUrl url;
+    // -1 until the first response tells it
+    qint64 size{-1};
+    QByteArray etag;
+    QByteArray lastModified;
+    QBitArray blocks;
+    qint64 cachedBlocks{0};
+    // fragment index built from what players read, see MpvFragmentIndexBuilder
+    QByteArray mfra;
+    QDateTime lastUsed;
+    int openCount{0};
+    // the source changed on the server, the entry was dropped
+    bool isStale{false};
+
+    qint64 blockCount() const
+    {
+        return size < 0 ? 0 : (size + BlockSize - 1) / BlockSize;
+    }
+
+    qint64 blockEnd(qint64 block) const
+    {
+        return qMin(size, (block + 1) * BlockSize);
+    }
+
+    qint64 cachedBytes() const
+    {
+        qint64 bytes = cachedBlocks * BlockSize;
+        // the last block is a short one
+        if (blockCount() > 0 && blocks.testBit(blockCount() - 1)) {
+            bytes -= blockCount() * BlockSize - size;
+        }
+        return bytes;
+    }
+};
+
+struct MpvHttpCache::StreamState {
+    std::shared_ptr<Entry> entry;
+    // block at the reading position
+    std::atomic<qint64> readBlock{0};
+    // next block the running fetch writes, -1 if none is running
+    std::atomic<qint64> fetchBlock{-1};
+    std::atomic<bool> isCancelled{false};
+    std::atomic<bool> hasFailed{false};
+    // bytes fetched for the stream not yet taken by takeNetworkBytes()
+    std::atomic<qint64> networkBytes{0};
+    // only touched on the network thread
+    QPointer<QObject> fetch;
+};
+
+/**
+ * A range request writing blocks into the cache, from a block up to the end
+ * of the source, an already cached block or the end of the readahead.
+ * Lives on the network thread.
+ */
+class MpvHttpCache::Fetch : public QObject
+{
+public:
+    Fetch(MpvHttpCache *cache, std::shared_ptr<StreamState> state, qint64 block)
+        : QObject(cache->m_context)
+        , m_cache(cache)
+        , m_state(std::move(state))
+        , m_block(block)
+        , m_publishedBlock(block)
+    {
+        const auto &entry = m_state->entry;
+        QNetworkRequest request(entry->url);
+        request.setRawHeader("Range", "bytes=" + QByteArray::number(block * BlockSize) + '-');
+        {
+            // a source that changed is answered in full instead of the range
+            QMutexLocker locker(&m_cache->m_mutex);
+            const QByteArray validator = entry->etag.isEmpty() ? entry->lastModified : entry->etag;
+            if (!validator.isEmpty()) {
+                request.setRawHeader("If-Range", validator);
+            }
+        }
+        m_reply = m_cache->network()->get(request);
+        connect(m_reply, &QNetworkReply::readyRead, this, &Fetch::onReadyRead);
+        connect(m_reply, &QNetworkReply::finished, this, &Fetch::onFinished);
+    }
+
+    ~Fetch() override
+    {
+        releaseReply();
+    }
+
+private:
+    bool accept()
+    {
+        auto &entry = *m_state->entry;
+        const int status = m_reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        // Content-Range: bytes first-last/total
+        const QByteArray range = m_reply->rawHeader("Content-Range");
+        const qint64 first = range.mid(6, range.indexOf('-') - 6).toLongLong();
+        const qint64 total = range.mid(range.lastIndexOf('/') + 1).toLongLong();
+
+        QMutexLocker locker(&m_cache->m_mutex);
+        // 200 means that the server ignores ranges, or that If-Range found the source changed
+        if (status != 206 || first != m_block * BlockSize || total <= 0 || (entry.size >= 0 && entry.size != total)) {
+            qCDebug(MpvQt_MpvHttpCache) << entry.url << "can't be served from the cache, status" << status << range;
+            if (entry.size >= 0) {
+                m_cache->dropEntry(m_state->entry);
+            }
+            return false;
+        }
+        if (entry.size < 0) {
+            QByteArray etag = m_reply->rawHeader("ETag");
+            // If-Range needs a strong validator
+            if (etag.startsWith("W/")) {
+                etag.clear();
+            }
+            if (!m_cache->initializeEntry(entry, total, etag, m_reply->rawHeader("Last-Modified"))) {
+                return false;
+            }
+        }
+        m_file.setFileName(m_cache->dataFileName(entry.key));
+        if (!m_file.open(QIODevice::ReadWrite | QIODevice::Unbuffered)) {
+            qCWarning(MpvQt_MpvHttpCache) << "could not open" << m_file.fileName() << m_file.errorString();
+            return false;
+        }
+        m_isAccepted = true;
+        return true;
+    }
+
+    void onReadyRead()
+    {
+        if (!m_isAccepted && !accept()) {
+            fail();
+            return;
+        }
+        const QByteArray data = m_reply->readAll();
+        m_cache->m_bytesFetched += data.size();
+        m_state->networkBytes += data.size();
+        m_buffer.append(data);
+        writeBlocks();
+    }
+
+    void writeBlocks()
+    {
+        auto &entry = *m_state->entry;
+        while (true) {
+            const qint64 start = m_block * BlockSize;
+            const qint64 length = entry.blockEnd(m_block) - start;
+            if (m_buffer.size() < length) {
+                return;
+            }
+            if (!m_file.seek(start) || m_file.write(m_buffer.constData(), length) != length) {
+                qCWarning(MpvQt_MpvHttpCache) << "could not write" << m_file.fileName() << m_file.errorString();
+                fail();
+                return;
+            }
+            m_buffer.remove(0, length);
+
+            bool isDone = false;
+            {
+                QMutexLocker locker(&m_cache->m_mutex);
+                m_cache->markBlock(entry, m_block);
+                ++m_block;
+                // stop at the end, at data that is already there, or far enough ahead of the reader
+                isDone = entry.isStale || m_block >= entry.blockCount() || entry.blocks.testBit(m_block)
+                    || m_block > m_state->readBlock + ReadaheadBlocks;
+            }
+            if (isDone) {
+                finish();
+                return;
+            }
+            // unless the stream started another fetch meanwhile
+            qint64 expected = m_publishedBlock;
+            if (m_state->fetchBlock.compare_exchange_strong(expected, m_block)) {
+                m_publishedBlock = m_block;
+            }
+        }
+    }
+
+    void onFinished()
+    {
+        if (m_reply->error() == QNetworkReply::NoError && m_reply->bytesAvailable() > 0) {
+            onReadyRead();
+        }
+        if (!m_reply) {
+            return;
+        }
+        if (m_reply->error() != QNetworkReply::NoError) {
+            qCWarning(MpvQt_MpvHttpCache) << "fetching" << m_state->entry->url << "failed:" << m_reply->errorString();
+            fail();
+            return;
+        }
+        if (!m_isAccepted && !accept()) {
+            fail();
+            return;
+        }
+        finish();
+    }
+
+    void fail()
+    {
+        m_state->hasFailed = true;
+        finish();
+    }
+
+    void finish()
+    {
+        {
+            QMutexLocker locker(&m_cache->m_mutex);
+            qint64 expected = m_publishedBlock;
+            m_state->fetchBlock.compare_exchange_strong(expected, -1);
+            // a reader waiting for a block past where this fetch stopped starts the next one
+            m_cache->m_blocksChanged.wakeAll();
+        }
+        releaseReply();
+        if (m_isAccepted) {
+            m_cache->saveEntry(m_state->entry);
+        }
+        deleteLater();
+    }
+
+    void releaseReply()
+    {
+        if (!m_reply) {
+            return;
+        }
+        disconnect(m_reply, nullptr, this, nullptr);
+        m_reply->abort();
+        m_reply->deleteLater();
+        m_reply = nullptr;
+    }
+
+    MpvHttpCache *m_cache;
+    std::shared_ptr<StreamState> m_state;
+    QNetworkReply *m_reply{nullptr};
+    QFile m_file;
+    QByteArray m_buffer;
+    // next block to write
+    qint64 m_block;
+    // the value this fetch last stored in StreamState::fetchBlock
+    qint64 m_publishedBlock;
+    bool m_isAccepted{false};
+};
+
+/**
+ * Reads of one player, on mpv's thread.
+ */
+class MpvHttpCache::Stream : public MpvStream
+{
+public:
+    Stream(MpvHttpCache *cache, std::shared_ptr<StreamState> state)
+        : m_cache(cache)
+        , m_state(std::move(state))
+    {
+    }
+
+    ~Stream() override
+    {
+        m_state->isCancelled = true;
+        m_cache->stopFetch(m_state);
+        {
+            QMutexLocker locker(&m_cache->m_mutex);
+            const auto &entry = m_state->entry;
+            --entry->openCount;
+            entry->lastUsed = QDateTime::currentDateTimeUtc();
+            // nothing was cached, the source can't be
+            if (entry->size < 0 && entry->openCount == 0 && m_cache->m_entries.value(entry->key) == entry) {
+                m_cache->m_entries.remove(entry->key);
+            }
+            // the entry may have kept the cache over its size
+            m_cache->evict();
+        }
+        m_cache->saveEntry(m_state->entry);
+    }
+
+    bool open()
+    {
+        QMutexLocker locker(&m_cache->m_mutex);
+        auto &entry = *m_state->entry;
+        ++entry.openCount;
+        entry.lastUsed = QDateTime::currentDateTimeUtc();
+        if (entry.isStale) {
+            return false;
+        }
+        if (entry.size < 0) {
+            // the first response tells the size, its data is kept; waiting for
+            // it is up to the first read, where cancel() can interrupt it
+            ensureFetching(0);
+        }
+        return true;
+    }
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        QMutexLocker locker(&m_cache->m_mutex);
+        if (!waitForSize()) {
+            return -1;
+        }
+        const auto &entry = *m_state->entry;
+        if (m_position >= entry.size) {
+            const qint64 read = qMin(maxSize, entry.size + m_mfra.size() - m_position);
+            if (read <= 0) {
+                return 0;
+            }
+            std::memcpy(data, m_mfra.constData() + (m_position - entry.size), read);
+            m_position += read;
+            return read;
+        }
+        const qint64 block = m_position / BlockSize;
+        m_state->readBlock = block;
+        int failures = 0;
+        while (!entry.blocks.testBit(block)) {
+            if (m_state->isCancelled || entry.isStale) {
+                return -1;
+            }
+            if (m_state->hasFailed.exchange(false) && ++failures > MaximumRetries) {
+                return -1;
+            }
+            ensureFetching(block);
+            m_cache->m_blocksChanged.wait(&m_cache->m_mutex);
+        }
+
+        // as much as is cached in a row
+        const qint64 count = entry.blockCount();
+        qint64 next = block + 1;
+        while (next < count && entry.blockEnd(next - 1) - m_position < maxSize && entry.blocks.testBit(next)) {
+            ++next;
+        }
+        const qint64 end = qMin(entry.blockEnd(next - 1), m_position + maxSize);
+        for (qint64 ahead = next; ahead < qMin(count, block + ReadaheadBlocks); ++ahead) {
+            if (!entry.blocks.testBit(ahead)) {
+                ensureFetching(ahead);
+                break;
+            }
+        }
+        locker.unlock();
+
+        if (!m_file.seek(m_position)) {
+            return -1;
+        }
+        const qint64 read = m_file.read(data, end - m_position);
+        if (read > 0) {
+            m_position += read;
+            m_cache->m_bytesRead += read;
+        }
+        if (m_indexer && m_position > m_indexer->position()) {
+            advanceIndex();
+        }
+        return read;
+    }
+
+    bool seek(qint64 offset) override
+    {
+        // the size doesn't change once it is known
+        const qint64 streamSize = size();
+        if (offset < 0 || streamSize < 0 || offset > streamSize) {
+            return false;
+        }
+        m_position = offset;
+        m_state->readBlock = qMin(offset, m_state->entry->size) / BlockSize;
+        return true;
+    }
+
+    qint64 size() override
+    {
+        QMutexLocker locker(&m_cache->m_mutex);
+        if (!waitForSize()) {
+            return -1;
+        }
+        return m_state->entry->size + m_mfra.size();
+    }
+
+    qint64 takeNetworkBytes() override
+    {
+        return m_state->networkBytes.exchange(0);
+    }
+
+    void cancel() override
+    {
+        m_state->isCancelled = true;
+        QMutexLocker locker(&m_cache->m_mutex);
+        m_cache->m_blocksChanged.wakeAll();
+    }
+
+private:
+    // With the mutex held. Waits for the first response of an uncached source,
+    // until OpenTimeout or cancel(); false if the source can't be served.
+    bool waitForSize()
+    {
+        if (m_file.isOpen()) {
+            return true;
+        }
+        auto &entry = *m_state->entry;
+        const QDeadlineTimer deadline(OpenTimeout);
+        while (entry.size < 0 && !m_state->hasFailed && !m_state->isCancelled) {
+            if (!m_cache->m_blocksChanged.wait(&m_cache->m_mutex, deadline)) {
+                break;
+            }
+        }
+        if (entry.size < 0 || entry.isStale || m_state->isCancelled) {
+            return false;
+        }
+        // served as it is now, an index built meanwhile applies to the next stream
+        m_mfra = entry.mfra;
+        if (m_mfra.isEmpty()) {
+            m_indexer.emplace(entry.size);
+        }
+        m_file.setFileName(m_cache->dataFileName(entry.key));
+        return m_file.open(QIODevice::ReadOnly);
+    }
+
+    // records the boxes read so far, from the cached data
+    void advanceIndex()
+    {
+        const auto &entry = *m_state->entry;
+        const bool isBuilding = m_indexer->advance(&m_file, m_position, [this, &entry](qint64 offset, qint64 length) {
+            QMutexLocker locker(&m_cache->m_mutex);
+            const qint64 last = (offset + length - 1) / BlockSize;
+            for (qint64 block = offset / BlockSize; block <= last; ++block) {
+                if (entry.isStale || !entry.blocks.testBit(block)) {
+                    return false;
+                }
+            }
+            return true;
+        });
+        if (isBuilding) {
+            return;
+        }
+        const MpvFragmentIndex index = m_indexer->index();
+        m_indexer.reset();
+        if (index.isUseful()) {
+            qCDebug(MpvQt_MpvHttpCache) << "indexed" << index.fragments.size() << "fragments of" << entry.url;
+            QMutexLocker locker(&m_cache->m_mutex);
+            m_state->entry->mfra = index.mfra();
+        }
+    }
+
+    // with the mutex held
+    void ensureFetching(qint64 block)
+    {
+        const qint64 next = m_state->fetchBlock;
+        if (next >= 0 && next <= block && block - next <= CatchUpBlocks) {
+            // the running fetch gets there unless it stops at a cached block first
+            const auto &blocks = m_state->entry->blocks;
+            bool isReached = true;
+            for (qint64 between = next; between < block && isReached; ++between) {
+                isReached = !blocks.testBit(between);
+            }
+            if (isReached) {
+                return;
+            }
+        }
+        m_state->fetchBlock = block;
+        m_cache->startFetch(m_state, block);
+    }
+
+    MpvHttpCache *m_cache;
+    std::shared_ptr<StreamState> m_state;
+    QFile m_file;
+    qint64 m_position{0};
+    // the entry's fragment index when opened, served after the source
+    QByteArray m_mfra;
+    // until the entry has a fragment index
+    std::optional<MpvFragmentIndexBuilder> m_indexer;
+};
+
+MpvHttpCache *MpvHttpCache::instance()
+{
+    // never destroyed, players may still read while the application quits
+    static MpvHttpCache *cache = new MpvHttpCache();
+    return cache;
+}
+
+MpvHttpCache::MpvHttpCache()
+    : m_directory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/mpvqt/http"))
+{
+}
+
+void MpvHttpCache::initialize()
+{
+    std::call_once(m_initialized, [this]() {
+        {
+            QMutexLocker locker(&m_mutex);
+            load();
+        }
+        m_thread.setObjectName(QStringLiteral("mpvqt/http"));
+        m_context = new QObject();
+        m_context->moveToThread(&m_thread);
+        m_thread.start();
+        if (auto app = QCoreApplication::instance()) {
+            QObject::connect(
+                app,
+                &QCoreApplication::aboutToQuit,
+                &m_thread,
+                [this]() {
+                    m_thread.quit();
+                    m_thread.wait();
+                },
+                Qt::DirectConnection);
+        }
+    });
+}
+
+QNetworkAccessManager *MpvHttpCache::network()
+{
+    if (!m_network) {
+        m_network = new QNetworkAccessManager(m_context);
+    }
+    return m_network;
+}
+
+bool MpvHttpCache::isEnabled()
+{
+    return isCacheEnabled;
+}
+
+void MpvHttpCache::setEnabled(bool enabled)
+{
+    isCacheEnabled = enabled;
+    if (enabled) {
+        instance()->initialize();
+    }
+}
+
+qint64 MpvHttpCache::maximumSize() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_maximumSize;
+}
+
+void MpvHttpCache::setMaximumSize(qint64 bytes)
+{
+    QMutexLocker locker(&m_mutex);
+    m_maximumSize = qMax<qint64>(0, bytes);
+    evict();
+}
+
+qint64 MpvHttpCache::size() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_size;
+}
+
+qint64 MpvHttpCache::bytesRead() const
+{
+    return m_bytesRead;
+}
+
+qint64 MpvHttpCache::bytesFetched() const
+{
+    return m_bytesFetched;
+}
+
+bool MpvHttpCache::isCacheable(const QUrl &source) const
+{
+    if (!isEnabled()) {
+        return false;
+    }
+    const QString scheme = source.scheme();
+    if (scheme != QStringLiteral("http") && scheme != QStringLiteral("https")) {
+        return false;
+    }
+    static const QStringList mediaSuffixes{
+        QStringLiteral("mp4"),
+        QStringLiteral("m4v"),
+        QStringLiteral("m4a"),
+        QStringLiteral("mov"),
+        QStringLiteral("mkv"),
+        QStringLiteral("mka"),
+        QStringLiteral("webm"),
+        QStringLiteral("ts"),
+        QStringLiteral("avi"),
+        QStringLiteral("ogg"),
+        QStringLiteral("ogv"),
+        QStringLiteral("opus"),
+        QStringLiteral("mp3"),
+        QStringLiteral("flac"),
+        QStringLiteral("wav"),
+    };
+    return mediaSuffixes.contains(QFileInfo(source.path()).suffix().toLower());
+}
+
+void MpvHttpCache::remove(const QUrl &source)
+{
+    QMutexLocker locker(&m_mutex);
+    const auto entry = m_entries.value(key(source));
+    if (entry && entry->openCount == 0) {
+        dropEntry(entry);
+    }
+}
+
+bool MpvHttpCache::hasFragmentIndex(const QUrl &source) const
+{
+    QMutexLocker locker(&m_mutex);
+    const auto entry = m_entries.value(key(source));
+    return entry && !entry->mfra.isEmpty();
+}
+
+void MpvHttpCache::clear()
+{
+    QMutexLocker locker(&m_mutex);
+    const auto entries = m_entries.values();
+    for (const auto &entry : entries) {
+        if (entry->openCount == 0) {
+            dropEntry(entry);
+        }
+    }
+}
+
+std::unique_ptr<MpvStream> MpvHttpCache::open(const QUrl &source)
+{
+    initialize();
+    auto state = std::make_shared<StreamState>();
+    {
+        QMutexLocker locker(&m_mutex);
+        state->entry = findEntry(source);
+    }
+    auto stream = std::make_unique<Stream>(this, state);
+    if (!stream->open()) {
+        return nullptr;
+    }
+    return stream;
+}
+
+QString MpvHttpCache::key(const QUrl &source)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(source.toString(QUrl::FullyEncoded).toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+QString MpvHttpCache::dataFileName(const QString &key) const
+{
+    return m_directory + QLatin1Char('/') + key + QStringLiteral(".data");
+}
+
+QString MpvHttpCache::mapFileName(const QString &key) const
+{
+    return m_directory + QLatin1Char('/') + key + QStringLiteral(".map");
+}
+
+void MpvHttpCache::load()
+{
+    const auto maps = QDir(m_directory).entryInfoList({QStringLiteral("*.map")}, QDir::Files);
+    for (const QFileInfo &info : maps) {
+        QFile file(info.filePath());
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        QDataStream stream(&file);
+        quint32 magic = 0;
+        quint32 version = 0;
+        auto entry = std::make_shared<Entry>();
+        entry->key = info.completeBaseName();
+        stream >> magic >> version;
+        stream >> entry->url >> entry->size >> entry->etag >> entry->lastModified >> entry->lastUsed >> entry->blocks;
+        if (version >= 2) {
+            stream >> entry->mfra;
+        }
+        if (magic != MapMagic || version < 1 || version > MapVersion || stream.status() != QDataStream::Ok || entry->size < 0
+            || entry->blocks.size() != entry->blockCount() || !QFile::exists(dataFileName(entry->key))) {
+            qCDebug(MpvQt_MpvHttpCache) << "dropping unusable entry" << info.filePath();
+            QFile::remove(info.filePath());
+            QFile::remove(dataFileName(entry->key));
+            continue;
+        }
+        entry->cachedBlocks = entry->blocks.count(true);
+        m_size += entry->cachedBytes();
+        m_entries.insert(entry->key, entry);
+    }
+    qCDebug(MpvQt_MpvHttpCache) << "loaded" << m_entries.size() << "entries," << m_size << "bytes from" << m_directory;
+}
+
+void MpvHttpCache::saveEntry(const std::shared_ptr<Entry> &entry)
+{
+    Entry snapshot;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (entry->size < 0 || entry->isStale || m_entries.value(entry->key) != entry) {
+            return;
+        }
+        snapshot = *entry;
+    }
+
+    QDir().mkpath(m_directory);
+    QSaveFile file(mapFileName(snapshot.key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(MpvQt_MpvHttpCache) << "could not write" << file.fileName() << file.errorString();
+        return;
+    }
+    QDataStream stream(&file);
+    stream << MapMagic << MapVersion;
+    stream << snapshot.url << snapshot.size << snapshot.etag << snapshot.lastModified << snapshot.lastUsed << snapshot.blocks << snapshot.mfra;
+    file.commit();
+}
+
+std::shared_ptr<MpvHttpCache::Entry> MpvHttpCache::findEntry(const QUrl &source)
+{
+    const QString key = MpvHttpCache::key(source);
+    auto &entry = m_entries[key];
+    if (!entry) {
+        entry = std::make_shared<Entry>();
+        entry->key = key;
+        entry->url = source;
+    }
+    return entry;
+}
+
+bool MpvHttpCache::initializeEntry(Entry &entry, qint64 size, const QByteArray &etag, const QByteArray &lastModified)
+{
+    QDir().mkpath(m_directory);
+    QFile file(dataFileName(entry.key));
+    // sparse where the filesystem supports it, the blocks are written as they arrive
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || !file.resize(size)) {
+        qCWarning(MpvQt_MpvHttpCache) << "could not create" << file.fileName() << file.errorString();
+        return false;
+    }
+    entry.size = size;
+    entry.etag = etag;
+    entry.lastModified = lastModified;
+    entry.blocks = QBitArray(entry.blockCount());
+    entry.cachedBlocks = 0;
+    entry.mfra.clear();
+    m_blocksChanged.wakeAll();
+    return true;
+}
+
+void MpvHttpCache::markBlock(Entry &entry, qint64 block)
+{
+    if (entry.isStale || entry.blocks.testBit(block)) {
+        return;
+    }
+    entry.blocks.setBit(block);
+    ++entry.cachedBlocks;
+    m_size += entry.blockEnd(block) - block * BlockSize;
+    m_blocksChanged.wakeAll();
+    evict();
+}
+
+void MpvHttpCache::dropEntry(const std::shared_ptr<Entry> &entry)
+{
+    if (m_entries.value(entry->key) != entry) {
+        return;
+    }
+    m_size -= entry->cachedBytes();
+    m_entries.remove(entry->key);
+    // streams still reading it fail
+    entry->isStale = true;
+    m_blocksChanged.wakeAll();
+    QFile::remove(dataFileName(entry->key));
+    QFile::remove(mapFileName(entry->key));
+}
+
+void MpvHttpCache::evict()
+{
+    while (m_size > m_maximumSize) {
+        std::shared_ptr<Entry> oldest;
+        for (const auto &entry : std::as_const(m_entries)) {
+            if (entry->openCount == 0 && (!oldest || entry->lastUsed < oldest->lastUsed)) {
+                oldest = entry;
+            }
+        }
+        if (!oldest) {
+            // everything left is being played
+            return;
+        }
+        qCDebug(MpvQt_MpvHttpCache) << "evicting" << oldest->url << oldest->cachedBytes() << "bytes";
+        dropEntry(oldest);
+    }
+}
+
+void MpvHttpCache::startFetch(const std::shared_ptr<StreamState> &state, qint64 block)
+{
+    QMetaObject::invokeMethod(
+        m_context,
+        [this, state, block]() {
+            delete state->fetch.data();
+            if (!state->isCancelled) {
+                state->fetch = new Fetch(this, state, block);
+            }
+        },
+        Qt::QueuedConnection);
+}
+
+void MpvHttpCache::stopFetch(const std::shared_ptr<StreamState> &state)
+{
+    QMetaObject::invokeMethod(
+        m_context,
+        [state]() {
+            delete state->fetch.data();
+        },
+        Qt::QueuedConnection);
+}
+
+QString MpvHttpCacheProtocol::scheme() const
+{
+    return Scheme;
+}
+
+std::unique_ptr<MpvStream> MpvHttpCacheProtocol::open(const QUrl &source)
+{
+    return MpvHttpCache::instance()->open(source);
+}
@@ -0,0 +1,170 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVHTTPCACHE_H
+#define MPVHTTPCACHE_H
+
+#include <QHash>
+#include <QMutex>
+#include <QThread>
+#include <QUrl>
+#include <QWaitCondition>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "mpvstreamprotocol.h"
+
+class QNetworkAccessManager;
+
+/**
+ * Persistent byte-range disk cache of HTTP(S) media, shared by all players
+ * and kept across sessions. Disabled by default.
+ *
+ * QMpv opens cacheable sources through MpvHttpCacheProtocol, which serves
+ * mpv's reads from the cache and fetches the missing blocks with range
+ * requests, ahead of the reading position. Each source is stored as a sparse
+ * file with a map of the blocks it holds, in the application's cache location.
+ * Rewatching, seeking back and scrubbing within fetched ranges are served from
+ * disk without any request.
+ *
+ * Fragmented MP4 sources are indexed from the moof boxes players read through
+ * the cache, see MpvFragmentIndexBuilder. Once the boxes were read up to the
+ * end, the index is kept with the entry and appended to the source as an mfra
+ * box, like MpvFragmentIndexProtocol does for local files.
+ *
+ * Cached sources are revalidated with If-Range whenever missing blocks are
+ * fetched: if the source changed on the server, its entry is dropped and the
+ * stream fails, QMpv then reopens the source without the cache. Sources whose
+ * servers don't support range requests are played without the cache as well.
+ *
+ * The least recently used entries are evicted once the cache exceeds
+ * maximumSize(); entries being played are never evicted.
+ *
+ * The requests are QNetworkAccessManager's, not mpv's: the user-agent,
+ * referrer, http-header-fields, cookies, http-proxy and tls-* options don't
+ * apply to them, nor does the ytdl hook. QMpv doesn't use the cache for
+ * players with any of these options set, see QMpv::isProxiable().
+ *
+ * Opening a source that isn't cached yet doesn't wait for the server; the
+ * first read does, until the first response or until the stream is cancelled.
+ *
+ * Requests run on a dedicated thread. Thread-safe.
+ */
+class MpvHttpCache
+{
+public:
+    static MpvHttpCache *instance();
+
+    /**
+     * Until the cache is first enabled, or a source opened through it, it
+     * neither reads its directory nor starts its thread.
+     */
+    static bool isEnabled();
+    static void setEnabled(bool enabled);
+
+    /**
+     * Bytes kept on disk. Defaults to 2 GiB.
+     */
+    qint64 maximumSize() const;
+    void setMaximumSize(qint64 bytes);
+
+    /**
+     * Bytes currently cached.
+     */
+    qint64 size() const;
+
+    /**
+     * Bytes read by players through the cache, and the part of them fetched from the network.
+     */
+    qint64 bytesRead() const;
+    qint64 bytesFetched() const;
+
+    /**
+     * Whether @p source is opened through the cache: HTTP(S) URLs of media
+     * files, going by their suffix. Not HLS or DASH manifests, whose segments
+     * are resolved relative to them, nor pages for the ytdl hook.
+     */
+    bool isCacheable(const QUrl &source) const;
+
+    /**
+     * Remove the cached data of @p source, or of every source. Sources being
+     * played are kept.
+     */
+    void remove(const QUrl &source);
+    void clear();
+
+    /**
+     * Whether @p source is served with its fragment index appended, lavf must
+     * then be told to read it with the demuxer-lavf-o option use_mfra_for=dts.
+     */
+    bool hasFragmentIndex(const QUrl &source) const;
+
+    // unit of fetching and of the block map
+    static constexpr qint64 BlockSize = 128 * 1024;
+
+private:
+    friend class MpvHttpCacheProtocol;
+    struct Entry;
+    struct StreamState;
+    class Fetch;
+    class Stream;
+
+    MpvHttpCache();
+    // loads the entries and starts the network thread, once
+    void initialize();
+    std::unique_ptr<MpvStream> open(const QUrl &source);
+    // on the network thread
+    QNetworkAccessManager *network();
+
+    static QString key(const QUrl &source);
+    QString dataFileName(const QString &key) const;
+    QString mapFileName(const QString &key) const;
+    void load();
+    void saveEntry(const std::shared_ptr<Entry> &entry);
+
+    // all called with m_mutex held
+    std::shared_ptr<Entry> findEntry(const QUrl &source);
+    bool initializeEntry(Entry &entry, qint64 size, const QByteArray &etag, const QByteArray &lastModified);
+    void markBlock(Entry &entry, qint64 block);
+    void dropEntry(const std::shared_ptr<Entry> &entry);
+    void evict();
+
+    // from any thread, runs on the network thread
+    void startFetch(const std::shared_ptr<StreamState> &state, qint64 block);
+    void stopFetch(const std::shared_ptr<StreamState> &state);
+
+    mutable QMutex m_mutex;
+    // woken whenever a block was written or a fetch failed
+    QWaitCondition m_blocksChanged;
+    QHash<QString, std::shared_ptr<Entry>> m_entries;
+    QString m_directory;
+    qint64 m_size{0};
+    qint64 m_maximumSize{2048LL * 1024 * 1024};
+    std::once_flag m_initialized;
+    std::atomic<qint64> m_bytesRead{0};
+    std::atomic<qint64> m_bytesFetched{0};
+
+    QThread m_thread;
+    // both live on m_thread, the network manager is created with the first fetch
+    QObject *m_context{nullptr};
+    QNetworkAccessManager *m_network{nullptr};
+};
+
+/**
+ * Serves HTTP(S) sources through MpvHttpCache.
+ */
+class MpvHttpCacheProtocol : public MpvStreamProtocol
+{
+public:
+    static inline const QString Scheme = QStringLiteral("mpvqt-http");
+
+    QString scheme() const override;
+    std::unique_ptr<MpvStream> open(const QUrl &source) override;
+};
+
+#endif // MPVHTTPCACHE_H
@@ -0,0 +1,81 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvkeyprovider.h"
+
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvKeyProvider, "MpvQt.MpvKeyProvider")
+
+QHash<QByteArray, QByteArray> &MpvKeyProvider::cache()
+{
+    static QHash<QByteArray, QByteArray> keys;
+    return keys;
+}
+
+MpvDecryptionKey MpvKeyProvider::resolve(const QUrl &source)
+{
+    MpvDecryptionKey decryptionKey;
+    decryptionKey.keyId = keyId(source).toLower();
+    if (decryptionKey.keyId.isEmpty()) {
+        return decryptionKey;
+    }
+
+    auto cached = cache().constFind(decryptionKey.keyId);
+    if (cached != cache().constEnd()) {
+        decryptionKey.key = cached.value();
+        return decryptionKey;
+    }
+
+    decryptionKey.key = key(decryptionKey.keyId).toLower();
+    if (decryptionKey.key.isEmpty()) {
+        qCWarning(MpvQt_MpvKeyProvider) << "no key for key ID" << decryptionKey.keyId << "of" << source;
+        return decryptionKey;
+    }
+    cache().insert(decryptionKey.keyId, decryptionKey.key);
+    return decryptionKey;
+}
+
+void MpvKeyProvider::clearCache()
+{
+    cache().clear();
+}
+
+MpvJSKeyProvider::MpvJSKeyProvider(const QJSValue &handler)
+    : m_handler(handler)
+{
+}
+
+QJSValue MpvJSKeyProvider::handler() const
+{
+    return m_handler;
+}
+
+QByteArray MpvJSKeyProvider::keyId(const QUrl &source)
+{
+    if (!m_handler.isCallable()) {
+        return {};
+    }
+    const QJSValue result = m_handler.call({QJSValue(source.toString())});
+    if (result.isError()) {
+        qCWarning(MpvQt_MpvKeyProvider) << "key provider failed for" << source << ":" << result.toString();
+        return {};
+    }
+    if (!result.isObject()) {
+        return {};
+    }
+    const QByteArray keyId = result.property(QStringLiteral("keyId")).toString().toLatin1().toLower();
+    const QJSValue key = result.property(QStringLiteral("key"));
+    if (!keyId.isEmpty() && key.isString()) {
+        m_keys.insert(keyId, key.toString().toLatin1());
+    }
+    return keyId;
+}
+
+QByteArray MpvJSKeyProvider::key(const QByteArray &keyId)
+{
+    return m_keys.take(keyId);
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVKEYPROVIDER_H
+#define MPVKEYPROVIDER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QJSValue>
+#include <QUrl>
+
+/**
+ * A CENC content key, both parts as hex strings the way ffmpeg's mov demuxer takes them.
+ */
+struct MpvDecryptionKey {
+    QByteArray keyId;
+    QByteArray key;
+
+    bool isValid() const
+    {
+        return !key.isEmpty();
+    }
+};
+
+/**
+ * Resolves the decryption keys of encrypted sources.
+ *
+ * keyId() is asked for every source and is expected to be cheap, e.g. a lookup
+ * in the catalog the URL comes from; sources without a key ID are played as
+ * plain media. key() may be expensive (a license request...), its results are
+ * cached process-wide by key ID, so it is only asked once per key.
+ *
+ * Used on the GUI thread.
+ */
+class MpvKeyProvider
+{
+public:
+    virtual ~MpvKeyProvider() = default;
+
+    /**
+     * @return the hex key ID of @p source, empty if it isn't encrypted
+     */
+    virtual QByteArray keyId(const QUrl &source) = 0;
+
+    /**
+     * @return the hex key for @p keyId, empty if unknown
+     */
+    virtual QByteArray key(const QByteArray &keyId) = 0;
+
+    /**
+     * The key to play @p source with, from the cache if possible.
+     * Invalid for plain sources and unknown keys.
+     */
+    MpvDecryptionKey resolve(const QUrl &source);
+
+    /**
+     * Forget the cached keys, e.g. when the user logs out.
+     */
+    static void clearCache();
+
+private:
+    static QHash<QByteArray, QByteArray> &cache();
+};
+
+/**
+ * Key provider calling a JavaScript function, for QMpv.keyProvider:
+ * @code
+ * keyProvider: function(source) {
+ *     // null or undefined for plain sources
+ *     return { keyId: "e40c0500...", key: "b45b4a1c..." }
+ * }
+ * @endcode
+ * The key can be left out for key IDs that were resolved before.
+ */
+class MpvJSKeyProvider : public MpvKeyProvider
+{
+public:
+    explicit MpvJSKeyProvider(const QJSValue &handler);
+
+    QJSValue handler() const;
+
+    QByteArray keyId(const QUrl &source) override;
+    QByteArray key(const QByteArray &keyId) override;
+
+private:
+    QJSValue m_handler;
+    // keys returned together with their ID by the handler
+    QHash<QByteArray, QByteArray> m_keys;
+};
+
+#endif // MPVKEYPROVIDER_H
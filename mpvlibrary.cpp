@@ -0,0 +1,152 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvlibrary.h"
+
+#ifdef MPVQT_LAZY_LIBMPV
+
+#include <QElapsedTimer>
+#include <QLibrary>
+#include <QLoggingCategory>
+
+#include <atomic>
+#include <mutex>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvLibrary, "MpvQt.MpvLibrary")
+
+namespace
+{
+struct Functions {
+#define MPVQT_DECLARE_FUNCTION(ret, name, params, args) ret(*name) params = nullptr;
+    MPVQT_LIBMPV_FUNCTIONS(MPVQT_DECLARE_FUNCTION)
+#undef MPVQT_DECLARE_FUNCTION
+};
+
+struct State {
+    std::once_flag once;
+    QString fileName;
+    QString errorString;
+    std::atomic<bool> isLoaded{false};
+    Functions functions;
+};
+
+State &state()
+{
+    static State state;
+    return state;
+}
+
+const Functions &functions()
+{
+    if (!MpvLibrary::load()) {
+        qFatal("could not load libmpv: %s", qPrintable(MpvLibrary::errorString()));
+    }
+    return state().functions;
+}
+}
+
+bool MpvLibrary::load()
+{
+    auto &s = state();
+    std::call_once(s.once, [&s]() {
+        QElapsedTimer timer;
+        timer.start();
+
+        QLibrary library;
+        if (!s.fileName.isEmpty()) {
+            library.setFileName(s.fileName);
+        } else {
+#if defined(Q_OS_WIN)
+            library.setFileName(QStringLiteral("libmpv-2"));
+#elif defined(Q_OS_ANDROID)
+            library.setFileName(QStringLiteral("mpv"));
+#else
+            library.setFileNameAndVersion(QStringLiteral("mpv"), 2);
+#endif
+        }
+        // never unloaded, the QLibrary going out of scope keeps it loaded
+        if (!library.load()) {
+            s.errorString = library.errorString();
+            return;
+        }
+
+#define MPVQT_RESOLVE_FUNCTION(ret, name, params, args)                                                                                                        \
+    s.functions.name = reinterpret_cast<ret(*) params>(library.resolve(#name));                                                                                \
+    if (!s.functions.name) {                                                                                                                                   \
+        s.errorString = QStringLiteral("%1 does not export %2").arg(library.fileName(), QLatin1String(#name));                                               \
+        return;                                                                                                                                                \
+    }
+        MPVQT_LIBMPV_FUNCTIONS(MPVQT_RESOLVE_FUNCTION)
+#undef MPVQT_RESOLVE_FUNCTION
+
+        // the major version changes when the ABI does
+        const unsigned long version = s.functions.mpv_client_api_version();
+        if ((version >> 16) != (MPV_CLIENT_API_VERSION >> 16)) {
+            s.errorString = QStringLiteral("%1 has client API %2.%3, expected %4.x")
+                                .arg(library.fileName())
+                                .arg(version >> 16)
+                                .arg(version & 0xffff)
+                                .arg(MPV_CLIENT_API_VERSION >> 16);
+            return;
+        }
+
+        s.isLoaded = true;
+        qCDebug(MpvQt_MpvLibrary) << "loaded" << library.fileName() << "in" << timer.elapsed() << "ms";
+    });
+    return s.isLoaded;
+}
+
+bool MpvLibrary::isLoaded()
+{
+    return state().isLoaded;
+}
+
+QString MpvLibrary::errorString()
+{
+    return state().isLoaded ? QString() : state().errorString;
+}
+
+void MpvLibrary::setFileName(const QString &fileName)
+{
+    if (state().isLoaded) {
+        qCWarning(MpvQt_MpvLibrary) << "libmpv is already loaded, ignoring" << fileName;
+        return;
+    }
+    state().fileName = fileName;
+}
+
+// the libmpv API, forwarded to the loaded library; declared with C linkage by the mpv headers
+#define MPVQT_FORWARD_FUNCTION(ret, name, params, args)                                                                                                        \
+    ret name params                                                                                                                                            \
+    {                                                                                                                                                          \
+        return functions().name args;                                                                                                                          \
+    }
+MPVQT_LIBMPV_FUNCTIONS(MPVQT_FORWARD_FUNCTION)
+#undef MPVQT_FORWARD_FUNCTION
+
+#else // MPVQT_LAZY_LIBMPV
+
+bool MpvLibrary::load()
+{
+    return true;
+}
+
+bool MpvLibrary::isLoaded()
+{
+    return true;
+}
+
+QString MpvLibrary::errorString()
+{
+    return {};
+}
+
+void MpvLibrary::setFileName(const QString &fileName)
+{
+    Q_UNUSED(fileName)
+}
+
+#endif // MPVQT_LAZY_LIBMPV
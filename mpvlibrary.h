@@ -0,0 +1,81 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVLIBRARY_H
+#define MPVLIBRARY_H
+
+#include <QString>
+
+#include <mpv/client.h>
+#include <mpv/render.h>
+#include <mpv/stream_cb.h>
+
+/**
+ * Optional lazy loading of libmpv.
+ *
+ * Linking libmpv pulls ffmpeg, libass, libplacebo... into the application's
+ * startup even if no video is ever played. Built with MPVQT_LAZY_LIBMPV defined
+ * and without linking libmpv, mpvlibrary.cpp provides the mpv_* functions used
+ * by MpvQt itself as forwarders to a function table, filled in by dlopen()ing
+ * libmpv the first time a player is initialized (on its worker thread, see
+ * MpvController::init()). Importing the QML module stays cheap.
+ *
+ * Without MPVQT_LAZY_LIBMPV libmpv is linked as usual and load() does nothing.
+ */
+class MpvLibrary
+{
+public:
+    /**
+     * Load libmpv and resolve the entry points, once. Thread-safe.
+     * @return whether libmpv is usable
+     */
+    static bool load();
+    static bool isLoaded();
+
+    /**
+     * Why load() failed.
+     */
+    static QString errorString();
+
+    /**
+     * File name or path passed to QLibrary, must be set before the first player is created.
+     * Defaults to the platform's libmpv name ("mpv" version 2 on Linux, "libmpv-2" on Windows).
+     */
+    static void setFileName(const QString &fileName);
+};
+
+#ifdef MPVQT_LAZY_LIBMPV
+// X-macro of the libmpv functions used by MpvQt: F(return type, name, parameters, arguments)
+// clang-format off
+#define MPVQT_LIBMPV_FUNCTIONS(F) \
+    F(unsigned long, mpv_client_api_version, (void), ()) \
+    F(const char *, mpv_error_string, (int error), (error)) \
+    F(void, mpv_free, (void *data), (data)) \
+    F(mpv_handle *, mpv_create, (void), ()) \
+    F(int, mpv_initialize, (mpv_handle *ctx), (ctx)) \
+    F(void, mpv_terminate_destroy, (mpv_handle *ctx), (ctx)) \
+    F(void, mpv_free_node_contents, (mpv_node *node), (node)) \
+    F(int, mpv_set_option, (mpv_handle *ctx, const char *name, mpv_format format, void *data), (ctx, name, format, data)) \
+    F(int, mpv_command_node, (mpv_handle *ctx, mpv_node *args, mpv_node *result), (ctx, args, result)) \
+    F(int, mpv_command_node_async, (mpv_handle *ctx, uint64_t reply_userdata, mpv_node *args), (ctx, reply_userdata, args)) \
+    F(int, mpv_set_property, (mpv_handle *ctx, const char *name, mpv_format format, void *data), (ctx, name, format, data)) \
+    F(int, mpv_set_property_async, (mpv_handle *ctx, uint64_t reply_userdata, const char *name, mpv_format format, void *data), (ctx, reply_userdata, name, format, data)) \
+    F(int, mpv_get_property, (mpv_handle *ctx, const char *name, mpv_format format, void *data), (ctx, name, format, data)) \
+    F(int, mpv_get_property_async, (mpv_handle *ctx, uint64_t reply_userdata, const char *name, mpv_format format), (ctx, reply_userdata, name, format)) \
+    F(int, mpv_observe_property, (mpv_handle *mpv, uint64_t reply_userdata, const char *name, mpv_format format), (mpv, reply_userdata, name, format)) \
+    F(int, mpv_unobserve_property, (mpv_handle *mpv, uint64_t registered_reply_userdata), (mpv, registered_reply_userdata)) \
+    F(mpv_event *, mpv_wait_event, (mpv_handle *ctx, double timeout), (ctx, timeout)) \
+    F(void, mpv_set_wakeup_callback, (mpv_handle *ctx, void (*cb)(void *d), void *d), (ctx, cb, d)) \
+    F(int, mpv_render_context_create, (mpv_render_context **res, mpv_handle *mpv, mpv_render_param *params), (res, mpv, params)) \
+    F(void, mpv_render_context_free, (mpv_render_context *ctx), (ctx)) \
+    F(int, mpv_render_context_render, (mpv_render_context *ctx, mpv_render_param *params), (ctx, params)) \
+    F(void, mpv_render_context_set_update_callback, (mpv_render_context *ctx, mpv_render_update_fn callback, void *callback_ctx), (ctx, callback, callback_ctx)) \
+    F(uint64_t, mpv_render_context_update, (mpv_render_context *ctx), (ctx)) \
+    F(int, mpv_stream_cb_add_ro, (mpv_handle *ctx, const char *protocol, void *user_data, mpv_stream_cb_open_ro_fn open_fn), (ctx, protocol, user_data, open_fn))
+// clang-format on
+#endif
+
+#endif // MPVLIBRARY_H
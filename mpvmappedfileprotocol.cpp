@@ -0,0 +1,213 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvmappedfileprotocol.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QLoggingCategory>
+
+#include <atomic>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(MpvQt_MpvMappedFileProtocol, "MpvQt.MpvMappedFileProtocol")
+
+namespace
+{
+std::atomic<qint64> s_readahead{32 * 1024 * 1024};
+
+struct AtomicStatistics {
+    std::atomic<qint64> reads{0};
+    std::atomic<qint64> bytes{0};
+    std::atomic<qint64> readTime{0};
+    std::atomic<qint64> slowReads{0};
+};
+AtomicStatistics s_statistics;
+
+class MappedFileStream : public MpvStream
+{
+public:
+    ~MappedFileStream() override
+    {
+        if (m_data) {
+            m_file.unmap(m_data);
+        }
+    }
+
+    bool open(const QString &fileName)
+    {
+        m_file.setFileName(fileName);
+        if (!m_file.open(QIODevice::ReadOnly)) {
+            return false;
+        }
+        m_size = m_file.size();
+        m_data = m_size > 0 ? m_file.map(0, m_size) : nullptr;
+        if (!m_data) {
+            qCDebug(MpvQt_MpvMappedFileProtocol) << "could not map" << fileName << m_file.errorString() << "reading it instead";
+            return true;
+        }
+#ifdef Q_OS_UNIX
+        // QFile::map() returns the start of the mapping, page aligned
+        madvise(m_data, m_size, MADV_SEQUENTIAL);
+#endif
+        adviseAhead();
+        return true;
+    }
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        QElapsedTimer timer;
+        timer.start();
+        qint64 read = 0;
+        if (m_data) {
+            read = qMax<qint64>(0, qMin(maxSize, m_size - m_position));
+            std::memcpy(data, m_data + m_position, read);
+        } else {
+            read = m_file.read(data, maxSize);
+        }
+        if (read > 0) {
+            m_position += read;
+        }
+        if (m_data && m_position >= m_adviseEnd - s_readahead / 2) {
+            adviseAhead();
+            dropBehind();
+        }
+
+        const qint64 elapsed = timer.nsecsElapsed() / 1000;
+        ++s_statistics.reads;
+        s_statistics.bytes += qMax<qint64>(0, read);
+        s_statistics.readTime += elapsed;
+        if (elapsed > MpvMappedFileProtocol::SlowRead) {
+            ++s_statistics.slowReads;
+        }
+        return read;
+    }
+
+    bool seek(qint64 offset) override
+    {
+        if (offset < 0 || offset > m_size) {
+            return false;
+        }
+        if (!m_data && !m_file.seek(offset)) {
+            return false;
+        }
+        m_position = offset;
+        if (m_data) {
+            // the window starts over at the new position
+            m_adviseEnd = 0;
+            m_dropStart = qMin(m_dropStart, offset / pageSize() * pageSize());
+            adviseAhead();
+        }
+        return true;
+    }
+
+    qint64 size() override
+    {
+        return m_size;
+    }
+
+private:
+    static qint64 pageSize()
+    {
+#ifdef Q_OS_UNIX
+        static const qint64 size = sysconf(_SC_PAGESIZE);
+        return size;
+#else
+        return 4096;
+#endif
+    }
+
+    // have the kernel read the window ahead of the position
+    void adviseAhead()
+    {
+        const qint64 start = qMax(m_adviseEnd, m_position) / pageSize() * pageSize();
+        const qint64 end = qMin(m_size, m_position + s_readahead);
+        if (end <= start) {
+            return;
+        }
+#ifdef Q_OS_UNIX
+        madvise(m_data + start, end - start, MADV_WILLNEED);
+#endif
+        m_adviseEnd = end;
+    }
+
+    // drop what is well behind the position, mpv's demuxer cache holds what it needs to go back
+    void dropBehind()
+    {
+        const qint64 end = (m_position - s_readahead) / pageSize() * pageSize();
+        if (end <= m_dropStart) {
+            return;
+        }
+#ifdef Q_OS_UNIX
+        madvise(m_data + m_dropStart, end - m_dropStart, MADV_DONTNEED);
+#endif
+#ifdef Q_OS_LINUX
+        posix_fadvise(m_file.handle(), m_dropStart, end - m_dropStart, POSIX_FADV_DONTNEED);
+#endif
+        m_dropStart = end;
+    }
+
+    QFile m_file;
+    uchar *m_data{nullptr};
+    qint64 m_size{0};
+    qint64 m_position{0};
+    // end of the window advised to be read ahead
+    qint64 m_adviseEnd{0};
+    // start of the pages not dropped yet
+    qint64 m_dropStart{0};
+};
+}
+
+qint64 MpvMappedFileProtocol::readahead()
+{
+    return s_readahead;
+}
+
+void MpvMappedFileProtocol::setReadahead(qint64 bytes)
+{
+    s_readahead = qMax<qint64>(1024 * 1024, bytes);
+}
+
+MpvMappedFileProtocol::Statistics MpvMappedFileProtocol::statistics()
+{
+    Statistics statistics;
+    statistics.reads = s_statistics.reads;
+    statistics.bytes = s_statistics.bytes;
+    statistics.readTime = s_statistics.readTime;
+    statistics.slowReads = s_statistics.slowReads;
+    return statistics;
+}
+
+void MpvMappedFileProtocol::resetStatistics()
+{
+    s_statistics.reads = 0;
+    s_statistics.bytes = 0;
+    s_statistics.readTime = 0;
+    s_statistics.slowReads = 0;
+}
+
+QString MpvMappedFileProtocol::scheme() const
+{
+    return Scheme;
+}
+
+std::unique_ptr<MpvStream> MpvMappedFileProtocol::open(const QUrl &source)
+{
+    if (!source.isLocalFile()) {
+        return nullptr;
+    }
+    auto stream = std::make_unique<MappedFileStream>();
+    if (!stream->open(source.toLocalFile())) {
+        return nullptr;
+    }
+    return stream;
+}
@@ -0,0 +1,55 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVMAPPEDFILEPROTOCOL_H
+#define MPVMAPPEDFILEPROTOCOL_H
+
+#include "mpvstreamprotocol.h"
+
+/**
+ * Reads local files through a memory mapping instead of mpv's small
+ * synchronous reads, for slow storage such as eMMC and SD cards.
+ *
+ * The kernel is told to read ahead a window in front of the reading position
+ * (MADV_SEQUENTIAL, MADV_WILLNEED), and the pages well behind it are dropped
+ * from the mapping and the page cache (MADV_DONTNEED, POSIX_FADV_DONTNEED);
+ * going back is served from mpv's demuxer cache. Where the file can't be
+ * mapped it is read as usual.
+ *
+ * Optional, see QMpv::memoryMappedFiles: a file truncated while it is mapped
+ * makes the process crash with SIGBUS when the missing part is read.
+ *
+ * statistics() tell how long reads took, to compare with mpv's own file
+ * reading (file://), whose stalls show as buffering.
+ */
+class MpvMappedFileProtocol : public MpvStreamProtocol
+{
+public:
+    static inline const QString Scheme = QStringLiteral("mpvqt-mmap");
+
+    /**
+     * Bytes read ahead of the reading position. Defaults to 32 MiB.
+     */
+    static qint64 readahead();
+    static void setReadahead(qint64 bytes);
+
+    struct Statistics {
+        qint64 reads{0};
+        qint64 bytes{0};
+        // microseconds spent in reads, including the page faults of copying
+        qint64 readTime{0};
+        // reads that took longer than SlowRead
+        qint64 slowReads{0};
+    };
+    static constexpr qint64 SlowRead = 50000;
+    static Statistics statistics();
+    static void resetStatistics();
+
+    QString scheme() const override;
+    std::unique_ptr<MpvStream> open(const QUrl &source) override;
+};
+
+#endif // MPVMAPPEDFILEPROTOCOL_H
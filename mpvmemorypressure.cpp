@@ -0,0 +1,235 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvmemorypressure.h"
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QFileSystemWatcher>
+#include <QLoggingCategory>
+#include <QPointer>
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(MpvQt_MpvMemoryPressure, "MpvQt.MpvMemoryPressure")
+
+MpvMemoryPressure *MpvMemoryPressure::instance()
+{
+    static QPointer<MpvMemoryPressure> monitor;
+    if (!monitor) {
+        monitor = new MpvMemoryPressure(QCoreApplication::instance());
+    }
+    return monitor;
+}
+
+MpvMemoryPressure::MpvMemoryPressure(QObject *parent)
+    : QObject(parent)
+{
+    m_relaxTimer.setSingleShot(true);
+    m_relaxTimer.setInterval(10000);
+    connect(&m_relaxTimer, &QTimer::timeout, this, &MpvMemoryPressure::relax);
+
+    if (startPsiMonitor()) {
+        qCDebug(MpvQt_MpvMemoryPressure) << "watching /proc/pressure/memory";
+    } else if (startCgroupMonitor()) {
+        qCDebug(MpvQt_MpvMemoryPressure) << "PSI unavailable, watching" << m_cgroupEventsPath;
+    } else {
+        qCDebug(MpvQt_MpvMemoryPressure) << "no memory pressure source available";
+    }
+}
+
+MpvMemoryPressure::~MpvMemoryPressure()
+{
+#ifdef Q_OS_LINUX
+    if (m_moderateFd >= 0) {
+        ::close(m_moderateFd);
+    }
+    if (m_criticalFd >= 0) {
+        ::close(m_criticalFd);
+    }
+#endif
+}
+
+MpvMemoryPressure::Level MpvMemoryPressure::level() const
+{
+    return m_level;
+}
+
+bool MpvMemoryPressure::isMonitoring() const
+{
+    return m_moderateFd >= 0 || m_cgroupWatcher;
+}
+
+int MpvMemoryPressure::relaxDelay() const
+{
+    return m_relaxTimer.interval();
+}
+
+void MpvMemoryPressure::setRelaxDelay(int msecs)
+{
+    m_relaxTimer.setInterval(qMax(0, msecs));
+}
+
+void MpvMemoryPressure::reportPressure(Level level)
+{
+    if (level == NoPressure) {
+        return;
+    }
+    m_relaxTimer.start();
+    if (level > m_level) {
+        setLevel(level);
+    }
+}
+
+int MpvMemoryPressure::openPsiTrigger(const QByteArray &trigger)
+{
+#ifdef Q_OS_LINUX
+    int fd = ::open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    // the trigger string includes its terminating null byte
+    if (::write(fd, trigger.constData(), trigger.size() + 1) < 0) {
+        qCDebug(MpvQt_MpvMemoryPressure) << "could not register PSI trigger" << trigger << qt_error_string(errno);
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    Q_UNUSED(trigger)
+    return -1;
+#endif
+}
+
+bool MpvMemoryPressure::startPsiMonitor()
+{
+    m_moderateFd = openPsiTrigger(ModerateTrigger);
+    if (m_moderateFd < 0) {
+        return false;
+    }
+    m_criticalFd = openPsiTrigger(CriticalTrigger);
+
+    // PSI triggers are signaled as POLLPRI, which QSocketNotifier reports as an exception
+    m_moderateNotifier = new QSocketNotifier(m_moderateFd, QSocketNotifier::Exception, this);
+    connect(m_moderateNotifier, &QSocketNotifier::activated, this, [this]() {
+        reportPressure(ModeratePressure);
+    });
+    if (m_criticalFd >= 0) {
+        m_criticalNotifier = new QSocketNotifier(m_criticalFd, QSocketNotifier::Exception, this);
+        connect(m_criticalNotifier, &QSocketNotifier::activated, this, [this]() {
+            reportPressure(CriticalPressure);
+        });
+    }
+    return true;
+}
+
+bool MpvMemoryPressure::startCgroupMonitor()
+{
+#ifdef Q_OS_LINUX
+    // the unified hierarchy entry looks like "0::/user.slice/app.scope"
+    QFile cgroup(QStringLiteral("/proc/self/cgroup"));
+    if (!cgroup.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QString path;
+    const auto lines = cgroup.readAll().split('\n');
+    for (const auto &line : lines) {
+        if (line.startsWith("0::")) {
+            path = QString::fromUtf8(line.mid(3));
+            break;
+        }
+    }
+    if (path.isEmpty()) {
+        return false;
+    }
+    m_cgroupEventsPath = QStringLiteral("/sys/fs/cgroup%1/memory.events").arg(path == QStringLiteral("/") ? QString() : path);
+    if (!QFile::exists(m_cgroupEventsPath)) {
+        return false;
+    }
+
+    // the current counters are the baseline, only new events count
+    readCgroupEvents();
+
+    // the kernel signals a modification whenever the counters change
+    m_cgroupWatcher = new QFileSystemWatcher({m_cgroupEventsPath}, this);
+    connect(m_cgroupWatcher, &QFileSystemWatcher::fileChanged, this, &MpvMemoryPressure::readCgroupEvents);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void MpvMemoryPressure::readCgroupEvents()
+{
+    QFile events(m_cgroupEventsPath);
+    if (!events.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    qint64 high = 0;
+    qint64 max = 0;
+    const auto lines = events.readAll().split('\n');
+    for (const auto &line : lines) {
+        const auto fields = line.split(' ');
+        if (fields.size() != 2) {
+            continue;
+        }
+        if (fields.at(0) == "high") {
+            high = fields.at(1).toLongLong();
+        } else if (fields.at(0) == "max" || fields.at(0) == "oom") {
+            max += fields.at(1).toLongLong();
+        }
+    }
+
+    const bool isBaseline = m_highEvents < 0;
+    const bool highRaised = !isBaseline && high > m_highEvents;
+    const bool maxRaised = !isBaseline && max > m_maxEvents;
+    m_highEvents = high;
+    m_maxEvents = max;
+    if (maxRaised) {
+        reportPressure(CriticalPressure);
+    } else if (highRaised) {
+        reportPressure(ModeratePressure);
+    }
+}
+
+void MpvMemoryPressure::relax()
+{
+    if (m_level == NoPressure) {
+        return;
+    }
+    setLevel(static_cast<Level>(m_level - 1));
+    if (m_level != NoPressure) {
+        m_relaxTimer.start();
+    }
+}
+
+void MpvMemoryPressure::setLevel(Level level)
+{
+    if (m_level == level) {
+        return;
+    }
+    qCDebug(MpvQt_MpvMemoryPressure) << "memory pressure changed from" << m_level << "to" << level;
+    m_level = level;
+    Q_EMIT levelChanged(m_level);
+    switch (m_level) {
+    case ModeratePressure:
+        Q_EMIT moderatePressure();
+        break;
+    case CriticalPressure:
+        Q_EMIT criticalPressure();
+        break;
+    case NoPressure:
+        Q_EMIT pressureRelieved();
+        break;
+    }
+}
+
+#include "moc_mpvmemorypressure.cpp"
@@ -0,0 +1,96 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVMEMORYPRESSURE_H
+#define MPVMEMORYPRESSURE_H
+
+#include <QObject>
+#include <QTimer>
+
+class QFileSystemWatcher;
+class QSocketNotifier;
+
+/**
+ * Watches the system memory pressure on Linux.
+ *
+ * Uses the pressure stall information triggers of /proc/pressure/memory: a
+ * "some" stall above the threshold raises the level to moderate, a "full"
+ * stall to critical. Kernels without PSI, or without permission to register
+ * triggers, fall back to the memory.events file of the process' cgroup v2,
+ * where "high" events mean moderate and "max"/"oom" events critical pressure.
+ *
+ * The level drops one step at a time once no event was seen for relaxDelay().
+ * MpvCacheBudget shrinks the caches in response, applications can connect to
+ * levelChanged() to free their own memory.
+ *
+ * Lives on the GUI thread. On other platforms the level stays NoPressure.
+ */
+class MpvMemoryPressure : public QObject
+{
+    Q_OBJECT
+public:
+    enum Level {
+        NoPressure,
+        ModeratePressure,
+        CriticalPressure,
+    };
+    Q_ENUM(Level)
+
+    static MpvMemoryPressure *instance();
+    ~MpvMemoryPressure();
+
+    Level level() const;
+
+    /**
+     * Whether a PSI trigger or the cgroup memory.events file is being watched.
+     */
+    bool isMonitoring() const;
+
+    /**
+     * Milliseconds without pressure events before the level is lowered. Defaults to 10 seconds.
+     */
+    int relaxDelay() const;
+    void setRelaxDelay(int msecs);
+
+    /**
+     * Report a pressure level from elsewhere, e.g. a platform low-memory notification.
+     * It is lowered again after relaxDelay() like levels raised by the monitor.
+     */
+    void reportPressure(Level level);
+
+Q_SIGNALS:
+    void levelChanged(MpvMemoryPressure::Level level);
+    void moderatePressure();
+    void criticalPressure();
+    void pressureRelieved();
+
+private:
+    explicit MpvMemoryPressure(QObject *parent = nullptr);
+    bool startPsiMonitor();
+    bool startCgroupMonitor();
+    int openPsiTrigger(const QByteArray &trigger);
+    void readCgroupEvents();
+    void relax();
+    void setLevel(Level level);
+
+    // stall of 150ms within a 2s window, the smallest window unprivileged processes may use
+    static constexpr auto ModerateTrigger = "some 150000 2000000";
+    static constexpr auto CriticalTrigger = "full 100000 2000000";
+
+    Level m_level{NoPressure};
+    int m_moderateFd{-1};
+    int m_criticalFd{-1};
+    QSocketNotifier *m_moderateNotifier{nullptr};
+    QSocketNotifier *m_criticalNotifier{nullptr};
+    QFileSystemWatcher *m_cgroupWatcher{nullptr};
+    QString m_cgroupEventsPath;
+    // -1 until memory.events was read once
+    qint64 m_highEvents{-1};
+    qint64 m_maxEvents{-1};
+    QTimer m_relaxTimer;
+};
+
+#endif // MPVMEMORYPRESSURE_H
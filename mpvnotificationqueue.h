@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVNOTIFICATIONQUEUE_H
+#define MPVNOTIFICATIONQUEUE_H
+
+#include "mpvcontroller.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+/**
+ * Bounded single-producer/single-consumer queue used to hand MpvNotification
+ * values from the controller's worker thread to a thread chosen by the consumer,
+ * without going through the Qt event loop.
+ *
+ * The producer is the controller that the queue is subscribed to, so a queue
+ * must only be attached to one MpvController. When the queue is full new
+ * notifications are dropped and counted, the worker thread never waits.
+ *
+ * @code
+ * auto queue = std::make_shared<MpvNotificationQueue>();
+ * queue->setWakeup([consumer] {
+ *     QMetaObject::invokeMethod(consumer, &Consumer::drain, Qt::QueuedConnection);
+ * });
+ * controller->subscribeProperty(QStringLiteral("time-pos"), MPV_FORMAT_DOUBLE,
+ *                               MpvNotificationQueue::subscriber(queue));
+ *
+ * void Consumer::drain()
+ * {
+ *     m_queue->drain([](MpvNotification &n) { ... });
+ * }
+ * @endcode
+ */
+class MpvNotificationQueue
+{
+public:
+    /**
+     * @param capacity maximum number of pending notifications, rounded up to a power of two
+     */
+    explicit MpvNotificationQueue(size_t capacity = 256)
+    {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    /**
+     * Set a function that is called on the producer thread whenever the queue
+     * goes from drained to non-empty. Use it to schedule drain() on the
+     * consumer thread. Must be set before the queue is subscribed.
+     */
+    void setWakeup(std::function<void()> wakeup)
+    {
+        m_wakeup = std::move(wakeup);
+    }
+
+    /**
+     * Producer side, called from the controller's worker thread.
+     *
+     * @return false if the queue was full and the notification was dropped
+     */
+    bool push(MpvNotification &&notification)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        m_slots[tail & m_mask] = std::move(notification);
+        m_tail.store(tail + 1, std::memory_order_release);
+
+        if (m_wakeup && !m_wakePending.exchange(true, std::memory_order_acq_rel)) {
+            m_wakeup();
+        }
+        return true;
+    }
+
+    /**
+     * Consumer side. Pops a single notification.
+     *
+     * @return false if the queue is empty
+     */
+    bool pop(MpvNotification &notification)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        notification = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. Re-arms the wakeup and pops every pending notification,
+     * passing each one to @p handler.
+     */
+    template<typename Handler>
+    void drain(Handler &&handler)
+    {
+        m_wakePending.store(false, std::memory_order_release);
+        MpvNotification notification;
+        while (pop(notification)) {
+            handler(notification);
+        }
+    }
+
+    /**
+     * @return number of notifications dropped because the queue was full
+     */
+    size_t dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Returns a subscriber that pushes notifications into @p queue,
+     * for use with MpvController::subscribeProperty() and MpvController::subscribeEvents().
+     */
+    static MpvSubscriber subscriber(const std::shared_ptr<MpvNotificationQueue> &queue)
+    {
+        return [queue](const MpvNotification &notification) {
+            MpvNotification copy = notification;
+            queue->push(std::move(copy));
+        };
+    }
+
+private:
+    std::vector<MpvNotification> m_slots;
+    size_t m_mask{0};
+    alignas(64) std::atomic<size_t> m_head{0};
+    alignas(64) std::atomic<size_t> m_tail{0};
+    std::atomic<bool> m_wakePending{false};
+    std::atomic<size_t> m_dropped{0};
+    std::function<void()> m_wakeup;
+};
+
+#endif // MPVNOTIFICATIONQUEUE_H
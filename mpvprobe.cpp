@@ -0,0 +1,92 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvprobe.h"
+
+#include <QHash>
+#include <QMimeDatabase>
+
+MpvProbeLevel MpvProbe::level(int index)
+{
+    static constexpr MpvProbeLevel levels[LevelCount]{
+        {256 * 1024, 0.5},
+        {2 * 1024 * 1024, 2},
+        {50'000'000, 50},
+    };
+    return levels[qBound(0, index, LevelCount - 1)];
+}
+
+MpvProbeLevel MpvProbe::lavfDefault()
+{
+    // libavformat's probesize and max_analyze_duration defaults
+    return {5'000'000, 5};
+}
+
+QString MpvProbe::sniffFormat(const QUrl &source)
+{
+    static const QHash<QString, QString> formats{
+        {QStringLiteral("video/mp4"), QStringLiteral("mov")},
+        {QStringLiteral("audio/mp4"), QStringLiteral("mov")},
+        {QStringLiteral("video/quicktime"), QStringLiteral("mov")},
+        {QStringLiteral("video/3gpp"), QStringLiteral("mov")},
+        {QStringLiteral("video/x-matroska"), QStringLiteral("matroska")},
+        {QStringLiteral("audio/x-matroska"), QStringLiteral("matroska")},
+        {QStringLiteral("video/webm"), QStringLiteral("matroska")},
+        {QStringLiteral("audio/webm"), QStringLiteral("matroska")},
+        {QStringLiteral("video/mp2t"), QStringLiteral("mpegts")},
+        {QStringLiteral("video/x-flv"), QStringLiteral("flv")},
+        {QStringLiteral("video/ogg"), QStringLiteral("ogg")},
+        {QStringLiteral("audio/ogg"), QStringLiteral("ogg")},
+        {QStringLiteral("audio/x-vorbis+ogg"), QStringLiteral("ogg")},
+        {QStringLiteral("audio/x-opus+ogg"), QStringLiteral("ogg")},
+        {QStringLiteral("audio/mpeg"), QStringLiteral("mp3")},
+        {QStringLiteral("audio/flac"), QStringLiteral("flac")},
+        {QStringLiteral("audio/x-wav"), QStringLiteral("wav")},
+        {QStringLiteral("video/x-msvideo"), QStringLiteral("avi")},
+    };
+
+    QMimeDatabase database;
+    // only local files can be sniffed without blocking on the network
+    const QMimeType mimeType = source.isLocalFile() ? database.mimeTypeForFile(source.toLocalFile())
+                                                    : database.mimeTypeForFile(source.path(), QMimeDatabase::MatchExtension);
+    if (!mimeType.isValid() || mimeType.isDefault()) {
+        return {};
+    }
+    auto format = formats.constFind(mimeType.name());
+    if (format != formats.constEnd()) {
+        return format.value();
+    }
+    const auto aliases = mimeType.aliases();
+    for (const auto &alias : aliases) {
+        format = formats.constFind(alias);
+        if (format != formats.constEnd()) {
+            return format.value();
+        }
+    }
+    return {};
+}
+
+bool MpvProbe::hasStreamParameters(const QVariant &trackList)
+{
+    bool hasStreams = false;
+    const auto tracks = trackList.toList();
+    for (const auto &track : tracks) {
+        const auto map = track.toMap();
+        const QString type = map.value(QStringLiteral("type")).toString();
+        if (type == QStringLiteral("video") && !map.value(QStringLiteral("albumart")).toBool()) {
+            hasStreams = true;
+            if (map.value(QStringLiteral("demux-w")).toInt() <= 0 || map.value(QStringLiteral("demux-h")).toInt() <= 0) {
+                return false;
+            }
+        } else if (type == QStringLiteral("audio")) {
+            hasStreams = true;
+            if (map.value(QStringLiteral("demux-samplerate")).toInt() <= 0 || map.value(QStringLiteral("demux-channel-count")).toInt() <= 0) {
+                return false;
+            }
+        }
+    }
+    return hasStreams;
+}
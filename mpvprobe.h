@@ -0,0 +1,62 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVPROBE_H
+#define MPVPROBE_H
+
+#include <QString>
+#include <QUrl>
+#include <QVariant>
+
+/**
+ * How much lavf may read to detect the streams of a source, applied as
+ * demuxer-lavf-probesize and demuxer-lavf-analyzeduration.
+ */
+struct MpvProbeLevel {
+    qint64 probeSize;
+    // seconds
+    double analyzeDuration;
+};
+
+/**
+ * Helpers for fast-start probing, see QMpv::fastStart.
+ *
+ * A source starts with the smallest probe level and is reopened with the next
+ * one only if the streams found lack their parameters, so well-formed files
+ * start after reading a few hundred KB instead of up to 50 MB.
+ */
+class MpvProbe
+{
+public:
+    static constexpr int LevelCount = 3;
+
+    /**
+     * Level 0 reads 256 KB or 0.5 s, level 1 2 MB or 2 s, level 2 50 MB or 50 s.
+     */
+    static MpvProbeLevel level(int index);
+
+    /**
+     * What lavf reads when mpv leaves the options unset: 5 MB or 5 s.
+     * demuxer-lavf-probesize can't be set back to unset (0 is out of its range),
+     * so this is applied instead for sources opened without a probe level.
+     */
+    static MpvProbeLevel lavfDefault();
+
+    /**
+     * The lavf demuxer for @p source, guessed from its MIME type: from the first
+     * few KB and the extension for local files, from the extension otherwise.
+     * Empty if unknown, leaving the detection to lavf.
+     */
+    static QString sniffFormat(const QUrl &source);
+
+    /**
+     * Whether the video and audio tracks of a track-list property value
+     * all have their essential parameters (size, sample rate, channels).
+     */
+    static bool hasStreamParameters(const QVariant &trackList);
+};
+
+#endif // MPVPROBE_H
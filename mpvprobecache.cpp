@@ -0,0 +1,311 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvprobecache.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QPointer>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvProbeCache, "MpvQt.MpvProbeCache")
+
+MpvProbeCache *MpvProbeCache::instance()
+{
+    static QPointer<MpvProbeCache> cache;
+    if (!cache) {
+        cache = new MpvProbeCache(QCoreApplication::instance());
+    }
+    return cache;
+}
+
+MpvProbeCache::MpvProbeCache(QObject *parent)
+    : QObject(parent)
+{
+    // entries come in bursts when a list of files is opened
+    m_saveTimer.setSingleShot(true);
+    m_saveTimer.setInterval(2000);
+    connect(&m_saveTimer, &QTimer::timeout, this, &MpvProbeCache::save);
+    load();
+}
+
+MpvProbeCache::~MpvProbeCache()
+{
+    if (m_saveTimer.isActive()) {
+        save();
+    }
+}
+
+bool MpvProbeCache::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void MpvProbeCache::setEnabled(bool enabled)
+{
+    m_isEnabled = enabled;
+}
+
+int MpvProbeCache::maximumEntries() const
+{
+    return m_maximumEntries;
+}
+
+void MpvProbeCache::setMaximumEntries(int count)
+{
+    m_maximumEntries = qMax(0, count);
+    trim();
+}
+
+QNetworkAccessManager *MpvProbeCache::network()
+{
+    if (!m_network) {
+        m_network = new QNetworkAccessManager(this);
+    }
+    return m_network;
+}
+
+QString MpvProbeCache::fileName() const
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/mpvqt/probe-cache.json");
+}
+
+MpvProbeEntry MpvProbeCache::lookup(const QUrl &source)
+{
+    if (!m_isEnabled) {
+        return {};
+    }
+    const QString key = source.toString(QUrl::FullyEncoded);
+    auto entry = m_entries.find(key);
+    if (entry == m_entries.end()) {
+        return {};
+    }
+
+    if (source.isLocalFile()) {
+        const QFileInfo info(source.toLocalFile());
+        if (!info.exists() || info.size() != entry->localSize || info.lastModified() != entry->localModified) {
+            qCDebug(MpvQt_MpvProbeCache) << "dropping outdated entry of" << source;
+            m_entries.erase(entry);
+            scheduleSave();
+            return {};
+        }
+    } else if (entry->etag.isEmpty() && entry->lastModified.isEmpty()) {
+        qCDebug(MpvQt_MpvProbeCache) << "dropping entry of" << source << "without validators";
+        m_entries.erase(entry);
+        scheduleSave();
+        return {};
+    }
+    entry->lastUsed = QDateTime::currentDateTimeUtc();
+    scheduleSave();
+    return entry.value();
+}
+
+void MpvProbeCache::validate(const QUrl &source, const MpvProbeEntry &entry, QObject *context, std::function<void(bool isValid)> callback)
+{
+    QNetworkRequest request(source);
+    request.setTransferTimeout(ValidationTimeout);
+    if (!entry.etag.isEmpty()) {
+        request.setRawHeader("If-None-Match", entry.etag);
+    }
+    if (!entry.lastModified.isEmpty()) {
+        request.setRawHeader("If-Modified-Since", entry.lastModified);
+    }
+    QNetworkReply *reply = network()->head(request);
+    connect(reply, &QNetworkReply::finished, this, [this, reply, source, entry, context = QPointer<QObject>(context), callback]() {
+        reply->deleteLater();
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        // servers ignoring the conditions answer with the current validators
+        const bool isValid = status == 304
+            || (status == 200 && (entry.etag.isEmpty() || reply->rawHeader("ETag") == entry.etag)
+                && (entry.lastModified.isEmpty() || reply->rawHeader("Last-Modified") == entry.lastModified));
+        if (!isValid && status != 0) {
+            qCDebug(MpvQt_MpvProbeCache) << "dropping outdated entry of" << source << "status" << status;
+            remove(source);
+        }
+        if (context) {
+            callback(isValid);
+        }
+    });
+}
+
+void MpvProbeCache::insert(const QUrl &source, MpvProbeEntry entry)
+{
+    ++m_missCount;
+    Q_EMIT statisticsChanged();
+    if (!m_isEnabled || !entry.isValid()) {
+        return;
+    }
+    if (source.isLocalFile()) {
+        const QFileInfo info(source.toLocalFile());
+        entry.localSize = info.size();
+        entry.localModified = info.lastModified();
+        store(source, entry);
+        return;
+    }
+
+    // remote entries are only useful with validators to check them against before use
+    QNetworkRequest request(source);
+    request.setTransferTimeout(ValidationTimeout);
+    QNetworkReply *reply = network()->head(request);
+    connect(reply, &QNetworkReply::finished, this, [this, reply, source, entry]() mutable {
+        reply->deleteLater();
+        entry.etag = reply->rawHeader("ETag");
+        entry.lastModified = reply->rawHeader("Last-Modified");
+        if (reply->error() != QNetworkReply::NoError || (entry.etag.isEmpty() && entry.lastModified.isEmpty())) {
+            qCDebug(MpvQt_MpvProbeCache) << "not storing" << source << "without validators" << reply->errorString();
+            return;
+        }
+        store(source, entry);
+    });
+}
+
+void MpvProbeCache::store(const QUrl &source, MpvProbeEntry entry)
+{
+    entry.lastUsed = QDateTime::currentDateTimeUtc();
+    m_entries.insert(source.toString(QUrl::FullyEncoded), entry);
+    trim();
+    scheduleSave();
+}
+
+void MpvProbeCache::recordHit(const QUrl &source, qint64 openTime)
+{
+    ++m_hitCount;
+    const auto entry = m_entries.constFind(source.toString(QUrl::FullyEncoded));
+    if (entry != m_entries.constEnd()) {
+        m_timeSaved += qMax<qint64>(0, entry->openTime - openTime);
+    }
+    Q_EMIT statisticsChanged();
+}
+
+void MpvProbeCache::remove(const QUrl &source)
+{
+    if (m_entries.remove(source.toString(QUrl::FullyEncoded))) {
+        scheduleSave();
+    }
+}
+
+void MpvProbeCache::clear()
+{
+    m_entries.clear();
+    m_hitCount = 0;
+    m_missCount = 0;
+    m_timeSaved = 0;
+    scheduleSave();
+    Q_EMIT statisticsChanged();
+}
+
+int MpvProbeCache::hitCount() const
+{
+    return m_hitCount;
+}
+
+int MpvProbeCache::missCount() const
+{
+    return m_missCount;
+}
+
+qreal MpvProbeCache::hitRate() const
+{
+    const int lookups = m_hitCount + m_missCount;
+    return lookups > 0 ? qreal(m_hitCount) / lookups : 0;
+}
+
+qint64 MpvProbeCache::timeSaved() const
+{
+    return m_timeSaved;
+}
+
+void MpvProbeCache::scheduleSave()
+{
+    if (!m_saveTimer.isActive()) {
+        m_saveTimer.start();
+    }
+}
+
+void MpvProbeCache::trim()
+{
+    while (m_entries.size() > m_maximumEntries) {
+        auto oldest = m_entries.begin();
+        for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+            if (it->lastUsed < oldest->lastUsed) {
+                oldest = it;
+            }
+        }
+        m_entries.erase(oldest);
+    }
+}
+
+void MpvProbeCache::load()
+{
+    QFile file(fileName());
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QJsonObject entries = QJsonDocument::fromJson(file.readAll()).object();
+    for (auto it = entries.constBegin(); it != entries.constEnd(); ++it) {
+        const QJsonObject object = it.value().toObject();
+        MpvProbeEntry entry;
+        entry.format = object.value(QStringLiteral("format")).toString();
+        entry.probeLevel = object.value(QStringLiteral("probeLevel")).toInt(-1);
+        entry.duration = object.value(QStringLiteral("duration")).toDouble();
+        entry.fileSize = object.value(QStringLiteral("fileSize")).toInteger(-1);
+        entry.tracks = object.value(QStringLiteral("tracks")).toArray().toVariantList();
+        entry.keyId = object.value(QStringLiteral("keyId")).toString().toLatin1();
+        entry.openTime = object.value(QStringLiteral("openTime")).toInteger();
+        entry.localSize = object.value(QStringLiteral("localSize")).toInteger(-1);
+        entry.localModified = QDateTime::fromString(object.value(QStringLiteral("localModified")).toString(), Qt::ISODateWithMs);
+        entry.etag = object.value(QStringLiteral("etag")).toString().toLatin1();
+        entry.lastModified = object.value(QStringLiteral("lastModified")).toString().toLatin1();
+        entry.lastUsed = QDateTime::fromString(object.value(QStringLiteral("lastUsed")).toString(), Qt::ISODateWithMs);
+        if (entry.isValid()) {
+            m_entries.insert(it.key(), entry);
+        }
+    }
+    qCDebug(MpvQt_MpvProbeCache) << "loaded" << m_entries.size() << "entries from" << file.fileName();
+}
+
+void MpvProbeCache::save()
+{
+    m_saveTimer.stop();
+
+    QJsonObject entries;
+    for (auto it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        const MpvProbeEntry &entry = it.value();
+        QJsonObject object;
+        object.insert(QStringLiteral("format"), entry.format);
+        object.insert(QStringLiteral("probeLevel"), entry.probeLevel);
+        object.insert(QStringLiteral("duration"), entry.duration);
+        object.insert(QStringLiteral("fileSize"), entry.fileSize);
+        object.insert(QStringLiteral("tracks"), QJsonArray::fromVariantList(entry.tracks));
+        object.insert(QStringLiteral("keyId"), QString::fromLatin1(entry.keyId));
+        object.insert(QStringLiteral("openTime"), entry.openTime);
+        object.insert(QStringLiteral("localSize"), entry.localSize);
+        object.insert(QStringLiteral("localModified"), entry.localModified.toString(Qt::ISODateWithMs));
+        object.insert(QStringLiteral("etag"), QString::fromLatin1(entry.etag));
+        object.insert(QStringLiteral("lastModified"), QString::fromLatin1(entry.lastModified));
+        object.insert(QStringLiteral("lastUsed"), entry.lastUsed.toString(Qt::ISODateWithMs));
+        entries.insert(it.key(), object);
+    }
+
+    QDir().mkpath(QFileInfo(fileName()).absolutePath());
+    QSaveFile file(fileName());
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(MpvQt_MpvProbeCache) << "could not write" << file.fileName() << file.errorString();
+        return;
+    }
+    file.write(QJsonDocument(entries).toJson(QJsonDocument::Compact));
+    file.commit();
+}
+
+#include "moc_mpvprobecache.cpp"
@@ -0,0 +1,146 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVPROBECACHE_H
+#define MPVPROBECACHE_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QObject>
+#include <QTimer>
+#include <QUrl>
+#include <QVariantList>
+
+#include <functional>
+
+class QNetworkAccessManager;
+
+/**
+ * What probing a source found out, see MpvProbeCache.
+ */
+struct MpvProbeEntry {
+    // lavf demuxer, e.g. "mov"
+    QString format;
+    // MpvProbe level that was enough, -1 if opened without fast start
+    int probeLevel{-1};
+    double duration{0};
+    qint64 fileSize{-1};
+    // type, codec and demuxer parameters of each track
+    QVariantList tracks;
+    QByteArray keyId;
+    // milliseconds from loadfile to the file being loaded, when it was probed
+    qint64 openTime{0};
+
+    // validators of local files
+    qint64 localSize{-1};
+    QDateTime localModified;
+    // validators of remote sources, from the server's ETag and Last-Modified headers
+    QByteArray etag;
+    QByteArray lastModified;
+
+    QDateTime lastUsed;
+
+    bool isValid() const
+    {
+        return !format.isEmpty();
+    }
+};
+
+/**
+ * On-disk cache of probe results, consulted by QMpv before loading a source.
+ *
+ * A hit gives the demuxer and the probe level the source needed last time,
+ * so it opens without format detection and without widening the probe.
+ * Local files are validated by size and modification time in lookup().
+ * Remote sources are stored with the ETag and Last-Modified the server sends
+ * for a HEAD request, and only if it sends either; their entries are
+ * revalidated with a conditional HEAD request before use, see validate().
+ *
+ * Stored as JSON in the application's cache location. Lives on the GUI thread.
+ */
+class MpvProbeCache : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(int hitCount READ hitCount NOTIFY statisticsChanged)
+    Q_PROPERTY(int missCount READ missCount NOTIFY statisticsChanged)
+    Q_PROPERTY(qreal hitRate READ hitRate NOTIFY statisticsChanged)
+    // milliseconds of opening time saved by hits, compared to the first, probed opening
+    Q_PROPERTY(qint64 timeSaved READ timeSaved NOTIFY statisticsChanged)
+
+public:
+    static MpvProbeCache *instance();
+    ~MpvProbeCache();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Maximum number of entries, the least recently used ones go first. Defaults to 500.
+     */
+    int maximumEntries() const;
+    void setMaximumEntries(int count);
+
+    /**
+     * The entry for @p source, invalid if there is none or a local file changed.
+     * Entries of remote sources have to be validate()d before use.
+     */
+    MpvProbeEntry lookup(const QUrl &source);
+
+    /**
+     * Check with the server whether the remote @p source is still what @p entry
+     * was probed from, and call @p callback with the answer unless @p context
+     * is gone by then. A source that changed loses its entry;
+     * one that couldn't be reached within ValidationTimeout keeps it, but is
+     * reported invalid.
+     */
+    void validate(const QUrl &source, const MpvProbeEntry &entry, QObject *context, std::function<void(bool isValid)> callback);
+
+    /**
+     * Store what probing @p source found out, counted as a miss. Remote sources
+     * are stored once the server sent their validators.
+     */
+    void insert(const QUrl &source, MpvProbeEntry entry);
+
+    /**
+     * Count a confirmed hit that opened in @p openTime milliseconds.
+     */
+    void recordHit(const QUrl &source, qint64 openTime);
+
+    void remove(const QUrl &source);
+    void clear();
+
+    int hitCount() const;
+    int missCount() const;
+    qreal hitRate() const;
+    qint64 timeSaved() const;
+
+    // milliseconds a validation may take before the source is opened without its entry
+    static constexpr int ValidationTimeout = 1500;
+
+Q_SIGNALS:
+    void statisticsChanged();
+
+private:
+    explicit MpvProbeCache(QObject *parent = nullptr);
+    void load();
+    void save();
+    void scheduleSave();
+    void trim();
+    void store(const QUrl &source, MpvProbeEntry entry);
+    QString fileName() const;
+    QNetworkAccessManager *network();
+
+    QHash<QString, MpvProbeEntry> m_entries;
+    bool m_isEnabled{true};
+    int m_maximumEntries{500};
+    int m_hitCount{0};
+    int m_missCount{0};
+    qint64 m_timeSaved{0};
+    QTimer m_saveTimer;
+    QNetworkAccessManager *m_network{nullptr};
+};
+
+#endif // MPVPROBECACHE_H
@@ -0,0 +1,70 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvratelimiter.h"
+
+#include <QMutexLocker>
+
+MpvRateLimiter::MpvRateLimiter()
+{
+    m_clock.start();
+}
+
+qint64 MpvRateLimiter::rate() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_rate;
+}
+
+void MpvRateLimiter::setRate(qint64 bytesPerSecond)
+{
+    QMutexLocker locker(&m_mutex);
+    refill();
+    m_rate = qMax<qint64>(0, bytesPerSecond);
+    // a lower rate doesn't keep the debt of a higher one longer than a burst
+    m_tokens = qBound(-m_rate * Burst, m_tokens, m_rate * Burst);
+    m_changed.wakeAll();
+}
+
+void MpvRateLimiter::consume(qint64 bytes, const std::atomic<bool> &isCancelled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_bytesConsumed += bytes;
+    if (m_rate <= 0) {
+        return;
+    }
+    refill();
+    m_tokens -= bytes;
+    while (m_rate > 0 && m_tokens < 0 && !isCancelled) {
+        // until the debt is paid back, checking now and then for a new rate
+        const qint64 wait = qBound<qint64>(1, qint64(-m_tokens * 1000 / m_rate), 100);
+        m_changed.wait(&m_mutex, wait);
+        refill();
+    }
+}
+
+qint64 MpvRateLimiter::bytesConsumed() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_bytesConsumed;
+}
+
+void MpvRateLimiter::wake()
+{
+    QMutexLocker locker(&m_mutex);
+    m_changed.wakeAll();
+}
+
+void MpvRateLimiter::refill()
+{
+    const qint64 now = m_clock.elapsed();
+    if (m_rate > 0) {
+        m_tokens = qMin(m_rate * Burst, m_tokens + m_rate * (now - m_lastRefill) / 1000.0);
+    } else {
+        m_tokens = 0;
+    }
+    m_lastRefill = now;
+}
@@ -0,0 +1,67 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVRATELIMITER_H
+#define MPVRATELIMITER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <atomic>
+
+/**
+ * Token bucket throttling the bytes the stream protocols of one player fetch
+ * from the network, see MpvStream::takeNetworkBytes(),
+ * MpvController::rateLimiter() and MpvBandwidthArbiter.
+ *
+ * Thread-safe.
+ */
+class MpvRateLimiter
+{
+public:
+    MpvRateLimiter();
+
+    /**
+     * Bytes per second the player may read, 0 for no limit.
+     */
+    qint64 rate() const;
+    void setRate(qint64 bytesPerSecond);
+
+    /**
+     * Account for @p bytes that were fetched, blocking while the fetches are
+     * ahead of the rate or until @p isCancelled is set and wake() is called.
+     */
+    void consume(qint64 bytes, const std::atomic<bool> &isCancelled);
+
+    /**
+     * Bytes consume() accounted for, limited or not.
+     */
+    qint64 bytesConsumed() const;
+
+    /**
+     * Make the blocked consume() calls check whether they are cancelled.
+     */
+    void wake();
+
+    // seconds of the rate that may be read at once
+    static constexpr double Burst = 0.5;
+
+private:
+    // with the mutex held
+    void refill();
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_changed;
+    qint64 m_rate{0};
+    qint64 m_bytesConsumed{0};
+    // bytes that may be read now, negative while reads are ahead of the rate
+    double m_tokens{0};
+    QElapsedTimer m_clock;
+    qint64 m_lastRefill{0};
+};
+
+#endif // MPVRATELIMITER_H
@@ -0,0 +1,56 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvreaper.h"
+
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvReaper, "MpvQt.MpvReaper")
+
+MpvReaper *MpvReaper::instance()
+{
+    static MpvReaper reaper;
+    return &reaper;
+}
+
+MpvReaper::MpvReaper()
+{
+    m_threadPool.setObjectName(QStringLiteral("MpvReaper"));
+    // handles are destroyed in parallel, one slow stream doesn't delay the others
+    m_threadPool.setMaxThreadCount(4);
+}
+
+MpvReaper::~MpvReaper()
+{
+    waitForDone();
+}
+
+void MpvReaper::reap(mpv_handle *handle, std::shared_ptr<void> keepAlive)
+{
+    if (!handle) {
+        return;
+    }
+    ++m_pendingCount;
+    m_threadPool.start([this, handle, keepAlive = std::move(keepAlive)]() mutable {
+        QElapsedTimer timer;
+        timer.start();
+        mpv_terminate_destroy(handle);
+        keepAlive.reset();
+        --m_pendingCount;
+        qCDebug(MpvQt_MpvReaper) << "mpv handle destroyed in" << timer.elapsed() << "ms";
+    });
+}
+
+int MpvReaper::pendingCount() const
+{
+    return m_pendingCount;
+}
+
+void MpvReaper::waitForDone()
+{
+    m_threadPool.waitForDone();
+}
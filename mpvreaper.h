@@ -0,0 +1,59 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVREAPER_H
+#define MPVREAPER_H
+
+#include <QThreadPool>
+
+#include <mpv/client.h>
+
+#include <atomic>
+#include <memory>
+
+/**
+ * Destroys mpv handles in the background.
+ *
+ * mpv_terminate_destroy() waits for the demuxer, network and decoder threads
+ * to exit, which can take seconds on slow streams. MpvHandleManager hands its
+ * handle to the reaper instead, so whichever thread drops the last reference
+ * (the GUI thread closing a page, the render thread after freeing the render
+ * context, a worker thread) never blocks on it.
+ *
+ * Pending handles are destroyed before the application exits.
+ */
+class MpvReaper
+{
+public:
+    static MpvReaper *instance();
+
+    /**
+     * Take ownership of @p handle and destroy it with mpv_terminate_destroy()
+     * on a reaper thread. Any render context created for it must be freed already.
+     * @p keepAlive is released once the handle is destroyed, for state mpv's
+     * callbacks use until then.
+     */
+    void reap(mpv_handle *handle, std::shared_ptr<void> keepAlive = {});
+
+    /**
+     * Number of handles waiting for, or in the middle of, destruction.
+     */
+    int pendingCount() const;
+
+    /**
+     * Block until every reaped handle is destroyed.
+     */
+    void waitForDone();
+
+private:
+    MpvReaper();
+    ~MpvReaper();
+
+    QThreadPool m_threadPool;
+    std::atomic<int> m_pendingCount{0};
+};
+
+#endif // MPVREAPER_H
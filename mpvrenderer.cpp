@@ -10,6 +10,9 @@
 #include <QLoggingCategory>
 #include <QOpenGLContext>
 #include <QOpenGLFramebufferObject>
+#include <QOpenGLPaintDevice>
+#include <QPainter>
+#include <QQuickOpenGLUtils>
 #include <QQuickWindow>
 
 #include "mpvabstractitem.h"
@@ -52,19 +55,77 @@ void MpvRenderer::synchronize(QQuickFramebufferObject *item)
     MpvAbstractItem *mpvAItem = static_cast<MpvAbstractItem *>(item);
     m_mpvAItem = mpvAItem;
 
-    if (!m_mpvResourceManager) {
-        m_mpvResourceManager = mpvAItem->d_ptr->m_mpvResourceManager;
+    auto d = mpvAItem->d_ptr.get();
+    if (m_mpvResourceManager != d->m_mpvResourceManager) {
+        // keep what the hibernated player showed, the framebuffer may be recreated before it resumes
+        if (d->m_isHibernated && d->m_hibernatedFrame.isNull() && m_isFramebufferReady && framebufferObject()) {
+            d->m_hibernatedFrame = framebufferObject()->toImage();
+        }
+        // the item got a new player or released its player; the render context has
+        // to be freed here, on the render thread, before the old player can be reused
+        if (m_mpvResourceManager) {
+            m_mpvResourceManager->freeContext();
+        }
+        m_mpvResourceManager = d->m_mpvResourceManager;
+        m_isFramebufferReady = false;
     }
 
-    if (mpvAItem->d_ptr->m_isRendererReady != m_isFramebufferReady) {
-        mpvAItem->d_ptr->m_isRendererReady = m_isFramebufferReady;
+    if (d->m_isRendererReady != m_isFramebufferReady) {
+        d->m_isRendererReady = m_isFramebufferReady;
 
         Q_EMIT mpvAItem->ready();
     }
+
+    if (d->m_isHoldingFrame && m_hasRestoredFrame) {
+        // the GUI thread is blocked during synchronize(), the item's state can be changed here
+        d->m_isHoldingFrame = false;
+        d->m_hibernatedFrame = QImage();
+        const qint64 resumeTime = d->m_resumeTimer.elapsed();
+        QPointer<MpvAbstractItem> item = mpvAItem;
+        QMetaObject::invokeMethod(
+            mpvAItem,
+            [item, resumeTime]() {
+                if (item) {
+                    item->d_ptr->finishResume(resumeTime);
+                }
+            },
+            Qt::QueuedConnection);
+    }
+    m_hasRestoredFrame = false;
+    m_isHoldingFrame = d->m_isHibernated || d->m_isHoldingFrame;
+    m_heldFrame = m_isHoldingFrame ? d->m_hibernatedFrame : QImage();
 }
 
 void MpvRenderer::render()
 {
+    if (!m_mpvResourceManager) {
+        // hibernated, or the mpv core is still being initialized
+        drawHeldFrame();
+        return;
+    }
+    if (!m_mpvResourceManager->mpvRenderContext) {
+        // the framebuffer was created before the mpv core was ready
+        m_mpvResourceManager->mpvRenderContext = createMpvRenderContext();
+        m_isFramebufferReady = m_mpvResourceManager->mpvRenderContext != nullptr;
+        if (!m_isFramebufferReady) {
+            drawHeldFrame();
+            return;
+        }
+        // let synchronize() emit ready()
+        requestUpdate();
+    }
+
+    if (m_isHoldingFrame) {
+        if (!(mpv_render_context_update(m_mpvResourceManager->mpvRenderContext) & MPV_RENDER_UPDATE_FRAME)) {
+            drawHeldFrame();
+            return;
+        }
+        m_isHoldingFrame = false;
+        m_hasRestoredFrame = true;
+        // let synchronize() report the resume
+        requestUpdate();
+    }
+
     QOpenGLFramebufferObject *fbo = framebufferObject();
     mpv_opengl_fbo mpfbo;
     mpfbo.fbo = static_cast<int>(fbo->handle());
@@ -90,11 +151,25 @@ void MpvRenderer::render()
     }
 }
 
+void MpvRenderer::drawHeldFrame()
+{
+    if (!m_isHoldingFrame || m_heldFrame.isNull()) {
+        return;
+    }
+    // renders into the framebuffer bound for render()
+    QOpenGLPaintDevice device(framebufferObject()->size());
+    QPainter painter(&device);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+    painter.drawImage(QRect(QPoint(0, 0), device.size()), m_heldFrame);
+    painter.end();
+    QQuickOpenGLUtils::resetOpenGLState();
+}
+
 QOpenGLFramebufferObject *MpvRenderer::createFramebufferObject(const QSize &size)
 {
     if (m_mpvResourceManager && !m_mpvResourceManager->mpvRenderContext) {
         m_mpvResourceManager->mpvRenderContext = createMpvRenderContext();
-        m_isFramebufferReady = true;
+        m_isFramebufferReady = m_mpvResourceManager->mpvRenderContext != nullptr;
     }
 
     return QQuickFramebufferObject::Renderer::createFramebufferObject(size);
@@ -7,6 +7,7 @@
 #ifndef MPVRENDERER_H
 #define MPVRENDERER_H
 
+#include <QImage>
 #include <QtQuick/QQuickFramebufferObject>
 
 #include <mpv/render_gl.h>
@@ -31,8 +32,14 @@ public:
 
 private:
     mpv_render_context *createMpvRenderContext();
+    // draws m_heldFrame into the framebuffer, scaled to it
+    void drawHeldFrame();
     QPointer<MpvAbstractItem> m_mpvAItem{nullptr};
     bool m_isFramebufferReady{false};
+    // draw the hibernated frame until the resumed player has one
+    bool m_isHoldingFrame{false};
+    bool m_hasRestoredFrame{false};
+    QImage m_heldFrame;
     std::shared_ptr<MpvResourceManager> m_mpvResourceManager;
 };
 
@@ -0,0 +1,224 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvresourceprotocol.h"
+
+#include <QHash>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QResource>
+
+#include <cstring>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvResourceProtocol, "MpvQt.MpvResourceProtocol")
+
+namespace
+{
+class ResourceStream : public MpvStream
+{
+public:
+    ResourceStream(const uchar *data, qint64 size, QByteArray uncompressed = {})
+        : m_data(data)
+        , m_size(size)
+        , m_uncompressed(std::move(uncompressed))
+    {
+    }
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        const qint64 read = qMin(maxSize, m_size - m_position);
+        if (read <= 0) {
+            return 0;
+        }
+        std::memcpy(data, m_data + m_position, read);
+        m_position += read;
+        return read;
+    }
+
+    bool seek(qint64 offset) override
+    {
+        if (offset < 0 || offset > m_size) {
+            return false;
+        }
+        m_position = offset;
+        return true;
+    }
+
+    qint64 size() override
+    {
+        return m_size;
+    }
+
+private:
+    const uchar *m_data;
+    qint64 m_size;
+    // owns m_data for compressed resources
+    QByteArray m_uncompressed;
+    qint64 m_position{0};
+};
+
+struct Device {
+    std::shared_ptr<QIODevice> device;
+    // serializes the players reading the device
+    QMutex mutex;
+    bool isOpen{false};
+};
+
+struct Devices {
+    QMutex mutex;
+    QHash<quint64, std::shared_ptr<Device>> devices;
+    quint64 nextId{1};
+};
+
+Devices &devices()
+{
+    static Devices devices;
+    return devices;
+}
+
+class DeviceStream : public MpvStream
+{
+public:
+    explicit DeviceStream(std::shared_ptr<Device> device)
+        : m_device(std::move(device))
+    {
+    }
+
+    ~DeviceStream() override
+    {
+        QMutexLocker locker(&m_device->mutex);
+        m_device->isOpen = false;
+    }
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        QMutexLocker locker(&m_device->mutex);
+        QIODevice *device = m_device->device.get();
+        // players sharing a random-access device each read from their own position
+        if (!device->isSequential() && device->pos() != m_position && !device->seek(m_position)) {
+            return -1;
+        }
+        const qint64 read = device->read(data, maxSize);
+        if (read > 0) {
+            m_position += read;
+        }
+        return read;
+    }
+
+    bool seek(qint64 offset) override
+    {
+        if (m_device->device->isSequential() || offset < 0 || offset > size()) {
+            return false;
+        }
+        m_position = offset;
+        return true;
+    }
+
+    qint64 size() override
+    {
+        QMutexLocker locker(&m_device->mutex);
+        return m_device->device->isSequential() ? -1 : m_device->device->size();
+    }
+
+private:
+    std::shared_ptr<Device> m_device;
+    qint64 m_position{0};
+};
+
+// the resource path of a qrc: or :/ url
+QString resourcePath(const QUrl &source)
+{
+    if (source.scheme() == QStringLiteral("qrc")) {
+        return QLatin1Char(':') + source.path();
+    }
+    if (source.scheme().isEmpty() && source.path().startsWith(QStringLiteral(":/"))) {
+        return source.path();
+    }
+    return {};
+}
+}
+
+bool MpvResourceProtocol::isResource(const QUrl &source)
+{
+    return !resourcePath(source).isEmpty();
+}
+
+QString MpvResourceProtocol::scheme() const
+{
+    return Scheme;
+}
+
+std::unique_ptr<MpvStream> MpvResourceProtocol::open(const QUrl &source)
+{
+    const QResource resource(resourcePath(source));
+    // directories have no data
+    if (!resource.isValid() || resource.size() == 0) {
+        return nullptr;
+    }
+    if (resource.compressionAlgorithm() != QResource::NoCompression) {
+        qCWarning(MpvQt_MpvResourceProtocol) << source << "is compressed and gets uncompressed into memory, add it without compression";
+        QByteArray data = resource.uncompressedData();
+        auto bytes = reinterpret_cast<const uchar *>(data.constData());
+        const qint64 size = data.size();
+        return std::make_unique<ResourceStream>(bytes, size, std::move(data));
+    }
+    // the data of registered resources stays mapped, no copy is made
+    return std::make_unique<ResourceStream>(resource.data(), resource.size());
+}
+
+QUrl MpvDeviceProtocol::registerDevice(std::shared_ptr<QIODevice> device)
+{
+    if (!device || !device->isReadable()) {
+        qCWarning(MpvQt_MpvResourceProtocol) << "the device must be open for reading";
+        return {};
+    }
+    auto entry = std::make_shared<Device>();
+    entry->device = std::move(device);
+
+    QMutexLocker locker(&devices().mutex);
+    const quint64 id = devices().nextId++;
+    devices().devices.insert(id, entry);
+    QUrl url;
+    url.setScheme(SourceScheme);
+    url.setPath(QString::number(id));
+    return url;
+}
+
+void MpvDeviceProtocol::unregisterDevice(const QUrl &source)
+{
+    QMutexLocker locker(&devices().mutex);
+    // streams still reading it keep it alive
+    devices().devices.remove(source.path().toULongLong());
+}
+
+QString MpvDeviceProtocol::scheme() const
+{
+    return Scheme;
+}
+
+std::unique_ptr<MpvStream> MpvDeviceProtocol::open(const QUrl &source)
+{
+    if (source.scheme() != SourceScheme) {
+        return nullptr;
+    }
+    std::shared_ptr<Device> device;
+    {
+        QMutexLocker locker(&devices().mutex);
+        device = devices().devices.value(source.path().toULongLong());
+    }
+    if (!device) {
+        return nullptr;
+    }
+    QMutexLocker locker(&device->mutex);
+    // a sequential device can't go back to where another player started
+    if (device->device->isSequential() && device->isOpen) {
+        qCWarning(MpvQt_MpvResourceProtocol) << source << "is sequential and already being played";
+        return nullptr;
+    }
+    device->isOpen = true;
+    return std::make_unique<DeviceStream>(device);
+}
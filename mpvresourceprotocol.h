@@ -0,0 +1,65 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVRESOURCEPROTOCOL_H
+#define MPVRESOURCEPROTOCOL_H
+
+#include <QIODevice>
+
+#include "mpvstreamprotocol.h"
+
+/**
+ * Plays media compiled into Qt resources ("qrc:/intro.mp4" or ":/intro.mp4")
+ * without extracting them: reads copy straight from the resource's mapped data
+ * into mpv's buffer.
+ *
+ * Compressed resources have to be uncompressed into memory first, so media
+ * should be added without compression (it rarely compresses anyway), e.g. with
+ * rcc's --no-compress or the resource's compression-algorithm="none".
+ */
+class MpvResourceProtocol : public MpvStreamProtocol
+{
+public:
+    static inline const QString Scheme = QStringLiteral("mpvqt-qrc");
+
+    /**
+     * Whether @p source names a Qt resource.
+     */
+    static bool isResource(const QUrl &source);
+
+    QString scheme() const override;
+    std::unique_ptr<MpvStream> open(const QUrl &source) override;
+};
+
+/**
+ * Plays media produced by a QIODevice.
+ *
+ * registerDevice() returns the "qiodevice:" url to set as source. The device is
+ * read on mpv's demuxer thread, never on the GUI thread, so it must not depend
+ * on an event loop: files, buffers, or devices producing their data
+ * synchronously. Random-access devices can be seeked in and opened by several
+ * players, sequential ones are read once from their current position.
+ */
+class MpvDeviceProtocol : public MpvStreamProtocol
+{
+public:
+    static inline const QString Scheme = QStringLiteral("mpvqt-device");
+    // scheme of the urls returned by registerDevice()
+    static inline const QString SourceScheme = QStringLiteral("qiodevice");
+
+    /**
+     * Make @p device, opened for reading, playable until unregisterDevice().
+     * Thread-safe.
+     * @return the url of the device
+     */
+    static QUrl registerDevice(std::shared_ptr<QIODevice> device);
+    static void unregisterDevice(const QUrl &source);
+
+    QString scheme() const override;
+    std::unique_ptr<MpvStream> open(const QUrl &source) override;
+};
+
+#endif // MPVRESOURCEPROTOCOL_H
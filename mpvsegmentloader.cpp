@@ -0,0 +1,1140 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvsegmentloader.h"
+
+#include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QLoggingCategory>
+#include <QMap>
+#include <QMutexLocker>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QPointer>
+#include <QSet>
+#include <QStandardPaths>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <QWaitCondition>
+
+#include <algorithm>
+#include <cstring>
+#include <deque>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvSegmentLoader, "MpvQt.MpvSegmentLoader")
+
+namespace
+{
+// milliseconds to wait for the playlist when opening a stream
+constexpr int OpenTimeout = 30000;
+// failed requests retried before a segment or the playlist fails
+constexpr int MaximumRetries = 3;
+// milliseconds before the first retry of a failed request, doubling with each failure
+constexpr qint64 RetryDelay = 500;
+// segments from the end of a live playlist where playback starts
+constexpr int LiveEdgeSegments = 3;
+// recent segments the throughput is computed from
+constexpr int ThroughputSegments = 16;
+
+// KEY=value,KEY="quoted, value" of a tag
+QHash<QString, QString> parseAttributes(const QString &list)
+{
+    QHash<QString, QString> attributes;
+    qsizetype position = 0;
+    while (position < list.size()) {
+        const qsizetype equals = list.indexOf(QLatin1Char('='), position);
+        if (equals < 0) {
+            break;
+        }
+        const QString name = list.mid(position, equals - position).trimmed();
+        qsizetype end = 0;
+        QString value;
+        if (list.mid(equals + 1, 1) == QStringLiteral("\"")) {
+            const qsizetype quote = list.indexOf(QLatin1Char('"'), equals + 2);
+            end = quote < 0 ? list.size() : quote + 1;
+            value = list.mid(equals + 2, end - equals - 3);
+        } else {
+            end = list.indexOf(QLatin1Char(','), equals);
+            end = end < 0 ? list.size() : end;
+            value = list.mid(equals + 1, end - equals - 1);
+        }
+        attributes.insert(name, value);
+        position = end + 1;
+    }
+    return attributes;
+}
+
+// length[@offset] of EXT-X-BYTERANGE, offset -1 if it follows the previous range
+void parseByteRange(const QString &range, qint64 &length, qint64 &offset)
+{
+    const qsizetype at = range.indexOf(QLatin1Char('@'));
+    length = range.left(at).toLongLong();
+    offset = at < 0 ? -1 : range.mid(at + 1).toLongLong();
+}
+}
+
+struct MpvSegmentLoader::Segment {
+    enum State {
+        Queued,
+        Loading,
+        Loaded,
+        Failed
+    };
+
+    QUrl url;
+    // -1 for init segments
+    qint64 sequence{-1};
+    // byte range within url, length -1 for all of it
+    qint64 offset{0};
+    qint64 length{-1};
+    State state{Queued};
+    int failures{0};
+    // loader clock time before which a failed segment isn't requested again
+    qint64 retryAt{0};
+    // the loaded data, in memory or in fileName
+    QByteArray data;
+    QString fileName;
+    // bytes, -1 until the segment was loaded or its size asked for
+    qint64 size{-1};
+
+    bool isSameResource(const Segment &other) const
+    {
+        return url == other.url && offset == other.offset && length == other.length;
+    }
+
+    // the data of a segment read or left behind by a seek, loaded again if needed
+    void release()
+    {
+        data.clear();
+        if (!fileName.isEmpty()) {
+            QFile::remove(fileName);
+            fileName.clear();
+        }
+        if (state == Loaded) {
+            state = Queued;
+        }
+    }
+};
+
+struct MpvSegmentLoader::Variant {
+    qint64 bandwidth{0};
+    QUrl url;
+};
+
+struct MpvSegmentLoader::Session {
+    QUrl source;
+    Storage storage{Memory};
+    QMutex mutex;
+    // woken whenever a segment or the playlist changed state
+    QWaitCondition changed;
+    // segments in reading order: all of them for VOD playlists, from the one
+    // being read on for live ones
+    std::deque<std::shared_ptr<Segment>> segments;
+    // position of the segment being read in segments, always 0 for live playlists
+    qsizetype readIndex{0};
+    // the playlist was parsed once
+    bool isReady{false};
+    // the playlist was complete when parsed first, the stream can seek
+    bool isVod{false};
+    // no segments are added any more
+    bool isEnded{false};
+    bool hasFailed{false};
+    // variants of the master playlist by increasing bandwidth, and the one loaded
+    QList<Variant> variants;
+    qsizetype variant{-1};
+    // variants can take over from any segment: no init segments to change
+    bool isSwitchable{false};
+    std::atomic<bool> isCancelled{false};
+    // bytes fetched for the stream not yet taken by takeNetworkBytes()
+    std::atomic<qint64> networkBytes{0};
+    // holds the files of Disk storage
+    std::unique_ptr<QTemporaryDir> directory;
+    // only touched on the network thread
+    QPointer<QObject> loader;
+};
+
+/**
+ * Fetches the playlist of a session and its segments. Lives on the network thread.
+ */
+class MpvSegmentLoader::Loader : public QObject
+{
+public:
+    Loader(MpvSegmentLoader *loader, std::shared_ptr<Session> session)
+        : QObject(loader->m_context)
+        , m_loader(loader)
+        , m_session(std::move(session))
+        , m_playlistUrl(m_session->source)
+    {
+        m_refresh.setSingleShot(true);
+        connect(&m_refresh, &QTimer::timeout, this, &Loader::fetchPlaylist);
+        m_retry.setSingleShot(true);
+        connect(&m_retry, &QTimer::timeout, this, &Loader::schedule);
+        fetchPlaylist();
+    }
+
+    ~Loader() override
+    {
+        if (m_playlistReply) {
+            release(m_playlistReply);
+        }
+        if (m_sizeReply) {
+            release(m_sizeReply);
+        }
+        const auto replies = m_fetches.keys();
+        for (QNetworkReply *reply : replies) {
+            release(reply);
+        }
+    }
+
+    // start the segments the window and the concurrency allow
+    void schedule()
+    {
+        const int concurrency = m_loader->concurrency();
+        const int segmentsAhead = m_loader->segmentsAhead();
+        const qint64 now = m_loader->m_clock.elapsed();
+        // the earliest time a failed segment in the window may be requested again
+        qint64 retryAt = -1;
+        QList<std::shared_ptr<Segment>> segments;
+        {
+            QMutexLocker locker(&m_session->mutex);
+            // the segment being read and the ones ahead of it
+            int window = 0;
+            for (auto it = m_session->segments.cbegin() + m_session->readIndex; it != m_session->segments.cend(); ++it) {
+                const auto &segment = *it;
+                if (window > segmentsAhead || m_fetches.size() + segments.size() >= concurrency) {
+                    break;
+                }
+                if (segment->state == Segment::Queued) {
+                    if (segment->retryAt > now) {
+                        retryAt = retryAt < 0 ? segment->retryAt : qMin(retryAt, segment->retryAt);
+                    } else {
+                        segment->state = Segment::Loading;
+                        segments.append(segment);
+                    }
+                }
+                ++window;
+            }
+        }
+        for (const auto &segment : std::as_const(segments)) {
+            fetch(segment);
+        }
+        if (retryAt >= 0 && (!m_retry.isActive() || m_retry.remainingTime() > retryAt - now)) {
+            m_retry.start(retryAt - now);
+        }
+    }
+
+    /**
+     * Load the segments from the variant at @p index of the master playlist on,
+     * starting with the first one not loading yet.
+     */
+    void selectVariant(qsizetype index)
+    {
+        Variant variant;
+        {
+            QMutexLocker locker(&m_session->mutex);
+            if (!m_session->isSwitchable || index < 0 || index >= m_session->variants.size() || index == m_session->variant) {
+                return;
+            }
+            m_session->variant = index;
+            variant = m_session->variants.at(index);
+            // the segments after the last one loading or loaded are dropped and
+            // queued again from the variant's playlist
+            auto &segments = m_session->segments;
+            qsizetype kept = m_session->readIndex;
+            for (qsizetype i = m_session->readIndex; i < qsizetype(segments.size()); ++i) {
+                if (segments.at(i)->state != Segment::Queued) {
+                    kept = i + 1;
+                }
+            }
+            if (kept < qsizetype(segments.size())) {
+                m_nextSequence = segments.at(kept)->sequence;
+                segments.erase(segments.begin() + kept, segments.end());
+            }
+        }
+        qCDebug(MpvQt_MpvSegmentLoader) << m_session->source << "switches to the variant" << variant.url << variant.bandwidth << "bit/s";
+        m_playlistUrl = variant.url;
+        m_playlistFailures = 0;
+        m_refresh.stop();
+        if (m_playlistReply) {
+            release(m_playlistReply);
+            m_playlistReply = nullptr;
+        }
+        fetchPlaylist();
+    }
+
+private:
+    struct Fetch {
+        std::shared_ptr<Segment> segment;
+        MpvSegmentTiming timing;
+        std::unique_ptr<QFile> file;
+        bool isAccepted{false};
+        bool hasFailed{false};
+    };
+
+    void fetchPlaylist()
+    {
+        m_playlistReply = m_loader->m_network->get(QNetworkRequest(m_playlistUrl));
+        connect(m_playlistReply, &QNetworkReply::finished, this, &Loader::onPlaylist);
+    }
+
+    void onPlaylist()
+    {
+        QNetworkReply *reply = m_playlistReply;
+        m_playlistReply = nullptr;
+        reply->deleteLater();
+        if (reply->error() != QNetworkReply::NoError) {
+            failPlaylist(reply->errorString(), true);
+            return;
+        }
+        const QStringList lines = QString::fromUtf8(reply->readAll()).split(QLatin1Char('\n'));
+        if (lines.isEmpty() || !lines.first().trimmed().startsWith(QStringLiteral("#EXTM3U"))) {
+            failPlaylist(QStringLiteral("not an HLS playlist"), false);
+            return;
+        }
+        // relative to where redirects led
+        const QUrl base = reply->url();
+        for (const QString &line : lines) {
+            if (line.startsWith(QStringLiteral("#EXT-X-STREAM-INF:"))) {
+                parseMaster(lines, base);
+                return;
+            }
+        }
+        parseMedia(lines, base);
+    }
+
+    void parseMaster(const QStringList &lines, const QUrl &base)
+    {
+        if (m_playlistUrl != m_session->source) {
+            failPlaylist(QStringLiteral("a variant is a master playlist"), false);
+            return;
+        }
+        // audio groups whose renditions are separate playlists
+        QSet<QString> separateAudio;
+        for (const QString &line : lines) {
+            if (line.startsWith(QStringLiteral("#EXT-X-MEDIA:"))) {
+                const auto attributes = parseAttributes(line.trimmed().mid(13));
+                if (attributes.value(QStringLiteral("TYPE")) == QStringLiteral("AUDIO") && attributes.contains(QStringLiteral("URI"))) {
+                    separateAudio.insert(attributes.value(QStringLiteral("GROUP-ID")));
+                }
+            }
+        }
+        // one variant per bandwidth, by increasing bandwidth
+        QMap<qint64, QUrl> variants;
+        bool hasSeparateAudio = false;
+        for (qsizetype i = 0; i < lines.size(); ++i) {
+            const QString line = lines.at(i).trimmed();
+            if (!line.startsWith(QStringLiteral("#EXT-X-STREAM-INF:"))) {
+                continue;
+            }
+            const auto attributes = parseAttributes(line.mid(18));
+            // the uri is the next line that isn't a tag
+            qsizetype next = i + 1;
+            while (next < lines.size() && (lines.at(next).trimmed().isEmpty() || lines.at(next).startsWith(QLatin1Char('#')))) {
+                ++next;
+            }
+            const QString audioGroup = attributes.value(QStringLiteral("AUDIO"));
+            if (!audioGroup.isEmpty() && separateAudio.contains(audioGroup)) {
+                hasSeparateAudio = true;
+                continue;
+            }
+            const qint64 bandwidth = attributes.value(QStringLiteral("BANDWIDTH")).toLongLong();
+            if (next < lines.size() && !variants.contains(bandwidth)) {
+                variants.insert(bandwidth, base.resolved(QUrl(lines.at(next).trimmed())));
+            }
+        }
+        if (variants.isEmpty()) {
+            failPlaylist(hasSeparateAudio ? QStringLiteral("separate audio renditions") : QStringLiteral("no variant"), false);
+            return;
+        }
+        Variant variant;
+        {
+            QMutexLocker locker(&m_session->mutex);
+            for (auto it = variants.cbegin(); it != variants.cend(); ++it) {
+                m_session->variants.append({it.key(), it.value()});
+            }
+            // the highest until the player asks for another one
+            m_session->variant = m_session->variants.size() - 1;
+            variant = m_session->variants.last();
+        }
+        qCDebug(MpvQt_MpvSegmentLoader) << m_session->source << "plays the variant" << variant.url << variant.bandwidth << "bit/s";
+        m_playlistUrl = variant.url;
+        fetchPlaylist();
+    }
+
+    void parseMedia(const QStringList &lines, const QUrl &base)
+    {
+        // the segments with the init segment they need, if any
+        QList<std::pair<std::shared_ptr<Segment>, std::shared_ptr<Segment>>> parsed;
+        std::shared_ptr<Segment> init;
+        qint64 sequence = 0;
+        int targetDuration = 0;
+        bool isEnded = false;
+        qint64 rangeLength = -1;
+        qint64 rangeOffset = -1;
+        // where the previous byte range ended, for ranges without offset
+        QUrl previousUrl;
+        qint64 previousEnd = 0;
+        for (const QString &rawLine : lines) {
+            const QString line = rawLine.trimmed();
+            if (line.isEmpty()) {
+                continue;
+            }
+            if (line.startsWith(QStringLiteral("#EXT-X-TARGETDURATION:"))) {
+                targetDuration = line.mid(22).toInt();
+            } else if (line.startsWith(QStringLiteral("#EXT-X-MEDIA-SEQUENCE:"))) {
+                sequence = line.mid(22).toLongLong();
+            } else if (line.startsWith(QStringLiteral("#EXT-X-ENDLIST"))) {
+                isEnded = true;
+            } else if (line.startsWith(QStringLiteral("#EXT-X-KEY:"))) {
+                if (parseAttributes(line.mid(11)).value(QStringLiteral("METHOD")) != QStringLiteral("NONE")) {
+                    failPlaylist(QStringLiteral("encrypted segments"), false);
+                    return;
+                }
+            } else if (line.startsWith(QStringLiteral("#EXT-X-MAP:"))) {
+                const auto attributes = parseAttributes(line.mid(11));
+                init = std::make_shared<Segment>();
+                init->url = base.resolved(QUrl(attributes.value(QStringLiteral("URI"))));
+                if (attributes.contains(QStringLiteral("BYTERANGE"))) {
+                    parseByteRange(attributes.value(QStringLiteral("BYTERANGE")), init->length, init->offset);
+                    init->offset = qMax<qint64>(0, init->offset);
+                    init->size = init->length;
+                }
+            } else if (line.startsWith(QStringLiteral("#EXT-X-BYTERANGE:"))) {
+                parseByteRange(line.mid(17), rangeLength, rangeOffset);
+            } else if (!line.startsWith(QLatin1Char('#'))) {
+                auto segment = std::make_shared<Segment>();
+                segment->url = base.resolved(QUrl(line));
+                segment->sequence = sequence++;
+                if (rangeLength >= 0) {
+                    segment->length = rangeLength;
+                    segment->size = rangeLength;
+                    segment->offset = rangeOffset >= 0 ? rangeOffset : (segment->url == previousUrl ? previousEnd : 0);
+                    previousUrl = segment->url;
+                    previousEnd = segment->offset + segment->length;
+                    rangeLength = -1;
+                    rangeOffset = -1;
+                }
+                parsed.append({segment, init});
+            }
+        }
+
+        const bool isFirst = m_nextSequence < 0;
+        // live streams start close to the live edge
+        const qsizetype first = isFirst && !isEnded ? qMax<qsizetype>(0, parsed.size() - LiveEdgeSegments) : 0;
+        int added = 0;
+        {
+            QMutexLocker locker(&m_session->mutex);
+            for (qsizetype i = first; i < parsed.size(); ++i) {
+                const auto &[segment, segmentInit] = parsed.at(i);
+                if (segment->sequence < m_nextSequence) {
+                    continue;
+                }
+                // an init segment precedes the first segment needing it
+                if (segmentInit && (!m_init || !m_init->isSameResource(*segmentInit))) {
+                    m_init = segmentInit;
+                    auto copy = std::make_shared<Segment>();
+                    copy->url = segmentInit->url;
+                    copy->offset = segmentInit->offset;
+                    copy->length = segmentInit->length;
+                    copy->size = segmentInit->size;
+                    m_session->segments.push_back(copy);
+                }
+                m_session->segments.push_back(segment);
+                m_nextSequence = segment->sequence + 1;
+                ++added;
+            }
+            if (isFirst) {
+                m_session->isVod = isEnded;
+                m_session->isSwitchable = m_session->variants.size() > 1 && !m_init;
+            }
+            m_session->isEnded = isEnded;
+            m_session->isReady = true;
+            m_session->changed.wakeAll();
+        }
+        m_playlistFailures = 0;
+        if (!isEnded) {
+            // a reload that brought nothing new is retried sooner
+            const int interval = qMax(1, targetDuration) * 1000;
+            m_refresh.start(added > 0 ? interval : interval / 2);
+        }
+        schedule();
+        fetchSize();
+    }
+
+    // the stream seeks by byte offsets, VOD segments not loaded yet are asked for their size one at a time
+    void fetchSize()
+    {
+        if (m_sizeReply || m_hasSizeFailed) {
+            return;
+        }
+        std::shared_ptr<Segment> segment;
+        {
+            QMutexLocker locker(&m_session->mutex);
+            if (!m_session->isVod) {
+                return;
+            }
+            for (const auto &candidate : m_session->segments) {
+                if (candidate->size < 0 && candidate->state != Segment::Loading) {
+                    segment = candidate;
+                    break;
+                }
+            }
+        }
+        if (!segment) {
+            return;
+        }
+        m_sizeReply = m_loader->m_network->head(QNetworkRequest(segment->url));
+        connect(m_sizeReply, &QNetworkReply::finished, this, [this, segment]() {
+            QNetworkReply *reply = m_sizeReply;
+            m_sizeReply = nullptr;
+            reply->deleteLater();
+            const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+            bool hasSize = false;
+            const qint64 size = reply->header(QNetworkRequest::ContentLengthHeader).toLongLong(&hasSize);
+            if (reply->error() != QNetworkReply::NoError || status != 200 || !hasSize) {
+                // the offsets past the segment stay unknown, seeking there is
+                // left to mpv's demuxer cache
+                m_hasSizeFailed = true;
+                qCDebug(MpvQt_MpvSegmentLoader) << "the size of" << segment->url << "is unknown, seeking past it isn't possible";
+                return;
+            }
+            {
+                QMutexLocker locker(&m_session->mutex);
+                if (segment->size < 0) {
+                    segment->size = size;
+                }
+            }
+            fetchSize();
+        });
+    }
+
+    void failPlaylist(const QString &reason, bool canRetry)
+    {
+        if (canRetry && ++m_playlistFailures <= MaximumRetries) {
+            qCDebug(MpvQt_MpvSegmentLoader) << "reloading" << m_playlistUrl << "after" << reason;
+            m_refresh.start(RetryDelay << m_playlistFailures);
+            return;
+        }
+        qCWarning(MpvQt_MpvSegmentLoader) << m_session->source << "can't be loaded:" << reason;
+        QMutexLocker locker(&m_session->mutex);
+        m_session->hasFailed = true;
+        m_session->changed.wakeAll();
+    }
+
+    void fetch(const std::shared_ptr<Segment> &segment)
+    {
+        QNetworkRequest request(segment->url);
+        if (segment->length >= 0) {
+            request.setRawHeader("Range",
+                                 "bytes=" + QByteArray::number(segment->offset) + '-' + QByteArray::number(segment->offset + segment->length - 1));
+        }
+        auto fetch = std::make_shared<Fetch>();
+        fetch->segment = segment;
+        fetch->timing.source = m_session->source;
+        fetch->timing.url = segment->url;
+        fetch->timing.sequence = segment->sequence;
+        fetch->timing.started = m_loader->m_clock.elapsed();
+        fetch->timing.firstByte = -1;
+        segment->data.clear();
+        if (m_session->storage == Disk) {
+            segment->fileName = m_session->directory->filePath(QString::number(++m_fileCount));
+            fetch->file = std::make_unique<QFile>(segment->fileName);
+            if (!fetch->file->open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+                qCWarning(MpvQt_MpvSegmentLoader) << "could not write" << segment->fileName << fetch->file->errorString() << "keeping it in memory";
+                fetch->file.reset();
+                segment->fileName.clear();
+            }
+        }
+
+        QNetworkReply *reply = m_loader->m_network->get(request);
+        m_fetches.insert(reply, fetch);
+        connect(reply, &QNetworkReply::readyRead, this, [this, reply]() {
+            onSegmentData(reply);
+        });
+        connect(reply, &QNetworkReply::finished, this, [this, reply]() {
+            onSegmentFinished(reply);
+        });
+    }
+
+    // whether the response is the segment, the first time data arrives
+    bool accept(QNetworkReply *reply, Fetch &fetch)
+    {
+        if (fetch.isAccepted) {
+            return true;
+        }
+        const int status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+        // a server ignoring the range would send the whole resource
+        if (status != (fetch.segment->length >= 0 ? 206 : 200)) {
+            qCWarning(MpvQt_MpvSegmentLoader) << fetch.segment->url << "answered with status" << status;
+            return false;
+        }
+        fetch.isAccepted = true;
+        fetch.timing.firstByte = m_loader->m_clock.elapsed();
+        return true;
+    }
+
+    void onSegmentData(QNetworkReply *reply)
+    {
+        const auto fetch = m_fetches.value(reply);
+        if (!accept(reply, *fetch)) {
+            reply->abort();
+            return;
+        }
+        const QByteArray data = reply->readAll();
+        fetch->timing.bytes += data.size();
+        m_session->networkBytes += data.size();
+        if (!fetch->file) {
+            fetch->segment->data.append(data);
+        } else if (fetch->file->write(data) != data.size()) {
+            qCWarning(MpvQt_MpvSegmentLoader) << "could not write" << fetch->file->fileName() << fetch->file->errorString();
+            fetch->hasFailed = true;
+            reply->abort();
+        }
+    }
+
+    void onSegmentFinished(QNetworkReply *reply)
+    {
+        const auto fetch = m_fetches.value(reply);
+        if (reply->error() == QNetworkReply::NoError && reply->bytesAvailable() > 0) {
+            onSegmentData(reply);
+        }
+        // empty segments have no data to accept them with
+        const bool isLoaded = reply->error() == QNetworkReply::NoError && !fetch->hasFailed && accept(reply, *fetch);
+        const QString error = reply->errorString();
+        m_fetches.remove(reply);
+        release(reply);
+        fetch->file.reset();
+
+        const auto &segment = fetch->segment;
+        {
+            QMutexLocker locker(&m_session->mutex);
+            if (isLoaded) {
+                if (segment->size >= 0 && segment->size != fetch->timing.bytes) {
+                    qCWarning(MpvQt_MpvSegmentLoader) << segment->url << "has" << fetch->timing.bytes << "bytes instead of" << segment->size
+                                                      << "the offsets of the segments after it moved";
+                }
+                segment->size = fetch->timing.bytes;
+                segment->state = Segment::Loaded;
+                // a seek left it behind while it loaded
+                const auto read = m_session->segments.cbegin() + m_session->readIndex;
+                if (std::find(m_session->segments.cbegin(), read, segment) != read) {
+                    segment->release();
+                }
+            } else {
+                qCDebug(MpvQt_MpvSegmentLoader) << "fetching" << segment->url << "failed:" << error;
+                segment->release();
+                // backing off gives a struggling server room
+                if (++segment->failures < MaximumRetries) {
+                    segment->state = Segment::Queued;
+                    segment->retryAt = m_loader->m_clock.elapsed() + (RetryDelay << (segment->failures - 1));
+                } else {
+                    segment->state = Segment::Failed;
+                }
+            }
+            m_session->changed.wakeAll();
+        }
+        if (isLoaded) {
+            fetch->timing.finished = m_loader->m_clock.elapsed();
+            m_loader->recordTiming(fetch->timing);
+        }
+        schedule();
+    }
+
+    void release(QNetworkReply *reply)
+    {
+        disconnect(reply, nullptr, this, nullptr);
+        reply->abort();
+        reply->deleteLater();
+    }
+
+    MpvSegmentLoader *m_loader;
+    std::shared_ptr<Session> m_session;
+    // the media playlist once a variant was chosen
+    QUrl m_playlistUrl;
+    QNetworkReply *m_playlistReply{nullptr};
+    QTimer m_refresh;
+    int m_playlistFailures{0};
+    // requests failed segments again once they backed off
+    QTimer m_retry;
+    QNetworkReply *m_sizeReply{nullptr};
+    bool m_hasSizeFailed{false};
+    // sequence number following the last queued segment, -1 before the first
+    qint64 m_nextSequence{-1};
+    // the init segment last queued
+    std::shared_ptr<Segment> m_init;
+    QHash<QNetworkReply *, std::shared_ptr<Fetch>> m_fetches;
+    int m_fileCount{0};
+};
+
+/**
+ * Reads of one player, on mpv's thread.
+ */
+class MpvSegmentLoader::Stream : public MpvStream
+{
+public:
+    Stream(MpvSegmentLoader *loader, std::shared_ptr<Session> session)
+        : m_loader(loader)
+        , m_session(std::move(session))
+    {
+    }
+
+    ~Stream() override
+    {
+        {
+            QMutexLocker locker(&m_loader->m_mutex);
+            auto it = m_loader->m_sessions.find(m_session->source);
+            if (it != m_loader->m_sessions.end() && it->lock() == m_session) {
+                m_loader->m_sessions.erase(it);
+            }
+        }
+        m_session->isCancelled = true;
+        QMetaObject::invokeMethod(
+            m_loader->m_context,
+            [session = m_session]() {
+                delete session->loader.data();
+            },
+            Qt::QueuedConnection);
+    }
+
+    bool open()
+    {
+        QMutexLocker locker(&m_session->mutex);
+        const QDeadlineTimer deadline(OpenTimeout);
+        while (!m_session->isReady && !m_session->hasFailed && !m_session->isCancelled) {
+            if (!m_session->changed.wait(&m_session->mutex, deadline)) {
+                break;
+            }
+        }
+        m_isSeekable = m_session->isVod;
+        return m_session->isReady && !m_session->hasFailed;
+    }
+
+    qint64 read(char *data, qint64 maxSize) override
+    {
+        while (true) {
+            std::shared_ptr<Segment> segment;
+            {
+                QMutexLocker locker(&m_session->mutex);
+                while (true) {
+                    if (m_session->isCancelled) {
+                        return -1;
+                    }
+                    if (m_session->readIndex < qsizetype(m_session->segments.size())) {
+                        segment = m_session->segments.at(m_session->readIndex);
+                        if (segment->state == Segment::Loaded) {
+                            break;
+                        }
+                        if (segment->state == Segment::Failed) {
+                            return -1;
+                        }
+                    } else if (m_session->isEnded) {
+                        return 0;
+                    } else if (m_session->hasFailed) {
+                        return -1;
+                    }
+                    m_session->changed.wait(&m_session->mutex);
+                }
+            }
+
+            // a loaded segment doesn't change any more
+            qint64 read = 0;
+            if (segment->fileName.isEmpty()) {
+                read = qMin(maxSize, segment->size - m_offset);
+                std::memcpy(data, segment->data.constData() + m_offset, read);
+            } else {
+                if (m_file.fileName() != segment->fileName) {
+                    m_file.close();
+                    m_file.setFileName(segment->fileName);
+                    if (!m_file.open(QIODevice::ReadOnly)) {
+                        return -1;
+                    }
+                }
+                if (!m_file.seek(m_offset) || (read = m_file.read(data, qMin(maxSize, segment->size - m_offset))) < 0) {
+                    return -1;
+                }
+            }
+            m_offset += read;
+
+            if (m_offset >= segment->size) {
+                // done with it, make room for the next ones
+                m_file.close();
+                {
+                    QMutexLocker locker(&m_session->mutex);
+                    segment->release();
+                    if (m_session->isVod) {
+                        // kept without its data, a seek back loads it again
+                        segment->failures = 0;
+                        ++m_session->readIndex;
+                    } else {
+                        m_session->segments.pop_front();
+                    }
+                }
+                m_offset = 0;
+                m_loader->schedule(m_session);
+            }
+            // an empty segment isn't the end of the stream
+            if (read > 0) {
+                return read;
+            }
+        }
+    }
+
+    bool seek(qint64 offset) override
+    {
+        if (!m_isSeekable || offset < 0) {
+            return false;
+        }
+        QMutexLocker locker(&m_session->mutex);
+        auto &segments = m_session->segments;
+        // the segments up to the one holding offset must have known sizes
+        qsizetype index = 0;
+        qint64 start = 0;
+        for (; index < qsizetype(segments.size()); ++index) {
+            const qint64 size = segments.at(index)->size;
+            if (size < 0) {
+                return false;
+            }
+            if (offset < start + size) {
+                break;
+            }
+            start += size;
+        }
+        if (offset > start) {
+            return false;
+        }
+        m_file.close();
+        // what isn't read soon from the new position gives its memory back
+        const int segmentsAhead = m_loader->segmentsAhead();
+        for (qsizetype i = 0; i < qsizetype(segments.size()); ++i) {
+            if (i < index || i > index + segmentsAhead) {
+                segments.at(i)->release();
+            }
+        }
+        m_session->readIndex = index;
+        m_offset = offset - start;
+        locker.unlock();
+        m_loader->schedule(m_session);
+        return true;
+    }
+
+    bool isSeekable() const override
+    {
+        return m_isSeekable;
+    }
+
+    qint64 size() override
+    {
+        if (!m_isSeekable) {
+            return -1;
+        }
+        QMutexLocker locker(&m_session->mutex);
+        qint64 size = 0;
+        for (const auto &segment : m_session->segments) {
+            if (segment->size < 0) {
+                return -1;
+            }
+            size += segment->size;
+        }
+        return size;
+    }
+
+    qint64 takeNetworkBytes() override
+    {
+        return m_session->networkBytes.exchange(0);
+    }
+
+    void cancel() override
+    {
+        m_session->isCancelled = true;
+        QMutexLocker locker(&m_session->mutex);
+        m_session->changed.wakeAll();
+    }
+
+private:
+    MpvSegmentLoader *m_loader;
+    std::shared_ptr<Session> m_session;
+    QFile m_file;
+    // read position within the segment being read
+    qint64 m_offset{0};
+    // VOD playlists, whose segments are all known
+    bool m_isSeekable{false};
+};
+
+MpvSegmentLoader *MpvSegmentLoader::instance()
+{
+    // never destroyed, players may still read while the application quits
+    static MpvSegmentLoader *loader = new MpvSegmentLoader();
+    return loader;
+}
+
+MpvSegmentLoader::MpvSegmentLoader()
+{
+    m_clock.start();
+
+    m_thread.setObjectName(QStringLiteral("mpvqt/segments"));
+    m_context = new QObject();
+    m_context->moveToThread(&m_thread);
+    m_thread.start();
+    QMetaObject::invokeMethod(
+        m_context,
+        [this]() {
+            m_network = new QNetworkAccessManager(m_context);
+        },
+        Qt::BlockingQueuedConnection);
+    if (auto app = QCoreApplication::instance()) {
+        QObject::connect(
+            app,
+            &QCoreApplication::aboutToQuit,
+            &m_thread,
+            [this]() {
+                m_thread.quit();
+                m_thread.wait();
+            },
+            Qt::DirectConnection);
+    }
+}
+
+bool MpvSegmentLoader::isEnabled() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_isEnabled;
+}
+
+void MpvSegmentLoader::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&m_mutex);
+    m_isEnabled = enabled;
+}
+
+int MpvSegmentLoader::concurrency() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_concurrency;
+}
+
+void MpvSegmentLoader::setConcurrency(int requests)
+{
+    QMutexLocker locker(&m_mutex);
+    m_concurrency = qMax(1, requests);
+}
+
+int MpvSegmentLoader::segmentsAhead() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_segmentsAhead;
+}
+
+void MpvSegmentLoader::setSegmentsAhead(int segments)
+{
+    QMutexLocker locker(&m_mutex);
+    m_segmentsAhead = qMax(1, segments);
+}
+
+MpvSegmentLoader::Storage MpvSegmentLoader::storage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_storage;
+}
+
+void MpvSegmentLoader::setStorage(Storage storage)
+{
+    QMutexLocker locker(&m_mutex);
+    m_storage = storage;
+}
+
+bool MpvSegmentLoader::isLoadable(const QUrl &source) const
+{
+    if (!isEnabled()) {
+        return false;
+    }
+    const QString scheme = source.scheme();
+    if (scheme != QStringLiteral("http") && scheme != QStringLiteral("https")) {
+        return false;
+    }
+    return QFileInfo(source.path()).suffix().toLower() == QStringLiteral("m3u8");
+}
+
+QList<MpvSegmentTiming> MpvSegmentLoader::timings() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_timings;
+}
+
+qint64 MpvSegmentLoader::throughput() const
+{
+    QMutexLocker locker(&m_mutex);
+    return recentThroughput({});
+}
+
+qint64 MpvSegmentLoader::throughput(const QUrl &source) const
+{
+    QMutexLocker locker(&m_mutex);
+    return recentThroughput(source);
+}
+
+qint64 MpvSegmentLoader::recentThroughput(const QUrl &source) const
+{
+    // segments fetched in parallel share the time they took together, the
+    // time nothing was fetched doesn't count
+    qint64 bytes = 0;
+    QList<std::pair<qint64, qint64>> intervals;
+    for (qsizetype i = m_timings.size() - 1; i >= 0 && intervals.size() < ThroughputSegments; --i) {
+        const auto &timing = m_timings.at(i);
+        if (source.isEmpty() || timing.source == source) {
+            bytes += timing.bytes;
+            intervals.append({timing.started, timing.finished});
+        }
+    }
+    if (intervals.isEmpty()) {
+        return 0;
+    }
+    std::sort(intervals.begin(), intervals.end());
+    qint64 busy = 0;
+    qint64 started = intervals.first().first;
+    qint64 finished = intervals.first().second;
+    for (const auto &[intervalStarted, intervalFinished] : std::as_const(intervals)) {
+        if (intervalStarted > finished) {
+            busy += finished - started;
+            started = intervalStarted;
+        }
+        finished = qMax(finished, intervalFinished);
+    }
+    busy += finished - started;
+    // fetches quicker than the clock's resolution
+    return bytes * 1000 / qMax<qint64>(1, busy);
+}
+
+QList<qint64> MpvSegmentLoader::variants(const QUrl &source) const
+{
+    const auto session = this->session(source);
+    QList<qint64> bandwidths;
+    if (session) {
+        QMutexLocker locker(&session->mutex);
+        if (session->isSwitchable) {
+            for (const auto &variant : std::as_const(session->variants)) {
+                bandwidths.append(variant.bandwidth);
+            }
+        }
+    }
+    return bandwidths;
+}
+
+qint64 MpvSegmentLoader::variant(const QUrl &source) const
+{
+    const auto session = this->session(source);
+    if (!session) {
+        return 0;
+    }
+    QMutexLocker locker(&session->mutex);
+    return session->variant >= 0 ? session->variants.at(session->variant).bandwidth : 0;
+}
+
+void MpvSegmentLoader::selectVariant(const QUrl &source, qint64 bandwidth)
+{
+    const auto session = this->session(source);
+    if (!session) {
+        return;
+    }
+    qsizetype index = -1;
+    {
+        QMutexLocker locker(&session->mutex);
+        for (qsizetype i = 0; i < session->variants.size(); ++i) {
+            if (session->variants.at(i).bandwidth == bandwidth) {
+                index = i;
+            }
+        }
+    }
+    if (index < 0) {
+        return;
+    }
+    QMetaObject::invokeMethod(
+        m_context,
+        [session, index]() {
+            if (session->loader) {
+                static_cast<Loader *>(session->loader.data())->selectVariant(index);
+            }
+        },
+        Qt::QueuedConnection);
+}
+
+std::shared_ptr<MpvSegmentLoader::Session> MpvSegmentLoader::session(const QUrl &source) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_sessions.value(source).lock();
+}
+
+std::unique_ptr<MpvStream> MpvSegmentLoader::open(const QUrl &source)
+{
+    auto session = std::make_shared<Session>();
+    session->source = source;
+    session->storage = storage();
+    if (session->storage == Disk) {
+        const QString directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + QStringLiteral("/mpvqt/segments");
+        QDir().mkpath(directory);
+        session->directory = std::make_unique<QTemporaryDir>(directory + QStringLiteral("/XXXXXX"));
+        if (!session->directory->isValid()) {
+            qCWarning(MpvQt_MpvSegmentLoader) << "could not create a directory in" << directory << "keeping segments in memory";
+            session->directory.reset();
+            session->storage = Memory;
+        }
+    }
+    QMetaObject::invokeMethod(
+        m_context,
+        [this, session]() {
+            if (!session->isCancelled) {
+                session->loader = new Loader(this, session);
+            }
+        },
+        Qt::QueuedConnection);
+
+    auto stream = std::make_unique<Stream>(this, session);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_sessions.insert(source, session);
+    }
+    if (!stream->open()) {
+        return nullptr;
+    }
+    return stream;
+}
+
+void MpvSegmentLoader::recordTiming(const MpvSegmentTiming &timing)
+{
+    qCDebug(MpvQt_MpvSegmentLoader) << "segment" << timing.sequence << timing.bytes << "bytes, first byte after" << timing.latency() << "ms,"
+                                    << timing.throughput() << "bytes/s";
+    QMutexLocker locker(&m_mutex);
+    m_timings.append(timing);
+    if (m_timings.size() > MaximumTimings) {
+        m_timings.removeFirst();
+    }
+}
+
+void MpvSegmentLoader::schedule(const std::shared_ptr<Session> &session)
+{
+    QMetaObject::invokeMethod(
+        m_context,
+        [session]() {
+            if (session->loader) {
+                static_cast<Loader *>(session->loader.data())->schedule();
+            }
+        },
+        Qt::QueuedConnection);
+}
+
+QString MpvSegmentLoaderProtocol::scheme() const
+{
+    return Scheme;
+}
+
+std::unique_ptr<MpvStream> MpvSegmentLoaderProtocol::open(const QUrl &source)
+{
+    return MpvSegmentLoader::instance()->open(source);
+}
@@ -0,0 +1,200 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVSEGMENTLOADER_H
+#define MPVSEGMENTLOADER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QUrl>
+
+#include <atomic>
+#include <memory>
+
+#include "mpvstreamprotocol.h"
+
+class QNetworkAccessManager;
+
+/**
+ * Timing of one fetched media segment.
+ */
+struct MpvSegmentTiming {
+    // the playlist the segment belongs to
+    QUrl source;
+    QUrl url;
+    qint64 sequence{0};
+    qint64 bytes{0};
+    // milliseconds since the loader started, from the request to its first byte and to its end
+    qint64 started{0};
+    qint64 firstByte{0};
+    qint64 finished{0};
+
+    qint64 latency() const
+    {
+        return firstByte - started;
+    }
+
+    /**
+     * Bytes per second of this segment alone.
+     */
+    qint64 throughput() const
+    {
+        return finished > started ? bytes * 1000 / (finished - started) : 0;
+    }
+};
+
+/**
+ * Loads the segments of HLS streams ahead of playback, several at a time.
+ *
+ * mpv fetches the segments of a playlist one after the other, so every segment
+ * pays the full round trip and links with a high latency are never filled.
+ * QMpv opens HLS sources through MpvSegmentLoaderProtocol instead: the loader
+ * fetches the playlist, keeps up to concurrency() segment requests running
+ * within the next segmentsAhead() segments, and serves the segments to mpv as
+ * one continuous stream (the init segment of fMP4 streams first). Loaded
+ * segments are held in memory or in temporary files until they are read.
+ *
+ * The highest variant of a master playlist is played until selectVariant()
+ * picks another one, which MpvAdaptiveBitrate does for the players it serves.
+ * Variants take over at segment boundaries, so only MPEG-TS variants switch:
+ * the init segment of fMP4 streams can't change within the stream. A segment
+ * is requested three times before it fails, waiting half a second before the
+ * second request and twice as long before the third.
+ *
+ * Live playlists are reloaded every target duration, start three segments
+ * from the live edge and can't seek: seeking is limited to mpv's demuxer
+ * cache. The stream of a VOD playlist seeks by byte offset into its segments
+ * laid end to end; the sizes of the segments not loaded yet are asked for
+ * with HEAD requests in the background, and seeking past a segment whose size
+ * is unknown fails. Encrypted playlists and variants with separate audio
+ * renditions can't be served; QMpv then lets mpv open the source itself.
+ *
+ * Disabled by default. Requests run on a dedicated thread. Thread-safe.
+ */
+class MpvSegmentLoader
+{
+public:
+    enum Storage {
+        Memory,
+        Disk
+    };
+
+    static MpvSegmentLoader *instance();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    /**
+     * Segment requests running at once, per stream. Defaults to 4.
+     */
+    int concurrency() const;
+    void setConcurrency(int requests);
+
+    /**
+     * Segments loaded or loading ahead of the one being read, per stream. Defaults to 8.
+     */
+    int segmentsAhead() const;
+    void setSegmentsAhead(int segments);
+
+    /**
+     * Where loaded segments wait to be read, applies to the streams opened from now on.
+     * Defaults to Memory.
+     */
+    Storage storage() const;
+    void setStorage(Storage storage);
+
+    /**
+     * Whether @p source is opened through the loader: HLS playlists over HTTP(S).
+     */
+    bool isLoadable(const QUrl &source) const;
+
+    /**
+     * The most recently fetched segments of all streams, oldest first.
+     */
+    QList<MpvSegmentTiming> timings() const;
+
+    /**
+     * Bytes per second fetched over the recent segments, over the time any of
+     * them was being fetched. 0 before the first segment.
+     */
+    qint64 throughput() const;
+
+    /**
+     * throughput() of the recent segments of the stream of @p source alone.
+     */
+    qint64 throughput(const QUrl &source) const;
+
+    /**
+     * Bandwidths in bits per second of the variants the stream of @p source
+     * can switch between, increasing. Empty if it can't switch, or isn't open.
+     * When several players open the same source, the last one opened is meant.
+     */
+    QList<qint64> variants(const QUrl &source) const;
+
+    /**
+     * Bandwidth of the variant the stream of @p source loads, 0 without a master playlist.
+     */
+    qint64 variant(const QUrl &source) const;
+
+    /**
+     * Load the segments of the stream of @p source from the variant with
+     * @p bandwidth, starting with the first segment not loading yet.
+     */
+    void selectVariant(const QUrl &source, qint64 bandwidth);
+
+    // segments whose timing is kept
+    static constexpr int MaximumTimings = 256;
+
+private:
+    friend class MpvSegmentLoaderProtocol;
+    struct Segment;
+    struct Variant;
+    struct Session;
+    class Loader;
+    class Stream;
+
+    MpvSegmentLoader();
+    std::unique_ptr<MpvStream> open(const QUrl &source);
+    void recordTiming(const MpvSegmentTiming &timing);
+    std::shared_ptr<Session> session(const QUrl &source) const;
+    // with m_mutex held, over the last ThroughputSegments timings of source, or of all
+    qint64 recentThroughput(const QUrl &source) const;
+
+    // from any thread, runs on the network thread
+    void schedule(const std::shared_ptr<Session> &session);
+
+    mutable QMutex m_mutex;
+    bool m_isEnabled{false};
+    int m_concurrency{4};
+    int m_segmentsAhead{8};
+    Storage m_storage{Memory};
+    QList<MpvSegmentTiming> m_timings;
+    // the stream last opened per source
+    QHash<QUrl, std::weak_ptr<Session>> m_sessions;
+    QElapsedTimer m_clock;
+
+    QThread m_thread;
+    // both live on m_thread
+    QObject *m_context{nullptr};
+    QNetworkAccessManager *m_network{nullptr};
+};
+
+/**
+ * Serves HLS sources through MpvSegmentLoader.
+ */
+class MpvSegmentLoaderProtocol : public MpvStreamProtocol
+{
+public:
+    static inline const QString Scheme = QStringLiteral("mpvqt-hls");
+
+    QString scheme() const override;
+    std::unique_ptr<MpvStream> open(const QUrl &source) override;
+};
+
+#endif // MPVSEGMENTLOADER_H
@@ -0,0 +1,173 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvstreamprotocol.h"
+#include "mpvfragmentindex.h"
+#include "mpvhttpcache.h"
+#include "mpvmappedfileprotocol.h"
+#include "mpvratelimiter.h"
+#include "mpvresourceprotocol.h"
+#include "mpvsegmentloader.h"
+
+#include <QHash>
+#include <QLoggingCategory>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <mpv/stream_cb.h>
+
+#include <atomic>
+#include <vector>
+
+Q_LOGGING_CATEGORY(MpvQt_MpvStreamProtocol, "MpvQt.MpvStreamProtocol")
+
+namespace
+{
+struct Registry {
+    Registry()
+    {
+        // MpvQt's own protocols
+        const std::shared_ptr<MpvStreamProtocol> builtins[] = {
+            std::make_shared<MpvFragmentIndexProtocol>(),
+            std::make_shared<MpvHttpCacheProtocol>(),
+            std::make_shared<MpvResourceProtocol>(),
+            std::make_shared<MpvDeviceProtocol>(),
+            std::make_shared<MpvMappedFileProtocol>(),
+            std::make_shared<MpvSegmentLoaderProtocol>(),
+        };
+        for (const auto &protocol : builtins) {
+            protocols.insert(protocol->scheme(), protocol);
+        }
+    }
+
+    QMutex mutex;
+    // never shrinks, players keep using the protocols installed on them
+    QHash<QString, std::shared_ptr<MpvStreamProtocol>> protocols;
+};
+
+Registry &registry()
+{
+    static Registry registry;
+    return registry;
+}
+
+// a protocol installed on one player
+struct Installation {
+    std::shared_ptr<MpvStreamProtocol> protocol;
+    std::shared_ptr<MpvRateLimiter> limiter;
+};
+
+struct OpenStream {
+    std::unique_ptr<MpvStream> stream;
+    std::shared_ptr<MpvRateLimiter> limiter;
+    std::atomic<bool> isCancelled{false};
+};
+
+int64_t readStream(void *cookie, char *buf, uint64_t nbytes)
+{
+    auto open = static_cast<OpenStream *>(cookie);
+    const qint64 read = open->stream->read(buf, qint64(nbytes));
+    // holding back the reads holds back the fetches running ahead of them
+    const qint64 fetched = open->stream->takeNetworkBytes();
+    if (fetched > 0) {
+        open->limiter->consume(fetched, open->isCancelled);
+    }
+    return read;
+}
+
+int64_t seekStream(void *cookie, int64_t offset)
+{
+    return static_cast<OpenStream *>(cookie)->stream->seek(offset) ? offset : MPV_ERROR_GENERIC;
+}
+
+int64_t streamSize(void *cookie)
+{
+    const qint64 size = static_cast<OpenStream *>(cookie)->stream->size();
+    return size >= 0 ? size : MPV_ERROR_UNSUPPORTED;
+}
+
+void closeStream(void *cookie)
+{
+    delete static_cast<OpenStream *>(cookie);
+}
+
+void cancelStream(void *cookie)
+{
+    auto open = static_cast<OpenStream *>(cookie);
+    open->isCancelled = true;
+    open->stream->cancel();
+    open->limiter->wake();
+}
+
+int openStream(void *userData, char *uri, mpv_stream_cb_info *info)
+{
+    auto installation = static_cast<Installation *>(userData);
+    const auto &protocol = installation->protocol;
+    const QUrl source = MpvStreamProtocol::source(QString::fromUtf8(uri));
+    auto stream = protocol->open(source);
+    if (!stream) {
+        qCDebug(MpvQt_MpvStreamProtocol) << protocol->scheme() << "could not open" << source;
+        return MPV_ERROR_LOADING_FAILED;
+    }
+    info->seek_fn = stream->isSeekable() ? seekStream : nullptr;
+    auto open = new OpenStream;
+    open->stream = std::move(stream);
+    open->limiter = installation->limiter;
+    info->cookie = open;
+    info->read_fn = readStream;
+    info->size_fn = streamSize;
+    info->close_fn = closeStream;
+    info->cancel_fn = cancelStream;
+    return 0;
+}
+}
+
+void MpvStreamProtocol::registerProtocol(std::shared_ptr<MpvStreamProtocol> protocol)
+{
+    QMutexLocker locker(&registry().mutex);
+    const QString scheme = protocol->scheme();
+    if (registry().protocols.contains(scheme)) {
+        qCWarning(MpvQt_MpvStreamProtocol) << "protocol" << scheme << "is already registered";
+        return;
+    }
+    registry().protocols.insert(scheme, std::move(protocol));
+}
+
+bool MpvStreamProtocol::isRegistered(const QString &scheme)
+{
+    QMutexLocker locker(&registry().mutex);
+    return registry().protocols.contains(scheme);
+}
+
+std::shared_ptr<void> MpvStreamProtocol::install(mpv_handle *mpv, std::shared_ptr<MpvRateLimiter> limiter)
+{
+    auto installations = std::make_shared<std::vector<std::unique_ptr<Installation>>>();
+    QMutexLocker locker(&registry().mutex);
+    for (auto it = registry().protocols.constBegin(); it != registry().protocols.constEnd(); ++it) {
+        auto installation = std::make_unique<Installation>(Installation{it.value(), limiter});
+        const int err = mpv_stream_cb_add_ro(mpv, it.key().toUtf8().constData(), installation.get(), openStream);
+        if (err < 0) {
+            qCWarning(MpvQt_MpvStreamProtocol) << "could not install protocol" << it.key() << mpv_error_string(err);
+            continue;
+        }
+        installations->push_back(std::move(installation));
+    }
+    return installations;
+}
+
+QString MpvStreamProtocol::url(const QString &scheme, const QUrl &source)
+{
+    return scheme + QStringLiteral("://") + source.toString(QUrl::FullyEncoded);
+}
+
+QUrl MpvStreamProtocol::source(const QString &url)
+{
+    const qsizetype separator = url.indexOf(QStringLiteral("://"));
+    if (separator > 0 && isRegistered(url.left(separator))) {
+        return QUrl(url.mid(separator + 3));
+    }
+    return QUrl(url);
+}
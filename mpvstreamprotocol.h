@@ -0,0 +1,128 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVSTREAMPROTOCOL_H
+#define MPVSTREAMPROTOCOL_H
+
+#include <QString>
+#include <QUrl>
+
+#include <memory>
+
+#include <mpv/client.h>
+
+class MpvRateLimiter;
+
+/**
+ * A stream opened by an MpvStreamProtocol.
+ *
+ * All functions except cancel() are called on the mpv thread reading the
+ * stream, usually the demuxer thread; cancel() may come from any thread.
+ */
+class MpvStream
+{
+public:
+    virtual ~MpvStream() = default;
+
+    /**
+     * Read up to @p maxSize bytes into @p data, blocking until some are available.
+     * @return the number of bytes read, 0 at the end of the stream, -1 on error
+     */
+    virtual qint64 read(char *data, qint64 maxSize) = 0;
+
+    /**
+     * Move to the absolute position @p offset.
+     * @return whether the position changed, streams that can't seek return false
+     */
+    virtual bool seek(qint64 offset) = 0;
+
+    /**
+     * Whether seek() can work at all; mpv only seeks within what it buffered of
+     * streams that can't.
+     */
+    virtual bool isSeekable() const
+    {
+        return true;
+    }
+
+    /**
+     * Total size in bytes, -1 if unknown.
+     */
+    virtual qint64 size()
+    {
+        return -1;
+    }
+
+    /**
+     * Bytes fetched from the network for this stream since the last call.
+     * The player's rate limiter applies to these only, reads of local data
+     * or of data cached before aren't throttled.
+     */
+    virtual qint64 takeNetworkBytes()
+    {
+        return 0;
+    }
+
+    /**
+     * Make a blocked read() return, the stream is closed afterwards.
+     */
+    virtual void cancel()
+    {
+    }
+};
+
+/**
+ * A custom protocol served to mpv through its stream callback API.
+ *
+ * Protocols are process-wide and installed on every player when it is
+ * initialized, so they must be registered before the first player is created.
+ * A protocol wraps other sources: mpv opens "<scheme>://<source url>", see
+ * url() and source().
+ */
+class MpvStreamProtocol
+{
+public:
+    virtual ~MpvStreamProtocol() = default;
+
+    /**
+     * The protocol's scheme, e.g. "mpvqt-fragidx".
+     */
+    virtual QString scheme() const = 0;
+
+    /**
+     * Open @p source, called on mpv's thread that opens the file.
+     * @return the stream, nullptr if it can't be opened
+     */
+    virtual std::unique_ptr<MpvStream> open(const QUrl &source) = 0;
+
+    /**
+     * Make @p protocol available to the players initialized from now on.
+     * Thread-safe. A scheme can only be registered once.
+     */
+    static void registerProtocol(std::shared_ptr<MpvStreamProtocol> protocol);
+
+    static bool isRegistered(const QString &scheme);
+
+    /**
+     * Install the registered protocols on @p mpv, see MpvController::init().
+     * The reads of the streams opened on it are throttled by @p limiter.
+     * @return state used by mpv's calls into the protocols, to keep alive until
+     *         @p mpv is destroyed
+     */
+    static std::shared_ptr<void> install(mpv_handle *mpv, std::shared_ptr<MpvRateLimiter> limiter);
+
+    /**
+     * The url opening @p source through the protocol with @p scheme.
+     */
+    static QString url(const QString &scheme, const QUrl &source);
+
+    /**
+     * The source wrapped in @p url by a registered protocol, or @p url itself.
+     */
+    static QUrl source(const QString &url);
+};
+
+#endif // MPVSTREAMPROTOCOL_H
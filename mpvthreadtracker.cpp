@@ -0,0 +1,211 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvthreadtracker.h"
+
+#include <QDir>
+#include <QFile>
+#include <QLoggingCategory>
+#include <QMutexLocker>
+
+#ifdef Q_OS_LINUX
+#include <cerrno>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+Q_LOGGING_CATEGORY(MpvQt_MpvThreadTracker, "MpvQt.MpvThreadTracker")
+
+MpvThreadTracker *MpvThreadTracker::instance()
+{
+    static MpvThreadTracker tracker;
+    return &tracker;
+}
+
+MpvThreadTracker::MpvThreadTracker()
+{
+    // the threads existing before the first player are nobody's
+    const auto live = scan();
+    for (auto it = live.constBegin(); it != live.constEnd(); ++it) {
+        m_threads.insert(it.key(), {nullptr, it.value().startTime, {}});
+    }
+}
+
+QHash<qint64, MpvThreadTracker::ThreadInfo> MpvThreadTracker::scan()
+{
+    QHash<qint64, ThreadInfo> threads;
+#ifdef Q_OS_LINUX
+    const auto tids = QDir(QStringLiteral("/proc/self/task")).entryList(QDir::Dirs | QDir::NoDotAndDotDot);
+    for (const auto &tid : tids) {
+        QFile stat(QStringLiteral("/proc/self/task/%1/stat").arg(tid));
+        QFile comm(QStringLiteral("/proc/self/task/%1/comm").arg(tid));
+        // the thread may have exited in the meantime
+        if (!stat.open(QIODevice::ReadOnly) || !comm.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+        // the name in parentheses may contain spaces, the fields after it don't;
+        // utime and stime are the 14th and 15th field, the start time the 22nd;
+        // the fields after the name start with the 3rd
+        const QByteArray line = stat.readAll();
+        const auto fields = line.mid(line.lastIndexOf(')') + 2).split(' ');
+        if (fields.size() < 20) {
+            continue;
+        }
+        ThreadInfo info;
+        info.cpuTicks = fields.at(11).toULongLong() + fields.at(12).toULongLong();
+        info.startTime = fields.at(19).toULongLong();
+        info.name = comm.readAll().trimmed();
+        threads.insert(tid.toLongLong(), info);
+    }
+#endif
+    return threads;
+}
+
+void MpvThreadTracker::prune(const QHash<qint64, ThreadInfo> &live)
+{
+    for (auto it = m_threads.begin(); it != m_threads.end();) {
+        auto liveThread = live.constFind(it.key());
+        if (liveThread == live.constEnd() || liveThread->startTime != it->startTime) {
+            it = m_threads.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+QList<qint64> MpvThreadTracker::attributeNewThreads(Owner owner)
+{
+    const auto live = scan();
+
+    QList<qint64> attributed;
+    QMutexLocker locker(&m_mutex);
+    prune(live);
+    for (auto it = live.constBegin(); it != live.constEnd(); ++it) {
+        if (m_threads.contains(it.key())) {
+            continue;
+        }
+        // threads inherit the name of their creator, so anything mpv or ffmpeg
+        // started carries one of their names
+        const QByteArray &name = it.value().name;
+        const bool isMpvThread = name.startsWith("mpv") || name.startsWith("av:");
+        m_threads.insert(it.key(), {isMpvThread ? owner : nullptr, it.value().startTime, roleOf(name)});
+        if (isMpvThread) {
+            attributed.append(it.key());
+        }
+    }
+    if (!attributed.isEmpty()) {
+        qCDebug(MpvQt_MpvThreadTracker) << owner << "started threads" << attributed;
+    }
+    return attributed;
+}
+
+void MpvThreadTracker::addThread(Owner owner, qint64 tid)
+{
+    if (tid < 0) {
+        return;
+    }
+    const auto live = scan();
+    QMutexLocker locker(&m_mutex);
+    m_threads.insert(tid, {owner, live.value(tid).startTime, QByteArrayLiteral("worker")});
+}
+
+QByteArray MpvThreadTracker::roleOf(const QByteArray &name)
+{
+    if (name.startsWith("av:")) {
+        return QByteArrayLiteral("decoder");
+    }
+    if (name.startsWith("mpv/")) {
+        return name.mid(4);
+    }
+    return name;
+}
+
+QList<MpvThreadTracker::ThreadUsage> MpvThreadTracker::sampleCpuTime()
+{
+    QList<ThreadUsage> usage;
+#ifdef Q_OS_LINUX
+    static const qint64 ticksPerSecond = ::sysconf(_SC_CLK_TCK);
+    const auto live = scan();
+
+    QMutexLocker locker(&m_mutex);
+    for (auto it = live.constBegin(); it != live.constEnd(); ++it) {
+        auto thread = m_threads.constFind(it.key());
+        if (thread == m_threads.constEnd() || !thread->owner || thread->startTime != it.value().startTime) {
+            continue;
+        }
+        ThreadUsage threadUsage;
+        threadUsage.tid = it.key();
+        threadUsage.owner = thread->owner;
+        threadUsage.role = thread->role;
+        threadUsage.cpuTime = static_cast<qint64>(it.value().cpuTicks) * 1000 / ticksPerSecond;
+        usage.append(threadUsage);
+    }
+#endif
+    return usage;
+}
+
+QList<qint64> MpvThreadTracker::threads(Owner owner)
+{
+    QList<qint64> threads;
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_threads.constBegin(); it != m_threads.constEnd(); ++it) {
+        if (it->owner == owner) {
+            threads.append(it.key());
+        }
+    }
+    return threads;
+}
+
+void MpvThreadTracker::forget(Owner owner)
+{
+    QMutexLocker locker(&m_mutex);
+    for (auto &thread : m_threads) {
+        if (thread.owner == owner) {
+            // keep the entry so a late scan doesn't attribute the thread to another player
+            thread.owner = nullptr;
+        }
+    }
+}
+
+qint64 MpvThreadTracker::currentThreadId()
+{
+#ifdef Q_OS_LINUX
+    return static_cast<qint64>(::syscall(SYS_gettid));
+#else
+    return -1;
+#endif
+}
+
+void MpvThreadTracker::applyScheduling(const MpvSchedulingParameters &parameters, const QList<qint64> &tids)
+{
+#ifdef Q_OS_LINUX
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (parameters.cpus.isEmpty()) {
+        // back to whatever the process as a whole may use
+        sched_getaffinity(::getpid(), sizeof(cpus), &cpus);
+    } else {
+        for (int cpu : parameters.cpus) {
+            CPU_SET(cpu, &cpus);
+        }
+    }
+
+    for (qint64 tid : tids) {
+        // on Linux the nice value is per thread
+        if (::setpriority(PRIO_PROCESS, static_cast<id_t>(tid), parameters.niceValue) < 0) {
+            qCDebug(MpvQt_MpvThreadTracker) << "could not set nice value" << parameters.niceValue << "of thread" << tid << qt_error_string(errno);
+        }
+        if (::sched_setaffinity(static_cast<pid_t>(tid), sizeof(cpus), &cpus) < 0) {
+            qCDebug(MpvQt_MpvThreadTracker) << "could not set affinity of thread" << tid << qt_error_string(errno);
+        }
+    }
+#else
+    Q_UNUSED(parameters)
+    Q_UNUSED(tids)
+#endif
+}
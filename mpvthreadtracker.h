@@ -0,0 +1,122 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVTHREADTRACKER_H
+#define MPVTHREADTRACKER_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+/**
+ * How the threads of a player are scheduled, see MpvAbstractItem::SchedulingPolicy.
+ */
+struct MpvSchedulingParameters {
+    // priority of the player's worker QThread, not used for players on the shared MpvWorkerPool
+    QThread::Priority threadPriority{QThread::InheritPriority};
+    // vd-lavc-threads, 0 lets ffmpeg pick one thread per core
+    int decoderThreads{0};
+    // Linux nice value of the player's threads. Lowering it again, e.g. when a
+    // background player becomes the focused one, needs CAP_SYS_NICE or a
+    // matching RLIMIT_NICE, so it is left at 0 by default.
+    int niceValue{0};
+    // Linux CPU affinity of the player's threads, empty for all CPUs the process may use
+    QList<int> cpus;
+};
+
+/**
+ * Finds out which threads of the process belong to which player (Linux only).
+ *
+ * libmpv doesn't tell which threads it starts, so the tracker scans
+ * /proc/self/task when a player is likely to have started some (after
+ * mpv_initialize, when a file is loaded, when the video is reconfigured) and
+ * attributes the threads that appeared since the previous scan to that player.
+ * Only threads named by mpv ("mpv/...") or ffmpeg ("av:...") are considered,
+ * threads inherit the name of the thread creating them. This is a heuristic:
+ * players loading files at the very same moment may get each other's threads.
+ *
+ * The attribution also serves per-player CPU accounting, see MpvCpuMonitor.
+ *
+ * Thread-safe.
+ */
+class MpvThreadTracker
+{
+public:
+    using Owner = const void *;
+
+    static MpvThreadTracker *instance();
+
+    /**
+     * Attribute the mpv threads started since the previous scan to @p owner.
+     * @return the newly attributed thread ids
+     */
+    QList<qint64> attributeNewThreads(Owner owner);
+
+    /**
+     * Attribute a known thread, such as the player's worker thread.
+     */
+    void addThread(Owner owner, qint64 tid);
+
+    /**
+     * The live threads of @p owner.
+     */
+    QList<qint64> threads(Owner owner);
+
+    void forget(Owner owner);
+
+    struct ThreadUsage {
+        qint64 tid{-1};
+        Owner owner{nullptr};
+        // what the thread does: "worker", "decoder" for ffmpeg's threads,
+        // otherwise mpv's name without the "mpv/" prefix ("demux", "vo", "ao"...)
+        QByteArray role;
+        // user and system time, in milliseconds
+        qint64 cpuTime{0};
+    };
+
+    /**
+     * CPU time used so far by each live thread attributed to a player.
+     */
+    QList<ThreadUsage> sampleCpuTime();
+
+    /**
+     * Kernel id of the calling thread, -1 where unsupported.
+     */
+    static qint64 currentThreadId();
+
+    /**
+     * Apply the nice value and CPU affinity of @p parameters to @p tids.
+     */
+    static void applyScheduling(const MpvSchedulingParameters &parameters, const QList<qint64> &tids);
+
+private:
+    MpvThreadTracker();
+
+    struct ThreadInfo {
+        // to notice reused thread ids
+        quint64 startTime{0};
+        QByteArray name;
+        // user plus system time in clock ticks
+        quint64 cpuTicks{0};
+    };
+    static QHash<qint64, ThreadInfo> scan();
+    void prune(const QHash<qint64, ThreadInfo> &live);
+
+    static QByteArray roleOf(const QByteArray &name);
+
+    struct Thread {
+        Owner owner{nullptr};
+        quint64 startTime{0};
+        QByteArray role;
+    };
+
+    QMutex m_mutex;
+    QHash<qint64, Thread> m_threads;
+};
+
+#endif // MPVTHREADTRACKER_H
@@ -0,0 +1,99 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#include "mpvworkerpool.h"
+
+#include <QMutexLocker>
+#include <QThread>
+
+MpvStrand::MpvStrand(MpvWorkerPool *pool)
+    : m_pool(pool)
+{
+}
+
+void MpvStrand::post(std::function<void()> task)
+{
+    {
+        QMutexLocker locker(&m_mutex);
+        m_tasks.push_back(std::move(task));
+        if (m_isScheduled) {
+            return;
+        }
+        m_isScheduled = true;
+    }
+    m_pool->m_threadPool.start([self = shared_from_this()]() {
+        self->run();
+    });
+}
+
+bool MpvStrand::isCurrent() const
+{
+    return m_runningThread.load() == QThread::currentThreadId();
+}
+
+void MpvStrand::run()
+{
+    m_runningThread = QThread::currentThreadId();
+    for (int i = 0; i < MaximumBatch; ++i) {
+        std::function<void()> task;
+        {
+            QMutexLocker locker(&m_mutex);
+            if (m_tasks.empty()) {
+                m_runningThread = nullptr;
+                m_isScheduled = false;
+                return;
+            }
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+    m_runningThread = nullptr;
+
+    // still busy, go to the back of the pool's queue so other players get a turn
+    m_pool->m_threadPool.start([self = shared_from_this()]() {
+        self->run();
+    });
+}
+
+MpvWorkerPool *MpvWorkerPool::instance()
+{
+    static MpvWorkerPool pool;
+    return &pool;
+}
+
+MpvWorkerPool::MpvWorkerPool()
+{
+    m_threadPool.setObjectName(QStringLiteral("MpvWorkerPool"));
+    m_threadPool.setMaxThreadCount(QThread::idealThreadCount());
+    // players are often idle for a while, keep the workers around
+    m_threadPool.setExpiryTimeout(-1);
+}
+
+bool MpvWorkerPool::isEnabled() const
+{
+    return m_isEnabled;
+}
+
+void MpvWorkerPool::setEnabled(bool enabled)
+{
+    m_isEnabled = enabled;
+}
+
+int MpvWorkerPool::maximumThreadCount() const
+{
+    return m_threadPool.maxThreadCount();
+}
+
+void MpvWorkerPool::setMaximumThreadCount(int count)
+{
+    m_threadPool.setMaxThreadCount(count > 0 ? count : QThread::idealThreadCount());
+}
+
+std::shared_ptr<MpvStrand> MpvWorkerPool::createStrand()
+{
+    return std::make_shared<MpvStrand>(this);
+}
@@ -0,0 +1,102 @@
+/*
+ * SPDX-FileCopyrightText: 2023 George Florea Bănuș <georgefb899@gmail.com>
+ *
+ * SPDX-License-Identifier: LGPL-2.1-only OR LGPL-3.0-only OR LicenseRef-KDE-Accepted-LGPL
+ */
+
+#ifndef MPVWORKERPOOL_H
+#define MPVWORKERPOOL_H
+
+#include <QMutex>
+#include <QThreadPool>
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+
+class MpvWorkerPool;
+
+/**
+ * Serial executor running on the shared MpvWorkerPool.
+ *
+ * Tasks posted to a strand run one at a time and in the order they were posted,
+ * but not on a fixed thread. Each MpvController gets its own strand, so it sees
+ * all of its calls in order while a slow call only occupies the worker it runs
+ * on; the other strands keep being scheduled on the remaining workers.
+ */
+class MpvStrand : public std::enable_shared_from_this<MpvStrand>
+{
+public:
+    explicit MpvStrand(MpvWorkerPool *pool);
+
+    void post(std::function<void()> task);
+
+    /**
+     * @return true when called from a task running on this strand
+     */
+    bool isCurrent() const;
+
+private:
+    void run();
+
+    // tasks run per turn before the worker is handed to the next strand
+    static constexpr int MaximumBatch = 16;
+
+    MpvWorkerPool *m_pool;
+    QMutex m_mutex;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_isScheduled{false};
+    std::atomic<Qt::HANDLE> m_runningThread{nullptr};
+};
+
+/**
+ * Process-wide pool of worker threads shared by the MpvController instances,
+ * as an alternative to one QThread per player.
+ *
+ * Disabled by default. When enabled, players created afterwards by
+ * MpvControllerPool are multiplexed onto the pool, which is sized to the
+ * number of cores.
+ */
+class MpvWorkerPool
+{
+public:
+    static MpvWorkerPool *instance();
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+
+    int maximumThreadCount() const;
+    void setMaximumThreadCount(int count);
+
+    std::shared_ptr<MpvStrand> createStrand();
+
+    /**
+     * Run @p call, which may block for a while (mpv_initialize parsing the
+     * config, any synchronous libmpv call waiting on a core busy opening a
+     * file...), without holding up the other strands: the pool may start an
+     * extra worker while it runs. MpvController makes every such call through this.
+     */
+    template<typename Func>
+    static void blockingCall(Func &&call)
+    {
+        auto pool = instance();
+        const bool onWorker = pool->m_threadPool.contains(QThread::currentThread());
+        if (onWorker) {
+            pool->m_threadPool.releaseThread();
+        }
+        call();
+        if (onWorker) {
+            pool->m_threadPool.reserveThread();
+        }
+    }
+
+private:
+    friend class MpvStrand;
+    MpvWorkerPool();
+
+    QThreadPool m_threadPool;
+    std::atomic<bool> m_isEnabled{false};
+};
+
+#endif // MPVWORKERPOOL_H
@@ -5,19 +5,32 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "qmpv.h"
+#include "mpvhttpcache.h"
+#include "mpvmappedfileprotocol.h"
+#include "mpvprobe.h"
+#include "mpvresourceprotocol.h"
+#include "mpvsegmentloader.h"
 
 #include <MpvController>
+#include <QCoreApplication>
 #include <QOpenGLContext>
 #include <QOpenGLFramebufferObject>
+#include <QPointer>
 #include <QQuickWindow>
 #include <QStandardPaths>
 #include <QDir>
 #include <QDebug>
+#include <QLoggingCategory>
+
+#include <algorithm>
+
+Q_LOGGING_CATEGORY(MpvQt_QMpv, "MpvQt.QMpv")
+
 QMpv::QMpv(QQuickItem * parent)
     : MpvAbstractItem(parent)
 {
 #ifdef Q_OS_ANDROID
-    setProperty(QStringLiteral("vo"), "opengl-cb");
+    setOption(QStringLiteral("vo"), "opengl-cb");
 #endif
 #ifdef Q_OS_LINUX
     // Force embedded rendering on Linux
@@ -32,14 +45,16 @@ QMpv::QMpv(QQuickItem * parent)
     qDebug()<<"Filessss :"<<watchLaterDir;
     //setProperty(QStringLiteral("watch-later-directory"), watchLaterLocation);
 
-    setProperty(QStringLiteral("terminal"), QStringLiteral("yes"));
-    setProperty(QStringLiteral("save-position-on-quit"), QStringLiteral("yes"));
-    setProperty(QStringLiteral("keep-open"), QStringLiteral("always"));
-    setProperty(QStringLiteral("cache"), QStringLiteral("yes"));
-    setProperty(QStringLiteral("cache-secs"), 2); // pre-buffer 2s before playback
-    setProperty(QStringLiteral("demuxer-max-bytes"), 50000000);      // 50MB forward cache
-    setProperty(QStringLiteral("demuxer-max-back-bytes"), 5000000); // 5MB back-seek cache
-    setProperty(QStringLiteral("force-seekable"), QStringLiteral("yes"));
+    // staged and applied before mpv_initialize, options set from QML are merged in
+    setOption(QStringLiteral("terminal"), QStringLiteral("yes"));
+    setOption(QStringLiteral("save-position-on-quit"), QStringLiteral("yes"));
+    setOption(QStringLiteral("keep-open"), QStringLiteral("always"));
+    setOption(QStringLiteral("cache"), QStringLiteral("yes"));
+    setOption(QStringLiteral("cache-secs"), 2); // pre-buffer 2s before playback
+    // initial cache sizes, MpvCacheBudget adjusts them once the player is running
+    setDefaultOption(QStringLiteral("demuxer-max-bytes"), 50000000);      // 50MB forward cache
+    setDefaultOption(QStringLiteral("demuxer-max-back-bytes"), 5000000); // 5MB back-seek cache
+    setOption(QStringLiteral("force-seekable"), QStringLiteral("yes"));
 
     observeProperty(QStringLiteral("duration"), MPV_FORMAT_DOUBLE);
     observeProperty(QStringLiteral("time-pos"), MPV_FORMAT_DOUBLE);
@@ -51,20 +66,84 @@ QMpv::QMpv(QQuickItem * parent)
     observeProperty(QStringLiteral("speed"), MPV_FORMAT_DOUBLE);
     observeProperty(QStringLiteral("volume"), MPV_FORMAT_DOUBLE);
     observeProperty(QStringLiteral("video-aspect"), MPV_FORMAT_DOUBLE);
-    connect(mpvController(), &MpvController::propertyChanged, this,
-            &QMpv::onPropertyChanged, Qt::QueuedConnection);
-}
-void QMpv::resetRenderer() {
-    // Clear the current video
-    Q_EMIT command(QStringList() << QStringLiteral("stop"));
-
-    // Force libmpv as the video output to ensure embedded rendering
-    setProperty(QStringLiteral("vo"), QStringLiteral("libmpv"));
+    connect(this, &MpvAbstractItem::propertyChanged, this, &QMpv::onPropertyChanged);
+    // ready() is emitted from the render thread, so this is a queued connection
+    connect(this, &MpvAbstractItem::ready, this, &QMpv::loadPendingSource);
+
+    // fast start: check that the small probe found everything, widen it otherwise
+    connect(this, &MpvAbstractItem::fileLoaded, this, [this]() {
+        m_isFileLoaded = true;
+        if (!m_isProbing && !m_isRecordingProbe) {
+            return;
+        }
+        m_openTime = m_openTimer.elapsed();
+        getPropertyAsync(QStringLiteral("track-list"), ProbeReplyId);
+        if (m_isRecordingProbe) {
+            getPropertyAsync(QStringLiteral("file-format"), ProbeReplyId + 1);
+            getPropertyAsync(QStringLiteral("duration"), ProbeReplyId + 2);
+            getPropertyAsync(QStringLiteral("file-size"), ProbeReplyId + 3);
+        }
+    });
+    connect(this, &MpvAbstractItem::asyncReply, this, &QMpv::onProbeReply);
+    // playback restart isn't relayed as a signal, subscribe to it on each new player
+    connect(this, &MpvAbstractItem::initialized, this, [this]() {
+        QPointer<QMpv> item = this;
+        mpvController()->subscribeEvents([item](const MpvNotification &notification) {
+            if (notification.event != MPV_EVENT_PLAYBACK_RESTART) {
+                return;
+            }
+            QMetaObject::invokeMethod(
+                QCoreApplication::instance(),
+                [item]() {
+                    if (item) {
+                        item->onPlaybackRestart();
+                    }
+                },
+                Qt::QueuedConnection);
+        });
+    });
+    connect(this, &MpvAbstractItem::endFile, this, [this](const QString &reason) {
+        const bool isProxied = m_loadUrl.startsWith(MpvHttpCacheProtocol::Scheme + QStringLiteral("://"))
+            || m_loadUrl.startsWith(MpvSegmentLoaderProtocol::Scheme + QStringLiteral("://"));
+        if (reason == QStringLiteral("error") && !m_isFileLoaded && isProxied) {
+            // no range requests, no size, changed on the server or a playlist the
+            // segment loader can't serve: mpv reads it itself
+            qCDebug(MpvQt_QMpv) << "Reopening" << m_source.value() << "directly";
+            m_adaptiveBitrate->setLoaderSource({});
+            m_loadUrl = m_source.value().toString();
+            m_pendingSource = m_loadUrl;
+            loadPendingSource();
+            return;
+        }
+        if (reason != QStringLiteral("error")) {
+            return;
+        }
+        if (m_isProbing) {
+            widenProbe();
+        } else if (!m_isFileLoaded && m_probeEntry.isValid()) {
+            // without fast start only the demuxer comes from MpvProbeCache, and it
+            // doesn't fit the source anymore: let lavf detect it
+            qCDebug(MpvQt_QMpv) << "Reopening" << m_source.value() << "without its cached demuxer";
+            MpvProbeCache::instance()->remove(m_source.value());
+            m_probeEntry = {};
+            m_sniffedFormat.clear();
+            applyDemuxerOptions();
+            m_pendingSource = m_loadUrl;
+            loadPendingSource();
+        }
+    });
 
-    // Schedule a redraw to recreate the renderer
-    update();
+    m_adaptiveBitrate = new MpvAdaptiveBitrate(this);
+    connect(m_adaptiveBitrate, &MpvAdaptiveBitrate::currentBitrateChanged, this, &QMpv::currentBitrateChanged);
+    connect(m_adaptiveBitrate, &MpvAdaptiveBitrate::targetBitrateChanged, this, &QMpv::targetBitrateChanged);
+    connect(m_adaptiveBitrate, &MpvAdaptiveBitrate::switchCountChanged, this, &QMpv::bitrateSwitchCountChanged);
 
-    // Let Qt know to invalidate the scene graph
+    m_playbackState.setBinding([this] {
+        if (m_stopped.value()) {
+            return StoppedState;
+        }
+        return m_paused.value() ? PausedState : PlayingState;
+    });
 }
 QQuickFramebufferObject::Renderer *QMpv::createRenderer() const
 {
@@ -84,34 +163,85 @@ QMpv::~QMpv()
 
 qreal QMpv::position()
 {
-    return m_position;
+    return m_position.value();
 }
 
 qreal QMpv::duration()
 {
-    return m_duration;
+    return m_duration.value();
 }
 
 bool QMpv::paused()
 {
-    return m_paused;
+    return m_paused.value();
 }
 
 bool QMpv::buffering()
 {
-    return m_buffering;
+    return m_buffering.value();
+}
+
+QBindable<qreal> QMpv::bindablePosition()
+{
+    return &m_position;
+}
+
+QBindable<qreal> QMpv::bindableDuration()
+{
+    return &m_duration;
+}
+
+QBindable<bool> QMpv::bindablePaused()
+{
+    return &m_paused;
+}
+
+QBindable<bool> QMpv::bindableStopped()
+{
+    return &m_stopped;
+}
+
+QBindable<bool> QMpv::bindableBuffering()
+{
+    return &m_buffering;
+}
+
+QBindable<QUrl> QMpv::bindableSource()
+{
+    return &m_source;
+}
+
+QBindable<qreal> QMpv::bindablePlaybackRate()
+{
+    return &m_playbackrate;
+}
+
+QBindable<qreal> QMpv::bindableVolume()
+{
+    return &m_volume;
+}
+
+QBindable<QMpv::PlaybackState> QMpv::bindablePlaybackState()
+{
+    return &m_playbackState;
+}
+
+QBindable<QMpv::FillMode> QMpv::bindableFillMode()
+{
+    return &m_fillMode;
 }
 
 void QMpv::play()
 {
+    // hibernated while paused, see pausedHibernationDelay
+    if (isHibernated()) {
+        resume();
+    }
     if (!paused()) {
         return;
     }
+    // paused and playbackState follow once mpv reports the change
     setProperty(QStringLiteral("pause"), false);
-    m_playbackState = PlayingState;
-
-    Q_EMIT playbackStateChanged();
-    Q_EMIT pausedChanged();
 }
 
 void QMpv::pause()
@@ -120,20 +250,12 @@ void QMpv::pause()
         return;
     }
     setProperty(QStringLiteral("pause"), true);
-    m_playbackState = PausedState;
-
-    Q_EMIT playbackStateChanged();
-    Q_EMIT pausedChanged();
 }
 
 void QMpv::stop() {
     setPosition(0);
     setProperty(QStringLiteral("stop"), true);
     m_stopped = true;
-    m_playbackState = StoppedState;
-
-    Q_EMIT playbackStateChanged();
-    Q_EMIT stoppedChanged();
 }
 
 void QMpv::setPosition(double value)
@@ -141,46 +263,375 @@ void QMpv::setPosition(double value)
     if (value == position()) {
         return;
     }
+    // position follows the time-pos change reported by mpv
+    startSeek();
     setProperty(QStringLiteral("time-pos"), value);
-    Q_EMIT positionChanged();
 }
 
 void QMpv::seek(qreal offset)
 {
+    startSeek();
     Q_EMIT command(QStringList() << QStringLiteral("add") << QStringLiteral("time-pos") << QString::number(offset));
 }
 
 
 void QMpv::setSource(const QUrl &url) {
-    // Store the new source URL
-    if (m_source != url) {
-        m_source = url;
-        Q_EMIT sourceChanged();
-    }
-
-    // Reset the renderer state
-    resetRenderer();
-
-    // apply decryption key always - the server streams encrypted files,
-    // external CDN plain .mp4 URLs that don't need it are harmlessly rejected by lavf.
-    // We force the 'mov' demuxer and Use massive probesize/analyzeduration for fragmented CENC compatibility.
-    // We also provide the decryption_key_id which is essential for matching keys to fragments in a fragmented stream.
-    setProperty(QStringLiteral("demuxer-lavf-format"), QStringLiteral("mov"));
-    setProperty(QStringLiteral("demuxer-lavf-o"), QStringLiteral("decryption_key=b45b4a1c441d30ea134075e3cde260d3,decryption_key_id=e40c050015175ead3b2de4dd94bd1360,probesize=50000000,analyzeduration=50000000"));
-    setProperty(QStringLiteral("demuxer-max-bytes"), QStringLiteral("2048MiB"));
-    setProperty(QStringLiteral("demuxer-readahead-secs"), 30);
-
-    // Use a short delay to ensure the renderer has time to reset
-    QTimer::singleShot(100, this, [this, url]() {
-        qDebug() << "Loading video:" << url.toString();
-        Q_EMIT command(QStringList() << QStringLiteral("loadfile") << url.toString());
+    // Store the new source URL, sourceChanged is only emitted if it differs
+    m_source = url;
+
+    m_decryptionKey = m_keyProvider ? m_keyProvider->resolve(url) : MpvDecryptionKey();
+    // the previous source isn't loaded anymore while this one's entry is validated
+    m_pendingSource.clear();
+    const quint64 generation = ++m_sourceGeneration;
+    auto cache = MpvProbeCache::instance();
+    MpvProbeEntry entry = cache->lookup(url);
+    if (entry.isValid() && entry.keyId != m_decryptionKey.keyId) {
+        // probed with another key, which may select another demuxer and layout
+        entry = {};
+    }
+    if (entry.isValid() && !url.isLocalFile()) {
+        cache->validate(url, entry, this, [this, generation, entry](bool isValid) {
+            if (generation == m_sourceGeneration) {
+                openSource(isValid ? entry : MpvProbeEntry());
+            }
+        });
+        return;
+    }
+    openSource(entry);
+}
+
+void QMpv::openSource(const MpvProbeEntry &probeEntry)
+{
+    const QUrl url = m_source.value();
+    // a source probed before opens with the demuxer and probe level it needed then
+    m_probeEntry = probeEntry;
+    m_probeResult.clear();
+    m_isRecordingProbe = MpvProbeCache::instance()->isEnabled();
+    if (m_probeEntry.isValid()) {
+        m_sniffedFormat = m_probeEntry.format;
+        setProbeLevel(m_fastStart ? qMax(0, m_probeEntry.probeLevel) : -1);
+    } else {
+        m_sniffedFormat = m_fastStart ? MpvProbe::sniffFormat(url) : QString();
+        setProbeLevel(m_fastStart ? 0 : -1);
+    }
+    m_isProbing = m_fastStart;
+    m_adaptiveBitrate->reset();
+
+    // a fragmented MP4 file scanned before opens with its fragment index,
+    // a new one is scanned now for the next time; remote files get theirs
+    // from MpvHttpCache once they were played through it
+    m_isSeekPending = false;
+    m_isFileLoaded = false;
+    const QString format = m_sniffedFormat.isEmpty() ? MpvProbe::sniffFormat(url) : m_sniffedFormat;
+    const bool isMp4 = format == QStringLiteral("mov") || m_decryptionKey.isValid();
+    MpvFragmentIndex fragmentIndex;
+    if (isMp4 && url.isLocalFile()) {
+        auto fragmentCache = MpvFragmentIndexCache::instance();
+        fragmentIndex = fragmentCache->lookup(url);
+        if (!fragmentIndex.isValid()) {
+            fragmentCache->build(url);
+        }
+    }
+    const bool isRemotelyIndexed = isMp4 && isProxiable() && MpvHttpCache::instance()->isCacheable(url) && MpvHttpCache::instance()->hasFragmentIndex(url);
+    // files that turned out not to need an index would only dilute the statistics
+    m_isRecordingSeeks = isMp4 && (!fragmentIndex.isValid() || fragmentIndex.isUseful());
+    setFragmentIndexed(fragmentIndex.isUseful() || isRemotelyIndexed);
+    if (MpvResourceProtocol::isResource(url)) {
+        // read from the mapped resource, without extracting it to a file
+        m_loadUrl = MpvStreamProtocol::url(MpvResourceProtocol::Scheme, url);
+    } else if (url.scheme() == MpvDeviceProtocol::SourceScheme) {
+        m_loadUrl = MpvStreamProtocol::url(MpvDeviceProtocol::Scheme, url);
+    } else if (fragmentIndex.isUseful()) {
+        m_loadUrl = MpvStreamProtocol::url(MpvFragmentIndexProtocol::Scheme, url);
+    } else if (m_memoryMappedFiles && url.isLocalFile()) {
+        m_loadUrl = MpvStreamProtocol::url(MpvMappedFileProtocol::Scheme, url);
+    } else if (isProxiable() && MpvSegmentLoader::instance()->isLoadable(url)) {
+        // upcoming segments are fetched in parallel
+        m_loadUrl = MpvStreamProtocol::url(MpvSegmentLoaderProtocol::Scheme, url);
+    } else if (isProxiable() && MpvHttpCache::instance()->isCacheable(url)) {
+        // fetched ranges are kept on disk, for rewatching and seeking back
+        m_loadUrl = MpvStreamProtocol::url(MpvHttpCacheProtocol::Scheme, url);
+    } else {
+        m_loadUrl = url.toString();
+    }
+    // mpv sees a single stream from the segment loader, which switches the variants
+    const bool isSegmentLoaded = m_loadUrl.startsWith(MpvSegmentLoaderProtocol::Scheme + QStringLiteral("://"));
+    m_adaptiveBitrate->setLoaderSource(isSegmentLoaded ? url : QUrl());
+
+    // demuxer-readahead-secs is set by MpvBandwidthArbiter
+    applyDemuxerOptions();
+
+    // The render context stays valid across files, so there is no need to stop
+    // or to reinitialize the video output: "loadfile replace" keeps the VO alive
+    // and mpv keeps redrawing the last frame until the new file's first frame
+    // arrives. Without a render context yet, wait for ready().
+    m_pendingSource = m_loadUrl;
+    if (isRendererReady()) {
+        loadPendingSource();
+    }
+}
+
+bool QMpv::isProxiable() const
+{
+    // options of mpv's own network access, which MpvHttpCache and MpvSegmentLoader don't have
+    static const QStringList networkOptions{
+        QStringLiteral("user-agent"),
+        QStringLiteral("referrer"),
+        QStringLiteral("http-header-fields"),
+        QStringLiteral("cookies"),
+        QStringLiteral("cookies-file"),
+        QStringLiteral("http-proxy"),
+        QStringLiteral("tls-verify"),
+        QStringLiteral("tls-ca-file"),
+        QStringLiteral("tls-cert-file"),
+        QStringLiteral("tls-key-file"),
+        QStringLiteral("ytdl-format"),
+        QStringLiteral("ytdl-raw-options"),
+    };
+    return std::none_of(networkOptions.cbegin(), networkOptions.cend(), [this](const QString &option) {
+        return isUserOption(option);
     });
 }
 
+void QMpv::applyDemuxerOptions()
+{
+    // Only encrypted sources get the mov demuxer forced and the decryption options;
+    // everything else uses the sniffed demuxer or lavf's own format detection,
+    // without options left over from the previous file.
+    QStringList lavfOptions;
+    if (m_decryptionKey.isValid()) {
+        // the key ID is needed to match the key to the fragments of a fragmented stream
+        setProperty(QStringLiteral("demuxer-lavf-format"), QStringLiteral("mov"));
+        lavfOptions << QStringLiteral("decryption_key=%1").arg(QString::fromLatin1(m_decryptionKey.key))
+                    << QStringLiteral("decryption_key_id=%1").arg(QString::fromLatin1(m_decryptionKey.keyId));
+    } else {
+        setProperty(QStringLiteral("demuxer-lavf-format"), m_sniffedFormat);
+    }
+    if (m_isFragmentIndexed) {
+        // the fragment index is served as an mfra box, see MpvFragmentIndexProtocol
+        lavfOptions << QStringLiteral("use_mfra_for=dts");
+    }
+    setProperty(QStringLiteral("demuxer-lavf-o"), lavfOptions.join(QLatin1Char(',')));
+
+    // lavf's defaults, replacing the previous source's level; without fast start
+    // fragmented CENC files get the deep probing they may need
+    MpvProbeLevel probe = MpvProbe::lavfDefault();
+    if (m_probeLevel >= 0) {
+        probe = MpvProbe::level(m_probeLevel);
+    } else if (m_decryptionKey.isValid()) {
+        probe = MpvProbe::level(MpvProbe::LevelCount - 1);
+    }
+    setProperty(QStringLiteral("demuxer-lavf-probesize"), probe.probeSize);
+    setProperty(QStringLiteral("demuxer-lavf-analyzeduration"), probe.analyzeDuration);
+}
+
+void QMpv::setProbeLevel(int level)
+{
+    if (m_probeLevel == level) {
+        return;
+    }
+    m_probeLevel = level;
+    Q_EMIT probeLevelChanged();
+}
+
+void QMpv::widenProbe()
+{
+    if (m_probeLevel + 1 >= MpvProbe::LevelCount) {
+        m_isProbing = false;
+        Q_EMIT probeFinished(m_source.value(), -1);
+        return;
+    }
+    // a wrong guess of the demuxer is as likely as a too small probe
+    m_sniffedFormat.clear();
+    m_probeResult.clear();
+    // the cached entry was wrong, the result of this probe replaces it
+    m_probeEntry = {};
+    setProbeLevel(m_probeLevel + 1);
+    applyDemuxerOptions();
+    m_pendingSource = m_loadUrl;
+    loadPendingSource();
+}
+
+void QMpv::onProbeReply(const QVariant &data, mpv_event event)
+{
+    static const QStringList properties{
+        QStringLiteral("track-list"),
+        QStringLiteral("file-format"),
+        QStringLiteral("duration"),
+        QStringLiteral("file-size"),
+    };
+    const qint64 index = qint64(event.reply_userdata) - ProbeReplyId;
+    if (index < 0 || index >= properties.size()) {
+        return;
+    }
+    m_probeResult.insert(properties.at(index), data);
+
+    if (index == 0 && m_isProbing) {
+        if (!MpvProbe::hasStreamParameters(data)) {
+            widenProbe();
+            return;
+        }
+        m_isProbing = false;
+        Q_EMIT probeFinished(m_source.value(), m_probeLevel);
+    }
+    if (m_isRecordingProbe && !m_isProbing && m_probeResult.size() == properties.size()) {
+        recordProbe();
+    }
+}
+
+void QMpv::recordProbe()
+{
+    m_isRecordingProbe = false;
+    const auto result = std::exchange(m_probeResult, {});
+
+    MpvProbeEntry entry;
+    // lavf reports all names of the demuxer ("mov,mp4,m4a,..."), the first one selects it
+    entry.format = result.value(QStringLiteral("file-format")).toString().section(QLatin1Char(','), 0, 0);
+    entry.probeLevel = m_probeLevel;
+    entry.duration = result.value(QStringLiteral("duration")).toDouble();
+    entry.fileSize = result.value(QStringLiteral("file-size")).toLongLong();
+    entry.keyId = m_decryptionKey.keyId;
+    entry.openTime = m_openTime;
+    const auto tracks = result.value(QStringLiteral("track-list")).toList();
+    for (const auto &track : tracks) {
+        const auto map = track.toMap();
+        QVariantMap layout;
+        for (const auto &key : {"type", "codec", "demux-w", "demux-h", "demux-samplerate", "demux-channel-count"}) {
+            const QString name = QString::fromLatin1(key);
+            if (map.contains(name)) {
+                layout.insert(name, map.value(name));
+            }
+        }
+        entry.tracks.append(layout);
+    }
+
+    auto cache = MpvProbeCache::instance();
+    const QUrl source = m_source.value();
+    // the entry was validated before use; a file that doesn't match it anyway is probed anew
+    if (m_probeEntry.isValid() && m_probeEntry.fileSize == entry.fileSize && qAbs(m_probeEntry.duration - entry.duration) < 1) {
+        cache->recordHit(source, m_openTime);
+    } else {
+        cache->insert(source, entry);
+    }
+    m_probeEntry = {};
+}
+
+bool QMpv::fastStart() const
+{
+    return m_fastStart;
+}
+
+void QMpv::setFastStart(bool fastStart)
+{
+    if (m_fastStart == fastStart) {
+        return;
+    }
+    m_fastStart = fastStart;
+    Q_EMIT fastStartChanged();
+}
+
+int QMpv::probeLevel() const
+{
+    return m_probeLevel;
+}
+
+bool QMpv::fragmentIndexed() const
+{
+    return m_isFragmentIndexed;
+}
+
+void QMpv::setFragmentIndexed(bool isIndexed)
+{
+    if (m_isFragmentIndexed == isIndexed) {
+        return;
+    }
+    m_isFragmentIndexed = isIndexed;
+    Q_EMIT fragmentIndexedChanged();
+}
+
+qint64 QMpv::seekLatency() const
+{
+    return m_seekLatency;
+}
+
+bool QMpv::memoryMappedFiles() const
+{
+    return m_memoryMappedFiles;
+}
+
+void QMpv::setMemoryMappedFiles(bool isMapped)
+{
+    if (m_memoryMappedFiles == isMapped) {
+        return;
+    }
+    m_memoryMappedFiles = isMapped;
+    Q_EMIT memoryMappedFilesChanged();
+}
+
+bool QMpv::adaptiveBitrate() const
+{
+    return m_adaptiveBitrate->isEnabled();
+}
+
+void QMpv::setAdaptiveBitrate(bool isAdaptive)
+{
+    if (m_adaptiveBitrate->isEnabled() == isAdaptive) {
+        return;
+    }
+    m_adaptiveBitrate->setEnabled(isAdaptive);
+    Q_EMIT adaptiveBitrateChanged();
+}
+
+qint64 QMpv::currentBitrate() const
+{
+    return m_adaptiveBitrate->currentBitrate();
+}
+
+qint64 QMpv::targetBitrate() const
+{
+    return m_adaptiveBitrate->targetBitrate();
+}
+
+int QMpv::bitrateSwitchCount() const
+{
+    return m_adaptiveBitrate->switchCount();
+}
+
+void QMpv::startSeek()
+{
+    // a seek replacing one still running is measured from the last request
+    m_seekTimer.start();
+    m_isSeekPending = true;
+}
+
+void QMpv::onPlaybackRestart()
+{
+    if (!m_isSeekPending) {
+        return;
+    }
+    m_isSeekPending = false;
+    m_seekLatency = m_seekTimer.elapsed();
+    Q_EMIT seekLatencyChanged();
+    if (m_isRecordingSeeks) {
+        MpvFragmentIndexCache::instance()->recordSeek(m_seekLatency, m_isFragmentIndexed);
+    }
+}
+
+void QMpv::loadPendingSource()
+{
+    if (m_pendingSource.isEmpty() || !isRendererReady()) {
+        return;
+    }
+    const QString url = std::exchange(m_pendingSource, QString());
+    m_openTimer.start();
+    qDebug() << "Loading video:" << url;
+    Q_EMIT command(QStringList() << QStringLiteral("loadfile") << url << QStringLiteral("replace"));
+}
+
 
 
 QUrl QMpv::source() const {
-    return m_source;
+    return m_source.value();
 }
 
 void QMpv::setplaybackRate(qreal rate){
@@ -189,32 +640,63 @@ void QMpv::setplaybackRate(qreal rate){
         return;
     }
     setProperty(QStringLiteral("speed"), rate);
-    Q_EMIT playbackRateChanged();
 }
 
 qreal QMpv::playbackRate(){
-    return m_playbackrate;
+    return m_playbackrate.value();
 }
 
 void QMpv::setVolume(qreal vol){
     qDebug()<<"C++ setvolume : "<<vol;
-    if (vol == m_volume) {
+    if (vol == m_volume.value()) {
         return;
     }
 
     setProperty(QStringLiteral("volume"), vol*100);
-    Q_EMIT volumeChanged();
 }
 
 qreal QMpv::volume(){
-    return m_volume;
+    return m_volume.value();
 }
 
 QMpv::PlaybackState QMpv::playbackState(){
-    return m_playbackState;
+    return m_playbackState.value();
 }
 QMpv::FillMode QMpv::fillMode(){
-    return m_fillMode;
+    return m_fillMode.value();
+}
+
+QJSValue QMpv::keyProvider() const
+{
+    auto provider = dynamic_cast<MpvJSKeyProvider *>(m_keyProvider.get());
+    return provider ? provider->handler() : QJSValue();
+}
+
+void QMpv::setKeyProvider(const QJSValue &handler)
+{
+    if (handler.isNull() || handler.isUndefined()) {
+        setDecryptionKeyProvider(nullptr);
+        return;
+    }
+    if (!handler.isCallable()) {
+        qCWarning(MpvQt_QMpv) << "keyProvider must be a function";
+        return;
+    }
+    setDecryptionKeyProvider(std::make_shared<MpvJSKeyProvider>(handler));
+}
+
+void QMpv::setDecryptionKeyProvider(std::shared_ptr<MpvKeyProvider> provider)
+{
+    if (m_keyProvider == provider) {
+        return;
+    }
+    m_keyProvider = std::move(provider);
+    Q_EMIT keyProviderChanged();
+}
+
+std::shared_ptr<MpvKeyProvider> QMpv::decryptionKeyProvider() const
+{
+    return m_keyProvider;
 }
 void QMpv::setFillMode(FillMode mode) {
     switch (mode) {
@@ -233,36 +715,27 @@ void QMpv::setFillMode(FillMode mode) {
     default:
         break;
     }
-    Q_EMIT fillModeChanged();
 }
 void QMpv::onPropertyChanged(const QString &property, const QVariant &value)
 {
 
+    // the bindable properties only notify when the value actually changes
     if (property == QStringLiteral("time-pos")) {
         double time = value.toDouble();
         m_position = time;
-        Q_EMIT positionChanged();
-        if (m_position > 0.0 && m_stopped) {
+        if (time > 0.0) {
             m_stopped = false;
-            Q_EMIT stoppedChanged();
         }
     } else if (property == QStringLiteral("duration")) {
         double time = value.toDouble();
         m_duration = time;
-        Q_EMIT durationChanged();
     } else if (property == QStringLiteral("pause")) {
         m_paused = value.toBool();
-        Q_EMIT pausedChanged();
     } else if (property == QStringLiteral("paused-for-cache") || property == QStringLiteral("core-idle")) {
-        bool idle = value.toBool();
-        if (m_buffering != idle) {
-            m_buffering = idle;
-            Q_EMIT bufferingChanged();
-        }
+        m_buffering = value.toBool();
     }
     else if (property == QStringLiteral("path")) {
-        m_source = value.toString();
-        Q_EMIT sourceChanged();
+        m_source = MpvStreamProtocol::source(value.toString());
     }else if (property == QStringLiteral("speed")) {
         double rate = value.toDouble();
         m_playbackrate = rate;
@@ -272,9 +745,8 @@ void QMpv::onPropertyChanged(const QString &property, const QVariant &value)
         qreal volume =  value.toDouble() / 100;
         qDebug()<<"C++ volume : "<<volume;
         m_volume=volume;
-        Q_EMIT volumeChanged();
     }
 }
 
-bool QMpv::stopped() { return m_stopped; }
+bool QMpv::stopped() { return m_stopped.value(); }
 
@@ -8,22 +8,49 @@
 #define QMPV_H
 
 #include "mpvabstractitem.h"
+#include "mpvadaptivebitrate.h"
+#include "mpvfragmentindex.h"
+#include "mpvkeyprovider.h"
+#include "mpvprobecache.h"
+#include <QElapsedTimer>
+#include <QJSValue>
+#include <QProperty>
 #include <QQuickFramebufferObject>
-#include <QTimer>
+#include <QtQml/qqmlregistration.h>
 
 class QMpv : public MpvAbstractItem
 {
     Q_OBJECT
+    QML_NAMED_ELEMENT(QMpv)
     Q_PROPERTY(qreal position READ position WRITE setPosition NOTIFY positionChanged)
-    Q_PROPERTY(qreal duration READ duration NOTIFY durationChanged)
-    Q_PROPERTY(bool paused READ paused NOTIFY pausedChanged)
-    Q_PROPERTY(bool stopped READ stopped NOTIFY stoppedChanged)
-    Q_PROPERTY(bool buffering READ buffering NOTIFY bufferingChanged)
+    Q_PROPERTY(qreal duration READ duration NOTIFY durationChanged BINDABLE bindableDuration)
+    Q_PROPERTY(bool paused READ paused NOTIFY pausedChanged BINDABLE bindablePaused)
+    Q_PROPERTY(bool stopped READ stopped NOTIFY stoppedChanged BINDABLE bindableStopped)
+    Q_PROPERTY(bool buffering READ buffering NOTIFY bufferingChanged BINDABLE bindableBuffering)
     Q_PROPERTY(QUrl source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(qreal playbackRate READ playbackRate WRITE setplaybackRate NOTIFY playbackRateChanged)
     Q_PROPERTY(qreal volume READ volume WRITE setVolume NOTIFY volumeChanged)
-    Q_PROPERTY(PlaybackState playbackState READ playbackState NOTIFY playbackStateChanged)
+    Q_PROPERTY(PlaybackState playbackState READ playbackState NOTIFY playbackStateChanged BINDABLE bindablePlaybackState)
     Q_PROPERTY(FillMode fillMode READ fillMode WRITE setFillMode NOTIFY fillModeChanged)
+    // start with a small probe and widen it only when needed, see MpvProbe; applies from the next source
+    Q_PROPERTY(bool fastStart READ fastStart WRITE setFastStart NOTIFY fastStartChanged)
+    // probe level the current source needed, -1 without fast start
+    Q_PROPERTY(int probeLevel READ probeLevel NOTIFY probeLevelChanged)
+    // function(source) returning the {keyId, key} of encrypted sources, see MpvJSKeyProvider
+    Q_PROPERTY(QJSValue keyProvider READ keyProvider WRITE setKeyProvider NOTIFY keyProviderChanged)
+    // whether the current source was opened with its fragment index, see MpvFragmentIndexCache and MpvHttpCache
+    Q_PROPERTY(bool fragmentIndexed READ fragmentIndexed NOTIFY fragmentIndexedChanged)
+    // milliseconds from the last seek to playback restarting, -1 before the first one
+    Q_PROPERTY(qint64 seekLatency READ seekLatency NOTIFY seekLatencyChanged)
+    // read local files through a memory mapping, see MpvMappedFileProtocol; applies from the next source
+    Q_PROPERTY(bool memoryMappedFiles READ memoryMappedFiles WRITE setMemoryMappedFiles NOTIFY memoryMappedFilesChanged)
+    // switch between the variants of HLS streams by throughput, see MpvAdaptiveBitrate; off by default
+    Q_PROPERTY(bool adaptiveBitrate READ adaptiveBitrate WRITE setAdaptiveBitrate NOTIFY adaptiveBitrateChanged)
+    // bits per second of the selected variant and of the one throughput allows, 0 without variants
+    Q_PROPERTY(qint64 currentBitrate READ currentBitrate NOTIFY currentBitrateChanged)
+    Q_PROPERTY(qint64 targetBitrate READ targetBitrate NOTIFY targetBitrateChanged)
+    // variant switches made for the current source
+    Q_PROPERTY(int bitrateSwitchCount READ bitrateSwitchCount NOTIFY bitrateSwitchCountChanged)
 
     enum PlaybackState {
         StoppedState,
@@ -54,6 +81,42 @@ public:
     qreal volume();
     PlaybackState playbackState();
     FillMode fillMode();
+    bool fastStart() const;
+    void setFastStart(bool fastStart);
+    int probeLevel() const;
+    QJSValue keyProvider() const;
+    void setKeyProvider(const QJSValue &handler);
+    bool fragmentIndexed() const;
+    qint64 seekLatency() const;
+    bool memoryMappedFiles() const;
+    void setMemoryMappedFiles(bool isMapped);
+    bool adaptiveBitrate() const;
+    void setAdaptiveBitrate(bool isAdaptive);
+    qint64 currentBitrate() const;
+    qint64 targetBitrate() const;
+    int bitrateSwitchCount() const;
+
+    /**
+     * Resolves the keys of encrypted sources, applied from the next setSource().
+     * Without a provider every source is opened as plain media.
+     */
+    void setDecryptionKeyProvider(std::shared_ptr<MpvKeyProvider> provider);
+    std::shared_ptr<MpvKeyProvider> decryptionKeyProvider() const;
+
+    // The writable properties are mpv-backed and only change once mpv reports
+    // the new value, so their bindables are for observing from C++; binding
+    // them from QML would bypass the setters. Bind to them via the setters instead.
+    QBindable<qreal> bindablePosition();
+    QBindable<qreal> bindableDuration();
+    QBindable<bool> bindablePaused();
+    QBindable<bool> bindableStopped();
+    QBindable<bool> bindableBuffering();
+    QBindable<QUrl> bindableSource();
+    QBindable<qreal> bindablePlaybackRate();
+    QBindable<qreal> bindableVolume();
+    QBindable<PlaybackState> bindablePlaybackState();
+    QBindable<FillMode> bindableFillMode();
+
         QQuickFramebufferObject::Renderer *createRenderer() const override;
 public Q_SLOTS:
     void play();
@@ -65,7 +128,6 @@ public Q_SLOTS:
     void setplaybackRate(qreal rate);
     void setVolume(qreal vol);
     void setFillMode(FillMode mode);
-    void resetRenderer();
 Q_SIGNALS:
     void positionChanged();
     void durationChanged();
@@ -77,18 +139,80 @@ Q_SIGNALS:
     void volumeChanged();
     void playbackStateChanged();
     void fillModeChanged();
+    void keyProviderChanged();
+    void fastStartChanged();
+    void probeLevelChanged();
+    void fragmentIndexedChanged();
+    void seekLatencyChanged();
+    void memoryMappedFilesChanged();
+    void adaptiveBitrateChanged();
+    void currentBitrateChanged();
+    void targetBitrateChanged();
+    void bitrateSwitchCountChanged();
+    // the streams of @p source were found with @p level, -1 if no level was enough
+    void probeFinished(const QUrl &source, int level);
 
 private:
     void onPropertyChanged(const QString &property, const QVariant &value);
-    bool m_paused = true;
-    qreal m_position = 0;
-    qreal m_duration = 0;
-    bool m_stopped = true;
-    bool m_buffering = false;
-    QUrl m_source;
-    qreal m_playbackrate = 1.0;
-    qreal m_volume = 1.0;
-    PlaybackState m_playbackState;
-    FillMode m_fillMode=Stretch;
+    void loadPendingSource();
+    // opens the current source, after its @p probeEntry was looked up and validated
+    void openSource(const MpvProbeEntry &probeEntry);
+    // whether the current source may be read through MpvHttpCache or MpvSegmentLoader,
+    // which don't know the options of mpv's own network access
+    bool isProxiable() const;
+    // demuxer options of the current source, from its key and probe level
+    void applyDemuxerOptions();
+    void setProbeLevel(int level);
+    void widenProbe();
+    void onProbeReply(const QVariant &data, mpv_event event);
+    void recordProbe();
+    void setFragmentIndexed(bool isIndexed);
+    void startSeek();
+    void onPlaybackRestart();
+    // reply_userdata of the requests for what probing found: track-list, then
+    // file-format, duration and file-size with the following ids
+    static constexpr int ProbeReplyId = 0x50524f42;
+    // what mpv opens for the current source, wrapped in a protocol of MpvStreamProtocol if needed
+    QString m_loadUrl;
+    // source set before the render context existed, loaded once ready() is emitted
+    QString m_pendingSource;
+    // counts setSource() calls, so validations finishing after the next one are ignored
+    quint64 m_sourceGeneration{0};
+    std::shared_ptr<MpvKeyProvider> m_keyProvider;
+    MpvDecryptionKey m_decryptionKey;
+    bool m_fastStart{true};
+    int m_probeLevel{-1};
+    // set until the probe level of the current source is settled
+    bool m_isProbing{false};
+    QString m_sniffedFormat;
+    // from MpvProbeCache, invalid on a miss
+    MpvProbeEntry m_probeEntry;
+    // set until what probing the current source found is stored in MpvProbeCache
+    bool m_isRecordingProbe{false};
+    QVariantMap m_probeResult;
+    QElapsedTimer m_openTimer;
+    qint64 m_openTime{0};
+    // set once the current source is loaded, until the next one is set
+    bool m_isFileLoaded{false};
+    bool m_isFragmentIndexed{false};
+    // MP4 source whose seeks count in the statistics of MpvFragmentIndexCache
+    bool m_isRecordingSeeks{false};
+    // set from a seek until playback restarts
+    bool m_isSeekPending{false};
+    QElapsedTimer m_seekTimer;
+    qint64 m_seekLatency{-1};
+    bool m_memoryMappedFiles{false};
+    MpvAdaptiveBitrate *m_adaptiveBitrate;
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, bool, m_paused, true, &QMpv::pausedChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, qreal, m_position, 0, &QMpv::positionChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, qreal, m_duration, 0, &QMpv::durationChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, bool, m_stopped, true, &QMpv::stoppedChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, bool, m_buffering, false, &QMpv::bufferingChanged)
+    Q_OBJECT_BINDABLE_PROPERTY(QMpv, QUrl, m_source, &QMpv::sourceChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, qreal, m_playbackrate, 1.0, &QMpv::playbackRateChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, qreal, m_volume, 1.0, &QMpv::volumeChanged)
+    // bound to m_stopped and m_paused in the constructor
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, PlaybackState, m_playbackState, StoppedState, &QMpv::playbackStateChanged)
+    Q_OBJECT_BINDABLE_PROPERTY_WITH_ARGS(QMpv, FillMode, m_fillMode, Stretch, &QMpv::fillModeChanged)
 };
 #endif // QMPV_H
@@ -0,0 +1,41 @@
+// SPDX-FileCopyrightText: 2023 Akram Abdeslem Chaima <akram@riseup.net>
+//
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QtQml/QQmlEngineExtensionPlugin>
+
+// Generated by qmltyperegistrar from the QML_NAMED_ELEMENT/QML_ELEMENT
+// declarations, together with qmpv.qmltypes (see the qmldir), when the library
+// is built as a QML module:
+//     qt_add_qml_module(qmpv URI QMpv VERSION 1.0 PLUGIN_TARGET qmpv
+//                       CLASS_NAME QMpvPlugin NO_GENERATE_PLUGIN_SOURCE ...)
+// so the types are registered declaratively and qmlcachegen, qmlsc and
+// qmllint know them at build time.
+extern void qml_register_types_QMpv();
+Q_GHS_KEEP_REFERENCE(qml_register_types_QMpv)
+
+/**
+ * Plugin of the QMpv QML module.
+ *
+ * Works as a dynamic plugin loaded by the QML engine as well as a static one;
+ * applications linking it statically import it with
+ * @code
+ * Q_IMPORT_QML_PLUGIN(QMpvPlugin)
+ * @endcode
+ */
+class QMpvPlugin : public QQmlEngineExtensionPlugin
+{
+    Q_OBJECT
+    Q_PLUGIN_METADATA(IID QQmlEngineExtensionInterface_iid)
+
+public:
+    explicit QMpvPlugin(QObject *parent = nullptr)
+        : QQmlEngineExtensionPlugin(parent)
+    {
+        // keeps the registration function from being dropped by the linker in static builds
+        volatile auto registration = &qml_register_types_QMpv;
+        Q_UNUSED(registration)
+    }
+};
+
+#include "qmpvplugin.moc"